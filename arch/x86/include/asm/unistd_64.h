@@ -661,6 +661,10 @@ __SYSCALL(__NR_pwritev, sys_pwritev)
 __SYSCALL(__NR_rt_tgsigqueueinfo, sys_rt_tgsigqueueinfo)
 #define __NR_perf_event_open			298
 __SYSCALL(__NR_perf_event_open, sys_perf_event_open)
+#define __NR_sched_lottery_setattr		299
+__SYSCALL(__NR_sched_lottery_setattr, sys_sched_lottery_setattr)
+#define __NR_sched_lottery_getattr		300
+__SYSCALL(__NR_sched_lottery_getattr, sys_sched_lottery_getattr)
 
 #ifndef __NO_STUBS
 #define __ARCH_WANT_OLD_READDIR
@@ -0,0 +1,563 @@
+/*
+ *  Lottery i/o scheduler.
+ *
+ *  Requests are queued per submitting task. Each dispatch round draws a
+ *  winner among the tasks with pending requests, weighted by the lottery
+ *  tickets of the task, so the CPU share set with SCHED_LOTTERY also governs
+ *  the share of the disk.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/random.h>
+#include <linux/hash.h>
+#include <linux/sched.h>
+
+/*
+ * See Documentation/block/lottery-iosched.txt
+ */
+static const int quantum = 4;		/* requests dispatched per winning draw */
+static const int async_starved = 2;	/* max times sync can starve async */
+static const int default_tickets = 1;	/* tickets of non SCHED_LOTTERY tasks */
+
+#define LOTTERY_QHASH_SHIFT	6
+#define LOTTERY_QHASH_ENTRIES	(1 << LOTTERY_QHASH_SHIFT)
+
+/*
+ * per task queue of requests
+ */
+struct lottery_queue {
+	struct hlist_node hash;		/* on lottery_data->qhash by pid */
+	struct list_head busy;		/* on lottery_data->busy_list */
+
+	/*
+	 * requests are present on both sort_list and fifo
+	 */
+	struct rb_root sort_list[2];	/* by sector, indexed by data dir */
+	struct list_head fifo[2];	/* by arrival, indexed by sync */
+
+	pid_t pid;
+	unsigned long long tickets;	/* lt.tickets of the last submitter */
+	int ref;			/* allocated requests */
+	unsigned int queued;		/* requests on fifo lists */
+	unsigned int starved;		/* times sync has starved async */
+};
+
+struct lottery_data {
+	/*
+	 * run time data
+	 */
+	struct hlist_head qhash[LOTTERY_QHASH_ENTRIES];
+
+	/*
+	 * queues with pending requests and the sum of their tickets
+	 */
+	struct list_head busy_list;
+	unsigned long long busy_tickets;
+
+	/*
+	 * winner of the last draw and requests it dispatched since
+	 */
+	struct lottery_queue *active;
+	unsigned int dispatched;
+
+	unsigned int queued;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int quantum;
+	int async_starved;
+	int front_merges;
+};
+
+#define RQ_LQ(rq)	((struct lottery_queue *) (rq)->elevator_private)
+
+static inline int lottery_bio_sync(struct bio *bio)
+{
+	return bio_data_dir(bio) == READ ||
+		bio_rw_flagged(bio, BIO_RW_SYNCIO);
+}
+
+static inline unsigned long long lottery_task_tickets(struct task_struct *p)
+{
+	/* lt.tickets keeps its last value after the task left the class */
+	if (p->policy != SCHED_LOTTERY)
+		return default_tickets;
+
+	/* A ticket-less task would never win and starve its own requests */
+	return p->lt.tickets ? p->lt.tickets : 1;
+}
+
+static struct lottery_queue *
+lottery_find_queue(struct lottery_data *ld, pid_t pid)
+{
+	struct hlist_head *head = &ld->qhash[hash_long(pid, LOTTERY_QHASH_SHIFT)];
+	struct hlist_node *entry;
+	struct lottery_queue *lq;
+
+	hlist_for_each_entry(lq, entry, head, hash) {
+		if (lq->pid == pid)
+			return lq;
+	}
+
+	return NULL;
+}
+
+static void lottery_init_lq(struct lottery_data *ld, struct lottery_queue *lq,
+			    pid_t pid)
+{
+	INIT_LIST_HEAD(&lq->busy);
+	INIT_LIST_HEAD(&lq->fifo[BLK_RW_ASYNC]);
+	INIT_LIST_HEAD(&lq->fifo[BLK_RW_SYNC]);
+	lq->sort_list[READ] = RB_ROOT;
+	lq->sort_list[WRITE] = RB_ROOT;
+	lq->pid = pid;
+
+	hlist_add_head(&lq->hash, &ld->qhash[hash_long(pid, LOTTERY_QHASH_SHIFT)]);
+}
+
+/*
+ * refresh the tickets of a queue, keeping busy_tickets in sync
+ */
+static void lottery_set_tickets(struct lottery_data *ld,
+				struct lottery_queue *lq,
+				unsigned long long tickets)
+{
+	if (!list_empty(&lq->busy))
+		ld->busy_tickets = ld->busy_tickets - lq->tickets + tickets;
+
+	lq->tickets = tickets;
+}
+
+static void lottery_add_busy(struct lottery_data *ld, struct lottery_queue *lq)
+{
+	list_add_tail(&lq->busy, &ld->busy_list);
+	ld->busy_tickets += lq->tickets;
+}
+
+static void lottery_del_busy(struct lottery_data *ld, struct lottery_queue *lq)
+{
+	list_del_init(&lq->busy);
+	ld->busy_tickets -= lq->tickets;
+
+	if (ld->active == lq)
+		ld->active = NULL;
+}
+
+static void lottery_move_request(struct lottery_queue *lq,
+				 struct request *rq);
+
+static void
+lottery_add_rq_rb(struct lottery_queue *lq, struct request *rq)
+{
+	struct rb_root *root = &lq->sort_list[rq_data_dir(rq)];
+	struct request *__alias;
+
+	while (unlikely(__alias = elv_rb_add(root, rq)))
+		lottery_move_request(lq, __alias);
+}
+
+/*
+ * add rq to rbtree and fifo of the queue of its task
+ */
+static void
+lottery_add_request(struct request_queue *q, struct request *rq)
+{
+	struct lottery_data *ld = q->elevator->elevator_data;
+	struct lottery_queue *lq = RQ_LQ(rq);
+
+	lottery_add_rq_rb(lq, rq);
+
+	rq_set_fifo_time(rq, jiffies);
+	list_add_tail(&rq->queuelist, &lq->fifo[rq_is_sync(rq)]);
+
+	if (!lq->queued++)
+		lottery_add_busy(ld, lq);
+	ld->queued++;
+}
+
+/*
+ * remove rq from rbtree and fifo.
+ */
+static void lottery_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct lottery_data *ld = q->elevator->elevator_data;
+	struct lottery_queue *lq = RQ_LQ(rq);
+
+	rq_fifo_clear(rq);
+	elv_rb_del(&lq->sort_list[rq_data_dir(rq)], rq);
+
+	if (!--lq->queued)
+		lottery_del_busy(ld, lq);
+	ld->queued--;
+}
+
+static int
+lottery_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct lottery_data *ld = q->elevator->elevator_data;
+	struct lottery_queue *lq;
+	struct request *__rq;
+	sector_t sector;
+
+	/*
+	 * check for front merge within the queue of the submitting task
+	 */
+	if (!ld->front_merges)
+		return ELEVATOR_NO_MERGE;
+
+	lq = lottery_find_queue(ld, current->pid);
+	if (!lq)
+		return ELEVATOR_NO_MERGE;
+
+	sector = bio->bi_sector + bio_sectors(bio);
+	__rq = elv_rb_find(&lq->sort_list[bio_data_dir(bio)], sector);
+	if (__rq) {
+		BUG_ON(sector != blk_rq_pos(__rq));
+
+		if (elv_rq_merge_ok(__rq, bio)) {
+			*req = __rq;
+			return ELEVATOR_FRONT_MERGE;
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void lottery_merged_request(struct request_queue *q,
+				   struct request *req, int type)
+{
+	struct lottery_queue *lq = RQ_LQ(req);
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(&lq->sort_list[rq_data_dir(req)], req);
+		lottery_add_rq_rb(lq, req);
+	}
+}
+
+static void
+lottery_merged_requests(struct request_queue *q, struct request *req,
+			struct request *next)
+{
+	/*
+	 * if next arrived before rq, move rq into its position in the fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+		}
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	lottery_remove_request(q, next);
+}
+
+/*
+ * only merge bios into requests of the same task, and never a sync bio into
+ * an async request
+ */
+static int lottery_allow_merge(struct request_queue *q, struct request *rq,
+			       struct bio *bio)
+{
+	struct lottery_data *ld = q->elevator->elevator_data;
+
+	if (lottery_bio_sync(bio) && !rq_is_sync(rq))
+		return 0;
+
+	return lottery_find_queue(ld, current->pid) == RQ_LQ(rq);
+}
+
+/*
+ * move an entry to dispatch queue
+ */
+static void
+lottery_move_request(struct lottery_queue *lq, struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	lottery_remove_request(q, rq);
+	elv_dispatch_add_tail(q, rq);
+}
+
+/*
+ * draw the queue to serve next, weighted by tickets
+ */
+static struct lottery_queue *lottery_draw(struct lottery_data *ld)
+{
+	struct lottery_queue *lq;
+	unsigned long long lottery;
+
+	if (list_empty(&ld->busy_list))
+		return NULL;
+
+	lottery = ((u64)random32() << 32 | random32()) % ld->busy_tickets;
+
+	list_for_each_entry(lq, &ld->busy_list, busy) {
+		if (lottery < lq->tickets)
+			return lq;
+		lottery -= lq->tickets;
+	}
+
+	/* Should never hit */
+	BUG();
+	return NULL;
+}
+
+/*
+ * serve sync requests first, unless async has been starved for too long
+ */
+static struct request *lottery_choose_request(struct lottery_data *ld,
+					      struct lottery_queue *lq)
+{
+	const int sync = !list_empty(&lq->fifo[BLK_RW_SYNC]);
+	const int async = !list_empty(&lq->fifo[BLK_RW_ASYNC]);
+
+	if (sync && !(async && lq->starved++ >= ld->async_starved))
+		return rq_entry_fifo(lq->fifo[BLK_RW_SYNC].next);
+
+	lq->starved = 0;
+	return rq_entry_fifo(lq->fifo[BLK_RW_ASYNC].next);
+}
+
+/*
+ * lottery_dispatch_requests keeps serving the winner of the last draw for up
+ * to quantum requests, then draws again
+ */
+static int lottery_dispatch_requests(struct request_queue *q, int force)
+{
+	struct lottery_data *ld = q->elevator->elevator_data;
+	struct lottery_queue *lq = ld->active;
+
+	if (!lq || ld->dispatched >= ld->quantum) {
+		lq = lottery_draw(ld);
+		if (!lq)
+			return 0;
+
+		ld->active = lq;
+		ld->dispatched = 0;
+	}
+
+	ld->dispatched++;
+	lottery_move_request(lq, lottery_choose_request(ld, lq));
+
+	return 1;
+}
+
+static int lottery_queue_empty(struct request_queue *q)
+{
+	struct lottery_data *ld = q->elevator->elevator_data;
+
+	return !ld->queued;
+}
+
+/*
+ * attach the request to the queue of the submitting task, creating it on the
+ * first request of the task
+ */
+static int
+lottery_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
+{
+	struct lottery_data *ld = q->elevator->elevator_data;
+	struct lottery_queue *lq, *new = NULL;
+	unsigned long flags;
+
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	lq = lottery_find_queue(ld, current->pid);
+	if (!lq) {
+		spin_unlock_irqrestore(q->queue_lock, flags);
+
+		new = kmalloc_node(sizeof(*new), gfp_mask | __GFP_ZERO,
+				   q->node);
+		if (!new)
+			return 1;
+
+		spin_lock_irqsave(q->queue_lock, flags);
+		lq = lottery_find_queue(ld, current->pid);
+		if (!lq) {
+			lq = new;
+			new = NULL;
+			lottery_init_lq(ld, lq, current->pid);
+		}
+	}
+
+	lq->ref++;
+	lottery_set_tickets(ld, lq, lottery_task_tickets(current));
+	rq->elevator_private = lq;
+	spin_unlock_irqrestore(q->queue_lock, flags);
+
+	kfree(new);
+	return 0;
+}
+
+/*
+ * drop the queue once its last request is freed, called with queue_lock held
+ */
+static void lottery_put_request(struct request *rq)
+{
+	struct lottery_queue *lq = RQ_LQ(rq);
+
+	if (!lq)
+		return;
+
+	rq->elevator_private = NULL;
+	if (--lq->ref)
+		return;
+
+	BUG_ON(lq->queued);
+	hlist_del(&lq->hash);
+	kfree(lq);
+}
+
+static void lottery_exit_queue(struct elevator_queue *e)
+{
+	struct lottery_data *ld = e->elevator_data;
+	int i;
+
+	BUG_ON(ld->queued);
+
+	for (i = 0; i < LOTTERY_QHASH_ENTRIES; i++)
+		BUG_ON(!hlist_empty(&ld->qhash[i]));
+
+	kfree(ld);
+}
+
+/*
+ * initialize elevator private data (lottery_data).
+ */
+static void *lottery_init_queue(struct request_queue *q)
+{
+	struct lottery_data *ld;
+	int i;
+
+	ld = kmalloc_node(sizeof(*ld), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!ld)
+		return NULL;
+
+	for (i = 0; i < LOTTERY_QHASH_ENTRIES; i++)
+		INIT_HLIST_HEAD(&ld->qhash[i]);
+	INIT_LIST_HEAD(&ld->busy_list);
+	ld->quantum = quantum;
+	ld->async_starved = async_starved;
+	ld->front_merges = 1;
+	return ld;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+lottery_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+lottery_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR)					\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct lottery_data *ld = e->elevator_data;			\
+	return lottery_var_show(__VAR, (page));				\
+}
+SHOW_FUNCTION(lottery_quantum_show, ld->quantum);
+SHOW_FUNCTION(lottery_async_starved_show, ld->async_starved);
+SHOW_FUNCTION(lottery_front_merges_show, ld->front_merges);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)				\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct lottery_data *ld = e->elevator_data;			\
+	int __data;							\
+	int ret = lottery_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	*(__PTR) = __data;						\
+	return ret;							\
+}
+STORE_FUNCTION(lottery_quantum_store, &ld->quantum, 1, INT_MAX);
+STORE_FUNCTION(lottery_async_starved_store, &ld->async_starved, 0, INT_MAX);
+STORE_FUNCTION(lottery_front_merges_store, &ld->front_merges, 0, 1);
+#undef STORE_FUNCTION
+
+#define LD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, lottery_##name##_show, \
+				      lottery_##name##_store)
+
+static struct elv_fs_entry lottery_attrs[] = {
+	LD_ATTR(quantum),
+	LD_ATTR(async_starved),
+	LD_ATTR(front_merges),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_lottery = {
+	.ops = {
+		.elevator_merge_fn = 		lottery_merge,
+		.elevator_merged_fn =		lottery_merged_request,
+		.elevator_merge_req_fn =	lottery_merged_requests,
+		.elevator_allow_merge_fn =	lottery_allow_merge,
+		.elevator_dispatch_fn =		lottery_dispatch_requests,
+		.elevator_add_req_fn =		lottery_add_request,
+		.elevator_queue_empty_fn =	lottery_queue_empty,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_set_req_fn =		lottery_set_request,
+		.elevator_put_req_fn =		lottery_put_request,
+		.elevator_init_fn =		lottery_init_queue,
+		.elevator_exit_fn =		lottery_exit_queue,
+	},
+
+	.elevator_attrs = lottery_attrs,
+	.elevator_name = "lottery",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init lottery_iosched_init(void)
+{
+	elv_register(&iosched_lottery);
+
+	return 0;
+}
+
+static void __exit lottery_iosched_exit(void)
+{
+	elv_unregister(&iosched_lottery);
+}
+
+module_init(lottery_iosched_init);
+module_exit(lottery_iosched_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("lottery IO scheduler");
@@ -438,6 +438,9 @@ static int pohmelfs_wait_on_page_locked(struct page *page)
 	for (;;) {
 		prepare_to_wait(page_waitqueue(page),
 				&wait.wait, TASK_INTERRUPTIBLE);
+		/* unlock_page() only wakes the queue of pages marked so */
+		SetPageWaiters(page);
+		smp_mb();
 
 		dprintk("%s: page: %p, locked: %d, uptodate: %d, error: %d, flags: %lx.\n",
 				__func__, page, PageLocked(page), PageUptodate(page),
@@ -32,6 +32,7 @@
 #include <linux/mount.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
 #include <linux/anon_inodes.h>
 #include <asm/uaccess.h>
 #include <asm/system.h>
@@ -44,7 +45,7 @@
  * There are three level of locking required by epoll :
  *
  * 1) epmutex (mutex)
- * 2) ep->mtx (mutex)
+ * 2) ep->sem (rw_semaphore)
  * 3) ep->lock (spinlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
@@ -55,19 +56,22 @@
  * a spinlock. During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
- * mutex (ep->mtx). It is acquired during the event transfer loop,
- * during epoll_ctl(EPOLL_CTL_DEL) and during eventpoll_release_file().
+ * rw_semaphore (ep->sem). It is acquired for writing during the event
+ * transfer loop, during epoll_ctl() and during eventpoll_release_file().
+ * Epoll files created with EPOLL_BATCH only take it for reading during
+ * the transfer loop, so that several epoll_wait() callers can deliver
+ * events at the same time; see ep_send_events_batch().
  * Then we also need a global mutex to serialize eventpoll_release_file()
  * and ep_free().
  * This mutex is acquired by ep_free() during the epoll file
  * cleanup path and it is also acquired by eventpoll_release_file()
  * if a file has been pushed inside an epoll set and it is then
  * close()d without a previous call toepoll_ctl(EPOLL_CTL_DEL).
- * It is possible to drop the "ep->mtx" and to use the global
+ * It is possible to drop the "ep->sem" and to use the global
  * mutex "epmutex" (together with "ep->lock") to have it working,
- * but having "ep->mtx" will make the interface more scalable.
+ * but having "ep->sem" will make the interface more scalable.
  * Events that require holding "epmutex" are very rare, while for
- * normal operations the epoll private "ep->mtx" will guarantee
+ * normal operations the epoll private "ep->sem" will guarantee
  * a better scalability.
  */
 
@@ -123,7 +127,8 @@ struct epitem {
 
 	/*
 	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
+	 * single linked chain of items. EP_UNACTIVE_PTR while the item
+	 * is not chained.
 	 */
 	struct epitem *next;
 
@@ -156,12 +161,13 @@ struct eventpoll {
 	spinlock_t lock;
 
 	/*
-	 * This mutex is used to ensure that files are not removed
+	 * This semaphore is used to ensure that files are not removed
 	 * while epoll is using them. This is held during the event
 	 * collection loop, the file cleanup path, the epoll file exit
-	 * code and the ctl operations.
+	 * code and the ctl operations. Only EPOLL_BATCH delivery takes
+	 * it for reading.
 	 */
-	struct mutex mtx;
+	struct rw_semaphore sem;
 
 	/* Wait queue used by sys_epoll_wait() */
 	wait_queue_head_t wq;
@@ -178,12 +184,16 @@ struct eventpoll {
 	/*
 	 * This is a single linked list that chains all the "struct epitem" that
 	 * happened while transfering ready events to userspace w/out
-	 * holding ->lock.
+	 * holding ->lock. With EPOLL_BATCH it is instead a lock-free stack,
+	 * NULL when empty, that ep_poll_callback() always pushes onto.
 	 */
 	struct epitem *ovflist;
 
 	/* The user that created the eventpoll descriptor */
 	struct user_struct *user;
+
+	/* Created with EPOLL_BATCH */
+	int batch;
 };
 
 /* Wait structure used by the poll hooks */
@@ -417,7 +427,7 @@ static void ep_poll_safewake(wait_queue_head_t *wq)
 
 /*
  * This function unregisters poll callbacks from the associated file
- * descriptor.  Must be called with "mtx" held (or "epmutex" if called from
+ * descriptor.  Must be called with "sem" held (or "epmutex" if called from
  * ep_free).
  */
 static void ep_unregister_pollwait(struct eventpoll *ep, struct epitem *epi)
@@ -434,6 +444,35 @@ static void ep_unregister_pollwait(struct eventpoll *ep, struct epitem *epi)
 	}
 }
 
+/*
+ * Moves the items pushed by ep_poll_callback() on an EPOLL_BATCH file to
+ * the ready list, oldest first. Items already in a ready or transfer list
+ * are skipped, their file gets polled anyway. Must be called with
+ * "ep->lock" held.
+ */
+static void ep_batch_requeue(struct eventpoll *ep)
+{
+	struct epitem *epi, *nepi;
+	LIST_HEAD(newlist);
+
+	for (nepi = xchg(&ep->ovflist, NULL); (epi = nepi) != NULL;) {
+		/* From here on the callback may push the item again */
+		nepi = xchg(&epi->next, EP_UNACTIVE_PTR);
+		if (!ep_is_linked(&epi->rdllink))
+			list_add(&epi->rdllink, &newlist);
+	}
+	list_splice_tail(&newlist, &ep->rdllist);
+}
+
+/*
+ * Returns whether epoll_wait() has something to look at. Must be called
+ * with "ep->lock" held.
+ */
+static inline int ep_events_available(struct eventpoll *ep)
+{
+	return !list_empty(&ep->rdllist) || (ep->batch && ep->ovflist);
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -459,7 +498,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	 * We need to lock this because we could be hit by
 	 * eventpoll_release_file() and epoll_ctl().
 	 */
-	mutex_lock(&ep->mtx);
+	down_write(&ep->sem);
 
 	/*
 	 * Steal the ready list, and re-init the original one to the
@@ -467,11 +506,15 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	 * happening while looping w/out locks, are not lost. We cannot
 	 * have the poll callback to queue directly on ep->rdllist,
 	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * in a lockless way. The poll callback of EPOLL_BATCH files
+	 * never touches ep->rdllist, only its stack is drained here.
 	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	if (ep->batch)
+		ep_batch_requeue(ep);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
+	if (!ep->batch)
+		ep->ovflist = NULL;
 	spin_unlock_irqrestore(&ep->lock, flags);
 
 	/*
@@ -485,6 +528,10 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	 * other events might have been queued by the poll callback.
 	 * We re-insert them inside the main ready-list here.
 	 */
+	if (ep->batch) {
+		ep_batch_requeue(ep);
+		goto requeued;
+	}
 	for (nepi = ep->ovflist; (epi = nepi) != NULL;
 	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
 		/*
@@ -503,6 +550,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	 */
 	ep->ovflist = EP_UNACTIVE_PTR;
 
+requeued:
 	/*
 	 * Quickly re-inject items left on "txlist".
 	 */
@@ -520,7 +568,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	}
 	spin_unlock_irqrestore(&ep->lock, flags);
 
-	mutex_unlock(&ep->mtx);
+	up_write(&ep->sem);
 
 	/* We have to call this outside the lock */
 	if (pwake)
@@ -531,7 +579,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 
 /*
  * Removes a "struct epitem" from the eventpoll RB tree and deallocates
- * all the associated resources. Must be called with "mtx" held.
+ * all the associated resources. Must be called with "sem" held.
  */
 static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 {
@@ -557,6 +605,9 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 	rb_erase(&epi->rbn, &ep->rbr);
 
 	spin_lock_irqsave(&ep->lock, flags);
+	/* The item may still sit on the stack of the batch poll callback */
+	if (ep->batch)
+		ep_batch_requeue(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
@@ -581,7 +632,7 @@ static void ep_free(struct eventpoll *ep)
 	/*
 	 * We need to lock this because we could be hit by
 	 * eventpoll_release_file() while we're freeing the "struct eventpoll".
-	 * We do not need to hold "ep->mtx" here because the epoll file
+	 * We do not need to hold "ep->sem" here because the epoll file
 	 * is on the way to be removed and no one has references to it
 	 * anymore. The only hit might come from eventpoll_release_file() but
 	 * holding "epmutex" is sufficent here.
@@ -609,7 +660,6 @@ static void ep_free(struct eventpoll *ep)
 	}
 
 	mutex_unlock(&epmutex);
-	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
 	kfree(ep);
 }
@@ -702,7 +752,7 @@ void eventpoll_release_file(struct file *file)
 	 * point, the file counter already went to zero and fget() would fail.
 	 * The only hit might come from ep_free() but by holding the mutex
 	 * will correctly serialize the operation. We do need to acquire
-	 * "ep->mtx" after "epmutex" because ep_remove() requires it when called
+	 * "ep->sem" after "epmutex" because ep_remove() requires it when called
 	 * from anywhere but ep_free().
 	 *
 	 * Besides, ep_remove() acquires the lock, so we can't hold it here.
@@ -714,15 +764,15 @@ void eventpoll_release_file(struct file *file)
 
 		ep = epi->ep;
 		list_del_init(&epi->fllink);
-		mutex_lock(&ep->mtx);
+		down_write(&ep->sem);
 		ep_remove(ep, epi);
-		mutex_unlock(&ep->mtx);
+		up_write(&ep->sem);
 	}
 
 	mutex_unlock(&epmutex);
 }
 
-static int ep_alloc(struct eventpoll **pep)
+static int ep_alloc(struct eventpoll **pep, int batch)
 {
 	int error;
 	struct user_struct *user;
@@ -735,13 +785,14 @@ static int ep_alloc(struct eventpoll **pep)
 		goto free_uid;
 
 	spin_lock_init(&ep->lock);
-	mutex_init(&ep->mtx);
+	init_rwsem(&ep->sem);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep->ovflist = batch ? NULL : EP_UNACTIVE_PTR;
 	ep->user = user;
+	ep->batch = batch;
 
 	*pep = ep;
 
@@ -754,8 +805,8 @@ free_uid:
 
 /*
  * Search the file inside the eventpoll tree. The RB tree operations
- * are protected by the "mtx" mutex, and ep_find() must be called with
- * "mtx" held.
+ * are protected by the "sem" semaphore, and ep_find() must be called with
+ * "sem" held.
  */
 static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 {
@@ -781,6 +832,52 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 	return epir;
 }
 
+/*
+ * The poll callback of EPOLL_BATCH files. The item is pushed on the
+ * ep->ovflist stack without taking "ep->lock", which is only taken to
+ * wake up a waiter, and only by the push that finds the stack empty:
+ * a batch of ready items wakes a single waiter, which wakes the next
+ * one if it leaves items behind.
+ */
+static int ep_poll_callback_batch(struct eventpoll *ep, struct epitem *epi,
+				  void *key)
+{
+	unsigned long flags;
+	struct epitem *head;
+
+	/* See ep_poll_callback() */
+	if (!(epi->event.events & ~EP_PRIVATE_BITS))
+		return 1;
+	if (key && !((unsigned long) key & epi->event.events))
+		return 1;
+
+	/* Already pushed, the consumer will poll the file anyway */
+	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) != EP_UNACTIVE_PTR)
+		return 1;
+
+	do {
+		head = ep->ovflist;
+		epi->next = head;
+	} while (cmpxchg(&ep->ovflist, head, epi) != head);
+
+	if (head)
+		return 1;
+
+	/*
+	 * The cmpxchg() above orders the push before the wait queue checks,
+	 * ep_poll() adds itself to the wait queue before checking the stack.
+	 */
+	if (waitqueue_active(&ep->wq)) {
+		spin_lock_irqsave(&ep->lock, flags);
+		wake_up_locked(&ep->wq);
+		spin_unlock_irqrestore(&ep->lock, flags);
+	}
+	if (waitqueue_active(&ep->poll_wait))
+		ep_poll_safewake(&ep->poll_wait);
+
+	return 1;
+}
+
 /*
  * This is the callback that is passed to the wait queue wakeup
  * machanism. It is called by the stored file descriptors when they
@@ -793,6 +890,9 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
 
+	if (ep->batch)
+		return ep_poll_callback_batch(ep, epi, key);
+
 	spin_lock_irqsave(&ep->lock, flags);
 
 	/*
@@ -893,7 +993,7 @@ static void ep_rbtree_insert(struct eventpoll *ep, struct epitem *epi)
 }
 
 /*
- * Must be called with "mtx" held.
+ * Must be called with "sem" held.
  */
 static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		     struct file *tfile, int fd)
@@ -948,7 +1048,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 
 	/*
 	 * Add the current item to the RB tree. All RB tree operations are
-	 * protected by "mtx", and ep_insert() is called with "mtx" held.
+	 * protected by "sem", and ep_insert() is called with "sem" held.
 	 */
 	ep_rbtree_insert(ep, epi);
 
@@ -982,10 +1082,13 @@ error_unregister:
 	/*
 	 * We need to do this because an event could have been arrived on some
 	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * list, since that is used/cleaned only inside a section bound by "sem".
+	 * And ep_insert() is called with "sem" held. The EPOLL_BATCH stack is
+	 * the exception, the callback may have pushed the item on it.
 	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	if (ep->batch)
+		ep_batch_requeue(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
@@ -997,7 +1100,7 @@ error_unregister:
 
 /*
  * Modify the interest event mask by dropping an event if the new mask
- * has a match in the current file status. Must be called with "mtx" held.
+ * has a match in the current file status. Must be called with "sem" held.
  */
 static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_event *event)
 {
@@ -1010,7 +1113,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * f_op->poll() call and the new event set registering.
 	 */
 	epi->event.events = event->events;
-	epi->event.data = event->data; /* protected by mtx */
+	epi->event.data = event->data; /* protected by sem */
 
 	/*
 	 * Get current event bits. We can safely use the file* here because
@@ -1055,7 +1158,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 	/*
 	 * We can loop without lock because we are passed a task private list.
 	 * Items cannot vanish during the loop because ep_scan_ready_list() is
-	 * holding "mtx" during this call.
+	 * holding "sem" during this call.
 	 */
 	for (eventcnt = 0, uevent = esed->events;
 	     !list_empty(head) && eventcnt < esed->maxevents;) {
@@ -1069,7 +1172,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 		/*
 		 * If the event mask intersect the caller-requested one,
 		 * deliver the event to userspace. Again, ep_scan_ready_list()
-		 * is holding "mtx", so no operations coming from userspace
+		 * is holding "sem", so no operations coming from userspace
 		 * can change the item.
 		 */
 		if (revents) {
@@ -1091,7 +1194,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * availability. At this point, noone can insert
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
-				 * ep_scan_ready_list() holding "mtx" and the
+				 * ep_scan_ready_list() holding "sem" and the
 				 * poll callback will queue them in ep->ovflist.
 				 */
 				list_add_tail(&epi->rdllink, &ep->rdllist);
@@ -1102,11 +1205,101 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 	return eventcnt;
 }
 
+/*
+ * Puts an item back on the ready list, unless the poll callback got it
+ * there first.
+ */
+static void ep_batch_relink(struct eventpoll *ep, struct epitem *epi)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (!ep_is_linked(&epi->rdllink))
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+	spin_unlock_irqrestore(&ep->lock, flags);
+}
+
+/*
+ * Event transfer of EPOLL_BATCH files. Each caller takes a batch of at
+ * most maxevents items off the ready list and delivers it holding "sem"
+ * for reading only, so callers on several cpus deliver in parallel, and
+ * wakes up the next waiter if items are left. Items cannot vanish while
+ * "sem" is held, but other callers test and requeue them, so unlike in
+ * ep_send_events_proc() every change to an rdllink, the private
+ * transfer list included, is made under "ep->lock".
+ */
+static int ep_send_events_batch(struct eventpoll *ep,
+				struct epoll_event __user *events,
+				int maxevents)
+{
+	int eventcnt = 0, pwake = 0, taken;
+	unsigned long flags;
+	unsigned int revents;
+	struct epitem *epi;
+	LIST_HEAD(txlist);
+
+	down_read(&ep->sem);
+
+	spin_lock_irqsave(&ep->lock, flags);
+	ep_batch_requeue(ep);
+	for (taken = 0; taken < maxevents && !list_empty(&ep->rdllist); taken++)
+		list_move_tail(ep->rdllist.next, &txlist);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	while (!list_empty(&txlist)) {
+		spin_lock_irqsave(&ep->lock, flags);
+		epi = list_first_entry(&txlist, struct epitem, rdllink);
+		list_del_init(&epi->rdllink);
+		spin_unlock_irqrestore(&ep->lock, flags);
+
+		revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL) &
+			epi->event.events;
+		if (!revents)
+			continue;
+
+		if (__put_user(revents, &events->events) ||
+		    __put_user(epi->event.data, &events->data)) {
+			ep_batch_relink(ep, epi);
+			if (!eventcnt)
+				eventcnt = -EFAULT;
+			break;
+		}
+		eventcnt++;
+		events++;
+		if (epi->event.events & EPOLLONESHOT)
+			epi->event.events &= EP_PRIVATE_BITS;
+		else if (!(epi->event.events & EPOLLET))
+			ep_batch_relink(ep, epi);
+	}
+
+	spin_lock_irqsave(&ep->lock, flags);
+	ep_batch_requeue(ep);
+	list_splice(&txlist, &ep->rdllist);
+	if (!list_empty(&ep->rdllist)) {
+		if (waitqueue_active(&ep->wq))
+			wake_up_locked(&ep->wq);
+		if (waitqueue_active(&ep->poll_wait))
+			pwake++;
+	}
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	up_read(&ep->sem);
+
+	/* We have to call this outside the lock */
+	if (pwake)
+		ep_poll_safewake(&ep->poll_wait);
+
+	return eventcnt;
+}
+
 static int ep_send_events(struct eventpoll *ep,
 			  struct epoll_event __user *events, int maxevents)
 {
 	struct ep_send_events_data esed;
 
+	if (ep->batch)
+		return ep_send_events_batch(ep, events, maxevents);
+
 	esed.maxevents = maxevents;
 	esed.events = events;
 
@@ -1133,7 +1326,7 @@ retry:
 	spin_lock_irqsave(&ep->lock, flags);
 
 	res = 0;
-	if (list_empty(&ep->rdllist)) {
+	if (!ep_events_available(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
@@ -1150,7 +1343,7 @@ retry:
 			 * to TASK_INTERRUPTIBLE before doing the checks.
 			 */
 			set_current_state(TASK_INTERRUPTIBLE);
-			if (!list_empty(&ep->rdllist) || !jtimeout)
+			if (ep_events_available(ep) || !jtimeout)
 				break;
 			if (signal_pending(current)) {
 				res = -EINTR;
@@ -1166,7 +1359,8 @@ retry:
 		set_current_state(TASK_RUNNING);
 	}
 	/* Is it worth to try to dig for events ? */
-	eavail = !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	eavail = ep_events_available(ep) ||
+		(!ep->batch && ep->ovflist != EP_UNACTIVE_PTR);
 
 	spin_unlock_irqrestore(&ep->lock, flags);
 
@@ -1193,12 +1387,12 @@ SYSCALL_DEFINE1(epoll_create1, int, flags)
 	/* Check the EPOLL_* constant for consistency.  */
 	BUILD_BUG_ON(EPOLL_CLOEXEC != O_CLOEXEC);
 
-	if (flags & ~EPOLL_CLOEXEC)
+	if (flags & ~(EPOLL_CLOEXEC | EPOLL_BATCH))
 		return -EINVAL;
 	/*
 	 * Create the internal data structure ("struct eventpoll").
 	 */
-	error = ep_alloc(&ep);
+	error = ep_alloc(&ep, !!(flags & EPOLL_BATCH));
 	if (error < 0)
 		return error;
 	/*
@@ -1271,10 +1465,10 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	 */
 	ep = file->private_data;
 
-	mutex_lock(&ep->mtx);
+	down_write(&ep->sem);
 
 	/*
-	 * Try to lookup the file inside our RB tree, Since we grabbed "mtx"
+	 * Try to lookup the file inside our RB tree, Since we grabbed "sem"
 	 * above, we can be sure to be able to use the item looked up by
 	 * ep_find() till we release the mutex.
 	 */
@@ -1303,7 +1497,7 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 			error = -ENOENT;
 		break;
 	}
-	mutex_unlock(&ep->mtx);
+	up_write(&ep->sem);
 
 error_tgt_fput:
 	fput(tfile);
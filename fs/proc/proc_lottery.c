@@ -18,59 +18,85 @@
 
 #include <linux/fs.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <linux/module.h>
+#include <linux/math64.h>
 #include <linux/proc_lottery.h>
 #include <asm/uaccess.h>
 
 #ifdef  CONFIG_SCHED_LOTTERY_POLICY
 
-#define MAX_LOTTERY_STATS 1024
-
-/**
- * @brief String for each action
- */
-static char *action[] = {"ENQUEUE", "DEQUEUE", "CONTEXT_SWITCH", "PICK_NEXT", "PREEMPT", "TICK", "LOG"};
-
 /**
  * @brief Directory entry for root of lottery proc entry
  */
 static struct proc_dir_entry *lottery_dir;
 
 /**
- * @brief Global data to manipulate file length
+ * @brief Write resets the lottery stats data structures
+ *
+ * @param filp Pointer for the file
+ * @param buf Buffer from user-space which is to be written
+ * @param count Number of bytes to write
+ * @param ppos Position in the file to write
+ *
+ * @return Number of bytes of data written
  */
-static unsigned int length = 0;
+static ssize_t lottery_stats_write(struct file *filp, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	lottery_reset_stats();
+	return count;
+}
 
 /**
- * @brief Initializes the length to 0 while file open
+ * @brief Shows the statistics information from lottery scheduler
  *
- * @param inode Pointer for the inode entry
- * @param file Pointer for the file
+ * @param m Sequence file being read
+ * @param v Not used
  *
- * @return Always 0.
+ * @return Always 0
  */
-static int lottery_open(struct inode *inode, struct file *file)
+static int lottery_stats_show(struct seq_file *m, void *v)
 {
-	length = 0;
+	struct lottery_stats *stats;
+	unsigned long long latency_per_cycle;
+
+	stats = lottery_get_stats();
+
+	/* Avoid divide by 0 crash */
+	if (unlikely(stats->lottery_iteration == 0))
+		latency_per_cycle = 0;
+	else
+		latency_per_cycle = div64_u64(stats->lottery_latency,
+					      stats->lottery_iteration);
+
+	seq_printf(m, "PickNextTask-> %llu   Latency -> %lluNS   Latency_Per_PickNextTask -> %lluNS\nEnqueue-> %llu   Dequeue-> %llu   Yield-> %llu   Preempt-> %llu\nRqSwitch-> %llu   Throttle-> %llu   Forced-> %llu\n",
+		   stats->lottery_iteration, stats->lottery_latency,
+		   latency_per_cycle, stats->lottery_enqueue,
+		   stats->lottery_dequeue,
+		   stats->lottery_yield, stats->lottery_prempt,
+		   stats->lottery_rq_switch, stats->lottery_throttle,
+		   stats->lottery_forced);
+
 	return 0;
 }
 
 /**
- * @brief Initializes the length to 0 while file close
+ * @brief Opens the stats file
  *
  * @param inode Pointer for the inode entry
  * @param file Pointer for the file
  *
- * @return Always 0.
+ * @return 0 on success, negative error otherwise
  */
-static int lottery_release(struct inode *inode, struct file *file)
+static int lottery_stats_open(struct inode *inode, struct file *file)
 {
-	length = 0;
-	return 0;
+	return single_open(file, lottery_stats_show, NULL);
 }
 
+
 /**
- * @brief Write resets the lottery stats data structures
+ * @brief Write resets the lottery log data structures
  *
  * @param filp Pointer for the file
  * @param buf Buffer from user-space which is to be written
@@ -79,155 +105,112 @@ static int lottery_release(struct inode *inode, struct file *file)
  *
  * @return Number of bytes of data written
  */
-static ssize_t lottery_stats_write(struct file *filp, const char __user *buf,
-				   size_t count, loff_t *ppos)
+static ssize_t lottery_log_write(struct file *filp, const char __user *buf,
+				 size_t count, loff_t *ppos)
 {
-	lottery_reset_stats();
+	lottery_clear_event_log();
 	return count;
 }
 
+/*
+ * The position in the log file is the sequence number of the next event,
+ * so every reader walks the log on its own and a reader which fell behind
+ * skips to the oldest event still logged.
+ */
+
 /**
- * @brief Reads the statistics information from lottery scheduler
+ * @brief Copies the event at *pos into the private buffer of the reader
  *
- * @param filp Pointer for the file
- * @param buf Buffer from user-space where read data is copied
- * @param count Number of bytes to read
- * @param ppos Position in the file to read
+ * @param m Sequence file being read
+ * @param pos Sequence number of the event, moved past overwritten events
  *
- * @return Number of bytes read
+ * @return The event copied, NULL at the end of the log
  */
-static ssize_t lottery_stats_read(struct file *filp, char __user *buf,
-				  size_t count, loff_t *ppos)
+static void *lottery_log_copy(struct seq_file *m, loff_t *pos)
 {
-	struct lottery_stats *stats;
-	unsigned long long latency_per_cycle;;
-	char *buffer = NULL;
+	struct lottery_event *event = m->private;
+	unsigned long long seq = *pos;
 
-	if(unlikely(!access_ok(VERIFY_WRITE, buf, count)))
-		return -1;
+	if (lottery_read_event(&seq, event))
+		return NULL;
 
-	if (length != 0)
-		return 0;
+	*pos = seq;
+	return event;
+}
 
-	stats = lottery_get_stats();
+static void *lottery_log_start(struct seq_file *m, loff_t *pos)
+{
+	return lottery_log_copy(m, pos);
+}
 
-	/* Avoid divide by 0 crash */
-	if (unlikely(stats->lottery_iteration == 0))
-		latency_per_cycle = 0;
-	else
-		latency_per_cycle = stats->lottery_latency / stats->lottery_iteration;
-
-	buffer = kmalloc (MAX_LOTTERY_STATS, GFP_KERNEL);
-	if (unlikely(!buffer))
-		return 0;
-	length = snprintf(buffer, count, "PickNextTask-> %llu   Latency -> %lluNS   Latency_Per_PickNextTask -> %lluNS\nEnqueue-> %llu   Dequeue-> %llu   Yield-> %llu   Preempt-> %llu\n",
-			  stats->lottery_iteration, stats->lottery_latency,
-			  latency_per_cycle, stats->lottery_enqueue,
-			  stats->lottery_dequeue,
-			  stats->lottery_yield, stats->lottery_prempt);
-
-	copy_to_user(buf, buffer, length);
-
-	if (buffer)
-		kfree(buffer);
-	return length;
+static void *lottery_log_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return lottery_log_copy(m, pos);
 }
 
+static void lottery_log_stop(struct seq_file *m, void *v)
+{
+}
 
 /**
- * @brief Write resets the lottery log data structures
+ * @brief Shows one event of the log
  *
- * @param filp Pointer for the file
- * @param buf Buffer from user-space which is to be written
- * @param count Number of bytes to write
- * @param ppos Position in the file to write
+ * @param m Sequence file being read
+ * @param v Event copied by lottery_log_copy()
  *
- * @return Number of bytes of data written
+ * @return Always 0
  */
-static ssize_t lottery_log_write(struct file *filp, const char __user *buf,
-				 size_t count, loff_t *ppos)
+static int lottery_log_show(struct seq_file *m, void *v)
 {
-	struct lottery_event_log *log = NULL;
+	struct lottery_event *event = v;
 
-	log = get_lottery_event_log();
-
-	/* Reset the head,tail,size & cursors */
-	log->cursor=log->head=log->tail=log->size = 0;
-
-	return count;
+	seq_printf(m, "[%llu] <%s>  {%s}\n", event->timestamp,
+		   lottery_action_name[event->action], event->msg);
+	return 0;
 }
 
+static const struct seq_operations lottery_log_seq_ops = {
+	.start	= lottery_log_start,
+	.next	= lottery_log_next,
+	.stop	= lottery_log_stop,
+	.show	= lottery_log_show,
+};
+
 /**
- * @brief Reads the log for the lottery scheduler
+ * @brief Opens the log file with a private copy of the current event
  *
- * @param filp Pointer for the file
- * @param buf Buffer from user-space which is to be written
- * @param count Number of bytes to write
- * @param ppos Position in the file to write
- *
- * @return Number of bytes of data written
+ * @param inode Pointer for the inode entry
+ * @param file Pointer for the file
  *
- * @return
+ * @return 0 on success, negative error otherwise
  */
-static ssize_t lottery_log_read(struct file *filep, const char __user *buf,
-				size_t count, loff_t *ppos)
+static int lottery_log_open(struct inode *inode, struct file *file)
 {
-	char buffer[LOTTERY_MSG_SIZE];
-	unsigned int len=0,idx=0;
-	struct lottery_event_log *log=NULL;
-
-	buffer[0]='\0';
-
-	log=get_lottery_event_log();
-
-	if(likely(log)){
-		if(unlikely(!access_ok(VERIFY_WRITE, buf, count)))
-			return -1;
-
-		if(log->cursor == log->tail) {
-			if(log->size < LOTTERY_MAX_EVENT_LINES)
-				return len;
-			else if(log->size == LOTTERY_MAX_EVENT_LINES) {
-				if(log->flag > 0)
-					return len;
-				log->flag = 1;
-			}
-		}
-
-		idx = log->cursor;
-		len = snprintf(buffer, count, "%s[%llu] <%s>  {%s}\n",
-			       buffer,
-			       log->lottery_event[idx].timestamp,
-			       action[log->lottery_event[idx].action],
-			       log->lottery_event[idx].msg);
-		idx = (idx + 1) % LOTTERY_MAX_EVENT_LINES;
-		log->cursor=idx;
-		if(len)
-			copy_to_user(buf,buffer,len);
-
-	}
-
-	return len;
+	return seq_open_private(file, &lottery_log_seq_ops,
+				sizeof(struct lottery_event));
 }
 
 /**
  * @brief Handles for read/write stats proc entry
  */
 static const struct file_operations proc_lottery_stats_operations = {
-	.open           = lottery_open,
-	.read           = lottery_stats_read,
-	.write           = lottery_stats_write,
-	.release        = lottery_release,
+	.open           = lottery_stats_open,
+	.read           = seq_read,
+	.write          = lottery_stats_write,
+	.llseek         = seq_lseek,
+	.release        = single_release,
 };
 
 /**
  * @brief Handles for read/write lottery event logs
  */
 static const struct file_operations proc_lottery_log_operations = {
-	.open           = lottery_open,
-	.read           = lottery_log_read,
-	.write           = lottery_log_write,
-	.release        = lottery_release,
+	.open           = lottery_log_open,
+	.read           = seq_read,
+	.write          = lottery_log_write,
+	.llseek         = seq_lseek,
+	.release        = seq_release_private,
 };
 
 /**
@@ -20,6 +20,8 @@
 
 /* Flags for epoll_create1.  */
 #define EPOLL_CLOEXEC O_CLOEXEC
+/* Wake one waiter per batch of ready events, deliver batches in parallel */
+#define EPOLL_BATCH 0x00000001
 
 /* Valid opcodes to issue to sys_epoll_ctl() */
 #define EPOLL_CTL_ADD 1
@@ -149,4 +149,41 @@ static inline unsigned int kfifo_len(struct kfifo *fifo)
 	return ret;
 }
 
+/*
+ * Multi-producer, single-consumer FIFO of records: any number of
+ * producers put records without locking, one consumer gets them.
+ */
+struct kfifo_mpsc {
+	unsigned char *buffer;	/* the buffer holding the records */
+	unsigned int size;	/* the size of the allocated buffer */
+	unsigned int head;	/* room is reserved at offset (head % size) */
+	unsigned int out;	/* records are taken at off. (out % size) */
+};
+
+extern struct kfifo_mpsc *kfifo_mpsc_alloc(unsigned int size, gfp_t gfp_mask);
+extern void kfifo_mpsc_free(struct kfifo_mpsc *fifo);
+extern unsigned int kfifo_mpsc_put(struct kfifo_mpsc *fifo,
+				   const unsigned char *buffer,
+				   unsigned int len);
+extern unsigned int kfifo_mpsc_get(struct kfifo_mpsc *fifo,
+				   unsigned char *buffer, unsigned int len);
+
+/*
+ * Per-cpu fan-in queue: each cpu puts fixed size elements into its own
+ * FIFO, one consumer gets them in batches.
+ */
+struct kfifo_percpu {
+	struct kfifo *fifos;	/* per cpu, filled by that cpu only */
+	unsigned int esize;	/* the size of an element */
+	int next_cpu;		/* the consumer resumes at this cpu */
+};
+
+extern struct kfifo_percpu *kfifo_percpu_alloc(unsigned int size,
+					       unsigned int esize,
+					       gfp_t gfp_mask);
+extern void kfifo_percpu_free(struct kfifo_percpu *q);
+extern int kfifo_percpu_put(struct kfifo_percpu *q, const void *elem);
+extern unsigned int kfifo_percpu_get(struct kfifo_percpu *q, void *buffer,
+				     unsigned int n);
+
 #endif
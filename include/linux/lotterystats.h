@@ -0,0 +1,96 @@
+/* lotterystats.h - exporting lottery scheduler statistics
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2.1 of the GNU Lesser General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef _LINUX_LOTTERYSTATS_H
+#define _LINUX_LOTTERYSTATS_H
+
+#include <linux/types.h>
+
+/*
+ * Statistics of the lottery scheduling class over generic netlink.
+ *
+ * Every value is its own attribute, so new ones can be appended without
+ * breaking older listeners, which skip attributes they do not know.
+ * LOTTERYSTATS_GENL_VERSION is bumped when the meaning of an attribute
+ * changes.
+ */
+
+/* Number of log2 buckets of the pick latency histogram */
+#define LOTTERYSTATS_HIST_BUCKETS	32
+
+/*
+ * Commands sent from userspace
+ * Not versioned. New commands should only be inserted at the enum's end
+ * prior to __LOTTERYSTATS_CMD_MAX
+ */
+
+enum {
+	LOTTERYSTATS_CMD_UNSPEC = 0,	/* Reserved */
+	LOTTERYSTATS_CMD_GET_CPU,	/* user->kernel request/get-response */
+	LOTTERYSTATS_CMD_GET_TASK,	/* user->kernel request/get-response */
+	LOTTERYSTATS_CMD_SET_INTERVAL,	/* period of the snapshots, admin */
+	LOTTERYSTATS_CMD_SNAPSHOT,	/* kernel->user multicast event */
+	__LOTTERYSTATS_CMD_MAX,
+};
+
+#define LOTTERYSTATS_CMD_MAX (__LOTTERYSTATS_CMD_MAX - 1)
+
+enum {
+	LOTTERYSTATS_ATTR_UNSPEC = 0,	/* Reserved */
+	LOTTERYSTATS_ATTR_CPU,		/* u32, cpu to get, all if absent */
+	LOTTERYSTATS_ATTR_PID,		/* u32, task to get, all if absent */
+	LOTTERYSTATS_ATTR_INTERVAL,	/* u32, snapshot period in ms, 0 off */
+	LOTTERYSTATS_ATTR_CPU_STATS,	/* nested LOTTERYSTATS_CPU_* */
+	LOTTERYSTATS_ATTR_TASK_STATS,	/* nested LOTTERYSTATS_TASK_* */
+	LOTTERYSTATS_ATTR_TIMESTAMP,	/* u64, sched_clock() of a snapshot */
+	__LOTTERYSTATS_ATTR_MAX,
+};
+
+#define LOTTERYSTATS_ATTR_MAX (__LOTTERYSTATS_ATTR_MAX - 1)
+
+enum {
+	LOTTERYSTATS_CPU_UNSPEC = 0,	/* Reserved */
+	LOTTERYSTATS_CPU_ID,		/* u32 */
+	LOTTERYSTATS_CPU_NR_RUNNING,	/* u32, queued lottery tasks */
+	LOTTERYSTATS_CPU_TICKETS,	/* u64, tickets in the run queue */
+	LOTTERYSTATS_CPU_BACKEND,	/* u32, LOTTERY_RQ_BACKEND_* */
+	LOTTERYSTATS_CPU_PICKS,		/* u64, draws won */
+	LOTTERYSTATS_CPU_ENQUEUES,	/* u64 */
+	LOTTERYSTATS_CPU_FORCED,	/* u64, picks forced by the wait bound */
+	LOTTERYSTATS_CPU_THROTTLED,	/* u32, out of runtime this period */
+	LOTTERYSTATS_CPU_RUNTIME,	/* u64, ns used in this period */
+	LOTTERYSTATS_CPU_PICK_HIST,	/* u64[LOTTERYSTATS_HIST_BUCKETS],
+					 * picks by log2 of latency in ns */
+	__LOTTERYSTATS_CPU_MAX,
+};
+
+#define LOTTERYSTATS_CPU_MAX (__LOTTERYSTATS_CPU_MAX - 1)
+
+enum {
+	LOTTERYSTATS_TASK_UNSPEC = 0,	/* Reserved */
+	LOTTERYSTATS_TASK_PID,		/* u32 */
+	LOTTERYSTATS_TASK_CPU,		/* u32 */
+	LOTTERYSTATS_TASK_TICKETS,	/* u64, including lent tickets */
+	LOTTERYSTATS_TASK_NORMAL_TICKETS, /* u64, own tickets */
+	LOTTERYSTATS_TASK_QUANTUM,	/* u64, ns between draws */
+	LOTTERYSTATS_TASK_RUNTIME,	/* u64, ns run since creation */
+	__LOTTERYSTATS_TASK_MAX,
+};
+
+#define LOTTERYSTATS_TASK_MAX (__LOTTERYSTATS_TASK_MAX - 1)
+
+/* NETLINK_GENERIC related info */
+
+#define LOTTERYSTATS_GENL_NAME		"LOTTERYSTATS"
+#define LOTTERYSTATS_GENL_VERSION	0x1
+#define LOTTERYSTATS_GENL_MCGRP_NAME	"snapshot"
+
+#endif /* _LINUX_LOTTERYSTATS_H */
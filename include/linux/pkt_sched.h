@@ -518,4 +518,21 @@ struct tc_drr_stats
 	__u32	deficit;
 };
 
+/* LOTTERY */
+
+enum
+{
+	TCA_LOTTERY_UNSPEC,
+	TCA_LOTTERY_TICKETS,
+	TCA_LOTTERY_QUANTUM,
+	__TCA_LOTTERY_MAX
+};
+
+#define TCA_LOTTERY_MAX	(__TCA_LOTTERY_MAX - 1)
+
+struct tc_lottery_stats
+{
+	__u64	eff_tickets;
+};
+
 #endif
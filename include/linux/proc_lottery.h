@@ -21,6 +21,9 @@
 
 #ifdef	CONFIG_SCHED_LOTTERY_POLICY
 
+#include <linux/lotterystats.h>
+#include <linux/spinlock.h>
+
 /* Enables logging of events in lottery scheduling */
 #define LOTTERY_LOGGING
 
@@ -45,33 +48,55 @@ struct lottery_stats{
 	unsigned long long lottery_dequeue;
 	unsigned long long lottery_yield;
 	unsigned long long lottery_prempt;
+	unsigned long long lottery_rq_switch;
+	unsigned long long lottery_throttle;
+	unsigned long long lottery_forced;
 };
 struct lottery_event{
 	enum lottery_action action;
+	unsigned long long seq;		/* order among the events of all cpus */
 	unsigned long long timestamp;
 	char msg[LOTTERY_MSG_SIZE];
 };
 
+/*
+ * Each cpu logs into its own ring, a slice of LOTTERY_MAX_EVENT_LINES
+ * events, under its own lock. Readers merge the rings by sequence number.
+ */
 struct lottery_event_log{
-	struct lottery_event lottery_event[LOTTERY_MAX_EVENT_LINES];
+	spinlock_t lock;
+	struct lottery_event *lottery_event;
+	unsigned int lines;
 	unsigned int tail;
 	unsigned int head;
 	unsigned int size;
-	unsigned int cursor;
-	unsigned int flag;
 };
 
+/**
+ * @brief Names of the actions, indexed by enum lottery_action
+ */
+extern const char * const lottery_action_name[];
+
 /**
  * @brief Initializes the lottery log data structures
  */
 void init_lottery_event_log(void);
 
 /**
- * @brief Get the buffer for lottery scheduling logs
+ * @brief Copies an event out of the lottery event log
+ *
+ * @param seq Sequence number of the event, moved up to the oldest event
+ * still logged if it was overwritten
+ * @param event Where the event is copied
  *
- * @return pointer to the buffer for lottery scheduling logs
+ * @return 0 on success, -ENOENT if the event was not logged yet
+ */
+int lottery_read_event(unsigned long long *seq, struct lottery_event *event);
+
+/**
+ * @brief Drops the logged events
  */
-struct lottery_event_log * get_lottery_event_log(void);
+void lottery_clear_event_log(void);
 
 /**
  * @brief Resets the statistics related data structure
@@ -85,6 +110,29 @@ void lottery_reset_stats(void);
  */
 struct lottery_stats *lottery_get_stats(void);
 
+/**
+ * @brief State and counters of one lottery run queue
+ */
+struct lottery_cpu_stats {
+	unsigned long nr_running;
+	unsigned long long tickets;
+	unsigned int backend;
+	unsigned long picks;
+	unsigned long enqueues;
+	unsigned long forced;
+	int throttled;
+	u64 runtime;
+	u64 pick_hist[LOTTERYSTATS_HIST_BUCKETS];
+};
+
+/**
+ * @brief Reads the state and counters of the lottery run queue of a cpu
+ *
+ * @param cpu Cpu to read
+ * @param st Where the values are stored
+ */
+void lottery_read_cpu_stats(int cpu, struct lottery_cpu_stats *st);
+
 
 #endif
 #endif
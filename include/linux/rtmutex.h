@@ -22,11 +22,15 @@
  * @wait_lock:	spinlock to protect the structure
  * @wait_list:	pilist head to enqueue waiters in priority order
  * @owner:	the mutex owner
+ * @waiter_tickets: lottery tickets lent to the owner by all waiters
  */
 struct rt_mutex {
 	spinlock_t		wait_lock;
 	struct plist_head	wait_list;
 	struct task_struct	*owner;
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	unsigned long long	waiter_tickets;
+#endif
 #ifdef CONFIG_DEBUG_RT_MUTEXES
 	int			save_state;
 	const char 		*name, *file;
@@ -41,6 +41,10 @@
 
 #ifdef CONFIG_SCHED_LOTTERY_POLICY
 #define SCHED_LOTTERY		6
+/* Most tickets a task may hold, keeps the run queue sums from overflowing */
+#define LOTTERY_MAX_TICKETS	(1ULL << 40)
+/* Longest lottery quantum, in ticks */
+#define LOTTERY_MAX_QUANTUM	HZ
 #endif
 /* Can be ORed in to make sure the process is reverted back to SCHED_NORMAL on fork */
 #define SCHED_RESET_ON_FORK     0x40000000
@@ -110,6 +114,37 @@ struct fs_struct;
 struct bts_context;
 struct perf_event_context;
 
+/*
+ * Extended scheduling parameters for sched_lottery_setattr() and
+ * sched_lottery_getattr(). @size is the size of the structure the caller
+ * knows, so fields can be appended without breaking older binaries.
+ *
+ * These are not the upstream sched_setattr()/sched_getattr(): the layout
+ * from offset 24 on holds the lottery fields, and the syscall numbers are
+ * local to this tree.
+ */
+#define SCHED_LOTTERY_FLAG_RESET_ON_FORK	0x01
+
+#define SCHED_LOTTERY_ATTR_SIZE_VER0	48	/* first published struct */
+
+struct sched_lottery_attr {
+	u32 size;
+
+	u32 sched_policy;
+	u64 sched_flags;
+
+	/* SCHED_NORMAL, SCHED_BATCH */
+	s32 sched_nice;
+
+	/* SCHED_FIFO, SCHED_RR */
+	u32 sched_priority;
+
+	/* SCHED_LOTTERY */
+	u64 sched_tickets;		/* own tickets */
+	u64 sched_tickets_effective;	/* including lent tickets, read only */
+	u64 sched_quantum;		/* run time between draws, in ns */
+};
+
 /*
  * List of flags we want to share for kernel threads,
  * if only because they are not used by them anyway.
@@ -747,6 +782,10 @@ struct user_struct {
 #ifdef CONFIG_PERF_EVENTS
 	atomic_long_t locked_vm;
 #endif
+
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	atomic64_t lottery_tickets; /* Tickets held by SCHED_LOTTERY tasks */
+#endif
 };
 
 extern int uids_sysfs_init(void);
@@ -1234,7 +1273,23 @@ struct sched_lottery_entity {
 	struct rb_node lottery_rb_node;
 	unsigned long long left_tickets;
 	unsigned long long right_tickets;
-	unsigned long long tickets;
+	unsigned long long tickets;	/* including tickets lent by rt_mutex waiters */
+	unsigned long long normal_tickets;
+	unsigned int rq_idx; /* slot in bucket or array based run queue */
+	u64 wait_start; /* runnable without a win since, 0 when asleep */
+	u64 wait_deadline; /* forced to run after this */
+	int wait_idx; /* slot in the wait heap, -1 if not guarded */
+	unsigned int quantum; /* ticks between draws while it runs */
+	unsigned int time_slice; /* ticks left of the current quantum */
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	unsigned int throttled; /* parked while its group is out of runtime */
+#endif
+	/* tickets counted against the per-user and per-group ceilings */
+	unsigned long long charged_tickets;
+	struct user_struct *user;
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	struct task_group *tg;
+#endif
 	struct task_struct *task;
 };
 #endif
@@ -1766,6 +1821,7 @@ extern void thread_group_times(struct task_struct *p, cputime_t *ut, cputime_t *
 #define PF_EXITING	0x00000004	/* getting shut down */
 #define PF_EXITPIDONE	0x00000008	/* pi exit done on shut down */
 #define PF_VCPU		0x00000010	/* I'm a virtual CPU */
+#define PF_WQ_WORKER	0x00000020	/* I'm a workqueue pool worker */
 #define PF_FORKNOEXEC	0x00000040	/* forked but didn't exec */
 #define PF_MCE_PROCESS  0x00000080      /* process policy on mce errors */
 #define PF_SUPERPRIV	0x00000100	/* used super-user privileges */
@@ -1964,16 +2020,63 @@ int sched_rt_handler(struct ctl_table *table, int write,
 
 extern unsigned int sysctl_sched_compat_yield;
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+/* Run queue backends for the lottery scheduling class */
+#define LOTTERY_RQ_BACKEND_LIST		0
+#define LOTTERY_RQ_BACKEND_RBTREE	1
+#define LOTTERY_RQ_BACKEND_ADAPTIVE	2
+#define LOTTERY_RQ_BACKEND_BUCKET	3
+#define LOTTERY_RQ_BACKEND_ARRAY	4
+#define LOTTERY_NR_RQ_BACKENDS		5
+
+extern unsigned int sysctl_sched_lottery_rq_backend;
+extern unsigned int sysctl_sched_lottery_adaptive_nr;
+extern unsigned int sysctl_sched_lottery_period;
+extern int sysctl_sched_lottery_runtime;
+extern unsigned int sysctl_sched_lottery_wait_factor;
+extern unsigned long sysctl_sched_lottery_user_tickets;
+#ifdef CONFIG_SMP
+extern unsigned int sysctl_sched_lottery_gang;
+#endif
+
+int sched_lottery_rq_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp,
+		loff_t *ppos);
+int sched_lottery_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp,
+		loff_t *ppos);
+int sched_lottery_gang_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp,
+		loff_t *ppos);
+
+extern void sched_lottery_exit(struct task_struct *p);
+#else
+static inline void sched_lottery_exit(struct task_struct *p)
+{
+}
+#endif
+
 #ifdef CONFIG_RT_MUTEXES
 extern int rt_mutex_getprio(struct task_struct *p);
 extern void rt_mutex_setprio(struct task_struct *p, int prio);
 extern void rt_mutex_adjust_pi(struct task_struct *p);
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+extern unsigned long long rt_mutex_gettickets(struct task_struct *p);
+extern void rt_mutex_settickets(struct task_struct *p,
+				unsigned long long tickets);
+#endif
 #else
 static inline int rt_mutex_getprio(struct task_struct *p)
 {
 	return p->normal_prio;
 }
 # define rt_mutex_adjust_pi(p)		do { } while (0)
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+static inline unsigned long long rt_mutex_gettickets(struct task_struct *p)
+{
+	return min(p->lt.normal_tickets, LOTTERY_MAX_TICKETS);
+}
+#endif
 #endif
 
 extern void set_user_nice(struct task_struct *p, long nice);
@@ -2059,6 +2162,7 @@ extern void wake_up_new_task(struct task_struct *tsk,
  static inline void kick_process(struct task_struct *tsk) { }
 #endif
 extern void sched_fork(struct task_struct *p, int clone_flags);
+extern void sched_fork_cleanup(struct task_struct *p);
 extern void sched_dead(struct task_struct *p);
 
 extern void proc_caches_init(void);
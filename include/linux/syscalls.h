@@ -33,6 +33,7 @@ struct pollfd;
 struct rlimit;
 struct rusage;
 struct sched_param;
+struct sched_lottery_attr;
 struct semaphore;
 struct sembuf;
 struct shmid_ds;
@@ -397,6 +398,12 @@ asmlinkage long sys_sched_setparam(pid_t pid,
 asmlinkage long sys_sched_getscheduler(pid_t pid);
 asmlinkage long sys_sched_getparam(pid_t pid,
 					struct sched_param __user *param);
+asmlinkage long sys_sched_lottery_setattr(pid_t pid,
+					struct sched_lottery_attr __user *attr,
+					unsigned int flags);
+asmlinkage long sys_sched_lottery_getattr(pid_t pid,
+					struct sched_lottery_attr __user *attr,
+					unsigned int size, unsigned int flags);
 asmlinkage long sys_sched_setaffinity(pid_t pid, unsigned int len,
 					unsigned long __user *user_mask_ptr);
 asmlinkage long sys_sched_getaffinity(pid_t pid, unsigned int len,
@@ -977,6 +977,7 @@ NORET_TYPE void do_exit(long code)
 	exit_fs(tsk);
 	check_stack_usage();
 	exit_thread();
+	sched_lottery_exit(tsk);
 	cgroup_exit(tsk, 1);
 
 	if (group_dead && tsk->signal->leader)
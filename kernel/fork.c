@@ -1130,6 +1130,16 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 #ifdef CONFIG_SCHED_LOTTERY_POLICY
 	p->lt.task = p;
 	p->lt.tickets = 1;
+	p->lt.normal_tickets = 1;
+	p->lt.wait_start = 0;
+	p->lt.wait_idx = -1;
+	p->lt.quantum = 1;
+	p->lt.time_slice = 1;
+	p->lt.charged_tickets = 0;
+	p->lt.user = NULL;
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	p->lt.tg = NULL;
+#endif
 #endif
 
 	p->bts = NULL;
@@ -1325,6 +1335,7 @@ bad_fork_cleanup_audit:
 	audit_free(p);
 bad_fork_cleanup_policy:
 	perf_event_free_task(p);
+	sched_fork_cleanup(p);
 #ifdef CONFIG_NUMA
 	mpol_put(p->mempolicy);
 bad_fork_cleanup_cgroup:
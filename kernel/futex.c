@@ -59,6 +59,7 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/random.h>
 
 #include <asm/futex.h>
 
@@ -866,10 +867,78 @@ double_unlock_hb(struct futex_hash_bucket *hb1, struct futex_hash_bucket *hb2)
 		spin_unlock(&hb2->lock);
 }
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+static inline unsigned long long futex_q_tickets(struct futex_q *q)
+{
+	/* A ticket-less waiter would never be woken */
+	return q->task->lt.tickets ? q->task->lt.tickets : 1;
+}
+
+/*
+ * Wake up nr_wake of the waiters matching key and bitset, drawn by a
+ * lottery over their tickets. SCHED_FIFO and SCHED_RR waiters are still
+ * woken first, in plist order. rt_task() is true for lottery tasks as
+ * well, so the policy is tested instead. Each draw walks the whole chain,
+ * so this is only used when fewer waiters are woken than are queued.
+ *
+ * Returns the number of waiters woken.
+ */
+static int futex_wake_lottery(struct plist_head *head, union futex_key *key,
+			      int nr_wake, u32 bitset)
+{
+	struct futex_q *this, *winner;
+	u64 total, lottery;
+	int ret = 0;
+
+	while (ret < nr_wake) {
+		total = 0;
+		winner = NULL;
+
+		plist_for_each_entry(this, head, list) {
+			if (!match_futex(&this->key, key) ||
+			    !(this->bitset & bitset))
+				continue;
+			if (this->task->policy == SCHED_FIFO ||
+			    this->task->policy == SCHED_RR) {
+				winner = this;
+				break;
+			}
+			total += futex_q_tickets(this);
+		}
+
+		if (!winner) {
+			if (!total)
+				break;
+
+			lottery = (u64)random32() << 32 | random32();
+			lottery -= div64_u64(lottery, total) * total;
+
+			plist_for_each_entry(this, head, list) {
+				if (!match_futex(&this->key, key) ||
+				    !(this->bitset & bitset))
+					continue;
+				winner = this;
+				if (lottery < futex_q_tickets(this))
+					break;
+				lottery -= futex_q_tickets(this);
+			}
+		}
+
+		wake_futex(winner);
+		ret++;
+	}
+
+	return ret;
+}
+#endif
+
 /*
  * Wake up waiters matching bitset queued on this futex (uaddr).
+ * With lottery set, a partial wakeup picks the waiters in proportion
+ * to their lottery tickets instead of in plist order.
  */
-static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
+static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset,
+		      int lottery)
 {
 	struct futex_hash_bucket *hb;
 	struct futex_q *this, *next;
@@ -888,6 +957,29 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 	spin_lock(&hb->lock);
 	head = &hb->chain;
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (lottery) {
+		int nr_queued = 0;
+
+		plist_for_each_entry(this, head, list) {
+			if (!match_futex(&this->key, &key))
+				continue;
+			if (this->pi_state || this->rt_waiter) {
+				ret = -EINVAL;
+				goto out_unlock;
+			}
+			if (this->bitset & bitset)
+				nr_queued++;
+		}
+
+		/* When everybody is woken anyway, skip the draws */
+		if (nr_queued > nr_wake) {
+			ret = futex_wake_lottery(head, &key, nr_wake, bitset);
+			goto out_unlock;
+		}
+	}
+#endif
+
 	plist_for_each_entry_safe(this, next, head, list) {
 		if (match_futex (&this->key, &key)) {
 			if (this->pi_state || this->rt_waiter) {
@@ -905,6 +997,7 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 		}
 	}
 
+out_unlock:
 	spin_unlock(&hb->lock);
 	put_futex_key(fshared, &key);
 out:
@@ -2449,7 +2542,7 @@ retry:
 		 * PI futexes happens in exit_pi_state():
 		 */
 		if (!pi && (uval & FUTEX_WAITERS))
-			futex_wake(uaddr, 1, 1, FUTEX_BITSET_MATCH_ANY);
+			futex_wake(uaddr, 1, 1, FUTEX_BITSET_MATCH_ANY, 0);
 	}
 	return 0;
 }
@@ -2543,7 +2636,7 @@ void exit_robust_list(struct task_struct *curr)
 long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 		u32 __user *uaddr2, u32 val2, u32 val3)
 {
-	int clockrt, ret = -ENOSYS;
+	int clockrt, lottery, ret = -ENOSYS;
 	int cmd = op & FUTEX_CMD_MASK;
 	int fshared = 0;
 
@@ -2554,6 +2647,15 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 	if (clockrt && cmd != FUTEX_WAIT_BITSET && cmd != FUTEX_WAIT_REQUEUE_PI)
 		return -ENOSYS;
 
+	lottery = op & FUTEX_LOTTERY_FLAG;
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (lottery && cmd != FUTEX_WAKE && cmd != FUTEX_WAKE_BITSET)
+		return -ENOSYS;
+#else
+	if (lottery)
+		return -ENOSYS;
+#endif
+
 	switch (cmd) {
 	case FUTEX_WAIT:
 		val3 = FUTEX_BITSET_MATCH_ANY;
@@ -2563,7 +2665,7 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 	case FUTEX_WAKE:
 		val3 = FUTEX_BITSET_MATCH_ANY;
 	case FUTEX_WAKE_BITSET:
-		ret = futex_wake(uaddr, fshared, val, val3);
+		ret = futex_wake(uaddr, fshared, val, val3, lottery);
 		break;
 	case FUTEX_REQUEUE:
 		ret = futex_requeue(uaddr, fshared, uaddr2, val, val2, NULL, 0);
@@ -25,6 +25,8 @@
 #include <linux/err.h>
 #include <linux/kfifo.h>
 #include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
 
 /**
  * kfifo_init - allocates a new FIFO using a preallocated buffer
@@ -195,3 +197,325 @@ unsigned int __kfifo_get(struct kfifo *fifo,
 	return len;
 }
 EXPORT_SYMBOL(__kfifo_get);
+
+/*
+ * Multi-producer, single-consumer FIFO of records.
+ *
+ * Producers reserve room for a record by moving fifo->head forward with
+ * cmpxchg(), copy the record in, then commit it by setting the commit bit
+ * in its header. The consumer takes committed records in reservation
+ * order and zeroes their room before handing it back, so a header slot
+ * never shows a stale commit. A record that does not fit before the end
+ * of the buffer is preceded by a pad record filling the end.
+ */
+#define KFIFO_MPSC_COMMIT	0x80000000U
+#define KFIFO_MPSC_PAD		0x40000000U
+#define KFIFO_MPSC_LEN		0x3fffffffU
+#define KFIFO_MPSC_HDR		sizeof(u32)
+
+static inline unsigned int kfifo_mpsc_recsize(unsigned int len)
+{
+	return KFIFO_MPSC_HDR + ALIGN(len, KFIFO_MPSC_HDR);
+}
+
+/**
+ * kfifo_mpsc_alloc - allocates a new multi-producer FIFO and its buffer
+ * @size: the size of the internal buffer to be allocated.
+ * @gfp_mask: get_free_pages mask, passed to kmalloc()
+ *
+ * The size will be rounded-up to a power of 2. Each record costs its
+ * length rounded up to 4 bytes, plus a 4 byte header.
+ */
+struct kfifo_mpsc *kfifo_mpsc_alloc(unsigned int size, gfp_t gfp_mask)
+{
+	struct kfifo_mpsc *fifo;
+
+	if (size < 2 * KFIFO_MPSC_HDR)
+		size = 2 * KFIFO_MPSC_HDR;
+	if (!is_power_of_2(size)) {
+		BUG_ON(size > 0x80000000);
+		size = roundup_pow_of_two(size);
+	}
+
+	fifo = kmalloc(sizeof(struct kfifo_mpsc), gfp_mask);
+	if (!fifo)
+		return ERR_PTR(-ENOMEM);
+
+	/* A zeroed buffer holds no committed header */
+	fifo->buffer = kzalloc(size, gfp_mask);
+	if (!fifo->buffer) {
+		kfree(fifo);
+		return ERR_PTR(-ENOMEM);
+	}
+	fifo->size = size;
+	fifo->head = fifo->out = 0;
+
+	return fifo;
+}
+EXPORT_SYMBOL(kfifo_mpsc_alloc);
+
+/**
+ * kfifo_mpsc_free - frees the multi-producer FIFO
+ * @fifo: the fifo to be freed.
+ */
+void kfifo_mpsc_free(struct kfifo_mpsc *fifo)
+{
+	kfree(fifo->buffer);
+	kfree(fifo);
+}
+EXPORT_SYMBOL(kfifo_mpsc_free);
+
+/**
+ * kfifo_mpsc_put - puts a record into the multi-producer FIFO
+ * @fifo: the fifo to be used.
+ * @buffer: the record to be added.
+ * @len: the length of the record.
+ *
+ * Any number of producers may call this concurrently, from any context,
+ * without locking. The record is added whole or not at all.
+ *
+ * Returns @len, or 0 if the FIFO has no room for the record.
+ */
+unsigned int kfifo_mpsc_put(struct kfifo_mpsc *fifo,
+			    const unsigned char *buffer, unsigned int len)
+{
+	unsigned int head, off, pad, need;
+	u32 *hdr;
+
+	if (!len || len > KFIFO_MPSC_LEN)
+		return 0;
+
+	need = kfifo_mpsc_recsize(len);
+	do {
+		head = ACCESS_ONCE(fifo->head);
+		off = head & (fifo->size - 1);
+		pad = fifo->size - off < need ? fifo->size - off : 0;
+
+		/* A record never wraps, so it may need the whole buffer */
+		if (pad + need > fifo->size - (head - ACCESS_ONCE(fifo->out)))
+			return 0;
+	} while (cmpxchg(&fifo->head, head, head + pad + need) != head);
+
+	/*
+	 * The cmpxchg() orders the fifo->out sample -before- we write
+	 * into the room the consumer gave back.
+	 */
+	if (pad) {
+		hdr = (u32 *)(fifo->buffer + off);
+		ACCESS_ONCE(*hdr) = KFIFO_MPSC_COMMIT | KFIFO_MPSC_PAD | pad;
+		off = 0;
+	}
+
+	hdr = (u32 *)(fifo->buffer + off);
+	memcpy(hdr + 1, buffer, len);
+
+	/*
+	 * Ensure that we add the bytes to the kfifo -before-
+	 * we commit the record.
+	 */
+	smp_wmb();
+
+	ACCESS_ONCE(*hdr) = KFIFO_MPSC_COMMIT | len;
+
+	return len;
+}
+EXPORT_SYMBOL(kfifo_mpsc_put);
+
+/**
+ * kfifo_mpsc_get - gets a record from the multi-producer FIFO
+ * @fifo: the fifo to be used.
+ * @buffer: where the record must be copied.
+ * @len: the size of the destination buffer.
+ *
+ * Only one consumer may call this at a time. Records are returned in
+ * the order their room was reserved, so a producer that has reserved
+ * but not yet committed holds back the records behind it. A record
+ * longer than @len is truncated.
+ *
+ * Returns the number of bytes copied, 0 if no record is committed.
+ */
+unsigned int kfifo_mpsc_get(struct kfifo_mpsc *fifo,
+			    unsigned char *buffer, unsigned int len)
+{
+	unsigned int off, h, skip, copied;
+	u32 *hdr;
+
+	for (;;) {
+		if (fifo->out == ACCESS_ONCE(fifo->head))
+			return 0;
+
+		off = fifo->out & (fifo->size - 1);
+		hdr = (u32 *)(fifo->buffer + off);
+		h = ACCESS_ONCE(*hdr);
+		if (!(h & KFIFO_MPSC_COMMIT))
+			return 0;
+
+		/*
+		 * Ensure that we sample the commit -before- we
+		 * read the record.
+		 */
+		smp_rmb();
+
+		if (h & KFIFO_MPSC_PAD) {
+			skip = h & KFIFO_MPSC_LEN;
+			copied = 0;
+		} else {
+			skip = kfifo_mpsc_recsize(h & KFIFO_MPSC_LEN);
+			copied = min(len, h & KFIFO_MPSC_LEN);
+			memcpy(buffer, hdr + 1, copied);
+		}
+
+		memset(hdr, 0, skip);
+
+		/*
+		 * Ensure that we clear the room -before- we
+		 * give it back to the producers.
+		 */
+		smp_mb();
+
+		fifo->out += skip;
+		if (!(h & KFIFO_MPSC_PAD))
+			return copied;
+	}
+}
+EXPORT_SYMBOL(kfifo_mpsc_get);
+
+/*
+ * Per-cpu fan-in queue of fixed size elements.
+ *
+ * Each cpu produces into its own single-producer FIFO with interrupts
+ * off, so producers never share a cacheline; the single consumer drains
+ * the cpus in turn, a batch of elements at a time.
+ */
+
+/**
+ * kfifo_percpu_alloc - allocates a per-cpu fan-in queue
+ * @size: the size of the FIFO of each cpu, rounded-up to a power of 2.
+ * @esize: the size of an element.
+ * @gfp_mask: get_free_pages mask, passed to kmalloc()
+ */
+struct kfifo_percpu *kfifo_percpu_alloc(unsigned int size,
+					unsigned int esize, gfp_t gfp_mask)
+{
+	struct kfifo_percpu *q;
+	int cpu;
+
+	BUG_ON(!esize);
+	if (size < esize)
+		size = esize;
+	if (!is_power_of_2(size)) {
+		BUG_ON(size > 0x80000000);
+		size = roundup_pow_of_two(size);
+	}
+
+	q = kmalloc(sizeof(struct kfifo_percpu), gfp_mask);
+	if (!q)
+		return ERR_PTR(-ENOMEM);
+
+	q->fifos = alloc_percpu(struct kfifo);
+	if (!q->fifos) {
+		kfree(q);
+		return ERR_PTR(-ENOMEM);
+	}
+	q->esize = esize;
+	q->next_cpu = 0;
+
+	for_each_possible_cpu(cpu) {
+		struct kfifo *fifo = per_cpu_ptr(q->fifos, cpu);
+
+		fifo->buffer = kmalloc_node(size, gfp_mask, cpu_to_node(cpu));
+		if (!fifo->buffer) {
+			kfifo_percpu_free(q);
+			return ERR_PTR(-ENOMEM);
+		}
+		fifo->size = size;
+		fifo->in = fifo->out = 0;
+		fifo->lock = NULL;
+	}
+
+	return q;
+}
+EXPORT_SYMBOL(kfifo_percpu_alloc);
+
+/**
+ * kfifo_percpu_free - frees the per-cpu fan-in queue
+ * @q: the queue to be freed.
+ */
+void kfifo_percpu_free(struct kfifo_percpu *q)
+{
+	int cpu;
+
+	/* alloc_percpu() zeroes, so this also undoes a partial alloc */
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(q->fifos, cpu)->buffer);
+	free_percpu(q->fifos);
+	kfree(q);
+}
+EXPORT_SYMBOL(kfifo_percpu_free);
+
+/**
+ * kfifo_percpu_put - puts an element into the FIFO of this cpu
+ * @q: the queue to be used.
+ * @elem: the element to be added, @q->esize bytes.
+ *
+ * May be called from any context, without locking.
+ *
+ * Returns 1 if the element was added, 0 if the FIFO of this cpu is full.
+ */
+int kfifo_percpu_put(struct kfifo_percpu *q, const void *elem)
+{
+	struct kfifo *fifo;
+	unsigned long flags;
+	int ret = 0;
+
+	local_irq_save(flags);
+	fifo = per_cpu_ptr(q->fifos, smp_processor_id());
+	if (fifo->size - __kfifo_len(fifo) >= q->esize) {
+		__kfifo_put(fifo, elem, q->esize);
+		ret = 1;
+	}
+	local_irq_restore(flags);
+
+	return ret;
+}
+EXPORT_SYMBOL(kfifo_percpu_put);
+
+/**
+ * kfifo_percpu_get - gets a batch of elements from the per-cpu FIFOs
+ * @q: the queue to be used.
+ * @buffer: where the elements must be copied.
+ * @n: the number of elements @buffer has room for.
+ *
+ * Only one consumer may call this at a time. The FIFOs of all possible
+ * cpus are drained in turn, starting after the cpu the last call stopped
+ * at, so no cpu is starved. Elements of one cpu keep their order.
+ *
+ * Returns the number of elements copied.
+ */
+unsigned int kfifo_percpu_get(struct kfifo_percpu *q, void *buffer,
+			      unsigned int n)
+{
+	unsigned char *p = buffer;
+	unsigned int got = 0, len, i;
+	int cpu = q->next_cpu;
+
+	for (i = 0; i < nr_cpu_ids && got < n; i++) {
+		cpu = cpumask_next(cpu - 1, cpu_possible_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_possible_mask);
+
+		len = __kfifo_len(per_cpu_ptr(q->fifos, cpu)) / q->esize;
+		len = min(len, n - got);
+		if (len) {
+			__kfifo_get(per_cpu_ptr(q->fifos, cpu), p,
+				    len * q->esize);
+			p += len * q->esize;
+			got += len;
+		}
+		cpu++;
+	}
+	q->next_cpu = cpu;
+
+	return got;
+}
+EXPORT_SYMBOL(kfifo_percpu_get);
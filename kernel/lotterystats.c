@@ -0,0 +1,412 @@
+/*
+ * lotterystats.c - Export lottery scheduler statistics to userland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/pid.h>
+#include <linux/nsproxy.h>
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
+#include <linux/lotterystats.h>
+#include <linux/proc_lottery.h>
+#include <net/genetlink.h>
+
+static struct genl_family family = {
+	.id		= GENL_ID_GENERATE,
+	.name		= LOTTERYSTATS_GENL_NAME,
+	.version	= LOTTERYSTATS_GENL_VERSION,
+	.maxattr	= LOTTERYSTATS_ATTR_MAX,
+};
+
+static struct genl_multicast_group snapshot_group = {
+	.name		= LOTTERYSTATS_GENL_MCGRP_NAME,
+};
+
+static struct nla_policy lotterystats_policy[LOTTERYSTATS_ATTR_MAX+1]
+__read_mostly = {
+	[LOTTERYSTATS_ATTR_CPU]      = { .type = NLA_U32 },
+	[LOTTERYSTATS_ATTR_PID]      = { .type = NLA_U32 },
+	[LOTTERYSTATS_ATTR_INTERVAL] = { .type = NLA_U32 },
+};
+
+/* Snapshot period in ms, 0 while not multicasting */
+static unsigned int snapshot_interval;
+static DEFINE_MUTEX(snapshot_mutex);
+static void snapshot_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(snapshot_work, snapshot_work_fn);
+static u32 snapshot_seq;
+
+/*
+ * Size of one cpu entry, revisit when attributes are added
+ */
+static size_t cpu_stats_size(void)
+{
+	return nla_total_size(0) +			/* CPU_STATS nest */
+		2 * nla_total_size(sizeof(u32)) +	/* ID, NR_RUNNING */
+		2 * nla_total_size(sizeof(u32)) +	/* BACKEND, THROTTLED */
+		5 * nla_total_size(sizeof(u64)) +	/* TICKETS...RUNTIME */
+		nla_total_size(LOTTERYSTATS_HIST_BUCKETS * sizeof(u64));
+}
+
+/*
+ * Size of one task entry, revisit when attributes are added
+ */
+static size_t task_stats_size(void)
+{
+	return nla_total_size(0) +			/* TASK_STATS nest */
+		2 * nla_total_size(sizeof(u32)) +	/* PID, CPU */
+		4 * nla_total_size(sizeof(u64));	/* TICKETS...RUNTIME */
+}
+
+static int fill_cpu_stats(struct sk_buff *skb, int cpu)
+{
+	struct lottery_cpu_stats st;
+	struct nlattr *na;
+
+	lottery_read_cpu_stats(cpu, &st);
+
+	na = nla_nest_start(skb, LOTTERYSTATS_ATTR_CPU_STATS);
+	if (!na)
+		return -EMSGSIZE;
+
+	NLA_PUT_U32(skb, LOTTERYSTATS_CPU_ID, cpu);
+	NLA_PUT_U32(skb, LOTTERYSTATS_CPU_NR_RUNNING, st.nr_running);
+	NLA_PUT_U64(skb, LOTTERYSTATS_CPU_TICKETS, st.tickets);
+	NLA_PUT_U32(skb, LOTTERYSTATS_CPU_BACKEND, st.backend);
+	NLA_PUT_U64(skb, LOTTERYSTATS_CPU_PICKS, st.picks);
+	NLA_PUT_U64(skb, LOTTERYSTATS_CPU_ENQUEUES, st.enqueues);
+	NLA_PUT_U64(skb, LOTTERYSTATS_CPU_FORCED, st.forced);
+	NLA_PUT_U32(skb, LOTTERYSTATS_CPU_THROTTLED, st.throttled);
+	NLA_PUT_U64(skb, LOTTERYSTATS_CPU_RUNTIME, st.runtime);
+	NLA_PUT(skb, LOTTERYSTATS_CPU_PICK_HIST, sizeof(st.pick_hist),
+		st.pick_hist);
+
+	nla_nest_end(skb, na);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(skb, na);
+	return -EMSGSIZE;
+}
+
+/*
+ * Called under rcu_read_lock(), the values of a running task are racy
+ * but each one is read once
+ */
+static int fill_task_stats(struct sk_buff *skb, struct task_struct *p)
+{
+	struct nlattr *na;
+
+	na = nla_nest_start(skb, LOTTERYSTATS_ATTR_TASK_STATS);
+	if (!na)
+		return -EMSGSIZE;
+
+	NLA_PUT_U32(skb, LOTTERYSTATS_TASK_PID, task_pid_vnr(p));
+	NLA_PUT_U32(skb, LOTTERYSTATS_TASK_CPU, task_cpu(p));
+	NLA_PUT_U64(skb, LOTTERYSTATS_TASK_TICKETS, p->lt.tickets);
+	NLA_PUT_U64(skb, LOTTERYSTATS_TASK_NORMAL_TICKETS,
+		    p->lt.normal_tickets);
+	NLA_PUT_U64(skb, LOTTERYSTATS_TASK_QUANTUM,
+		    (u64)p->lt.quantum * TICK_NSEC);
+	NLA_PUT_U64(skb, LOTTERYSTATS_TASK_RUNTIME, p->se.sum_exec_runtime);
+
+	nla_nest_end(skb, na);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(skb, na);
+	return -EMSGSIZE;
+}
+
+static int prepare_reply(struct genl_info *info, u8 cmd, struct sk_buff **skbp,
+			 void **replyp, size_t size)
+{
+	struct sk_buff *skb;
+	void *reply;
+
+	skb = genlmsg_new(size, GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+
+	if (!info)
+		reply = genlmsg_put(skb, 0, snapshot_seq++, &family, 0, cmd);
+	else
+		reply = genlmsg_put_reply(skb, info, &family, 0, cmd);
+	if (reply == NULL) {
+		nlmsg_free(skb);
+		return -EINVAL;
+	}
+
+	*skbp = skb;
+	*replyp = reply;
+	return 0;
+}
+
+static int cmd_attr_cpu(struct genl_info *info)
+{
+	struct sk_buff *rep_skb;
+	void *reply;
+	size_t size;
+	unsigned int cpu;
+	int rc;
+
+	cpu = nla_get_u32(info->attrs[LOTTERYSTATS_ATTR_CPU]);
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -EINVAL;
+
+	size = cpu_stats_size();
+	rc = prepare_reply(info, LOTTERYSTATS_CMD_GET_CPU, &rep_skb, &reply,
+			   size);
+	if (rc < 0)
+		return rc;
+
+	rc = fill_cpu_stats(rep_skb, cpu);
+	if (rc < 0)
+		goto err;
+
+	genlmsg_end(rep_skb, reply);
+	return genlmsg_reply(rep_skb, info);
+err:
+	nlmsg_free(rep_skb);
+	return rc;
+}
+
+static int lotterystats_cpu_cmd(struct sk_buff *skb, struct genl_info *info)
+{
+	if (!info->attrs[LOTTERYSTATS_ATTR_CPU])
+		return -EINVAL;
+
+	return cmd_attr_cpu(info);
+}
+
+/*
+ * Dump one message per possible cpu, cb->args[0] is the next cpu
+ */
+static int lotterystats_cpu_dump(struct sk_buff *skb,
+				 struct netlink_callback *cb)
+{
+	int cpu = cb->args[0];
+	void *hdr;
+
+	for (; cpu < nr_cpu_ids; cpu++) {
+		if (!cpu_possible(cpu))
+			continue;
+
+		hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid,
+				  cb->nlh->nlmsg_seq, &family, NLM_F_MULTI,
+				  LOTTERYSTATS_CMD_GET_CPU);
+		if (!hdr)
+			break;
+		if (fill_cpu_stats(skb, cpu) < 0) {
+			genlmsg_cancel(skb, hdr);
+			break;
+		}
+		genlmsg_end(skb, hdr);
+	}
+	cb->args[0] = cpu;
+
+	return skb->len;
+}
+
+static int lotterystats_task_cmd(struct sk_buff *skb, struct genl_info *info)
+{
+	struct task_struct *p;
+	struct sk_buff *rep_skb;
+	void *reply;
+	pid_t pid;
+	int rc;
+
+	if (!info->attrs[LOTTERYSTATS_ATTR_PID])
+		return -EINVAL;
+
+	pid = nla_get_u32(info->attrs[LOTTERYSTATS_ATTR_PID]);
+
+	rc = prepare_reply(info, LOTTERYSTATS_CMD_GET_TASK, &rep_skb, &reply,
+			   task_stats_size());
+	if (rc < 0)
+		return rc;
+
+	rc = -ESRCH;
+	rcu_read_lock();
+	p = find_task_by_vpid(pid);
+	if (p)
+		rc = fill_task_stats(rep_skb, p);
+	rcu_read_unlock();
+	if (rc < 0)
+		goto err;
+
+	genlmsg_end(rep_skb, reply);
+	return genlmsg_reply(rep_skb, info);
+err:
+	nlmsg_free(rep_skb);
+	return rc;
+}
+
+/*
+ * Dump every SCHED_LOTTERY task in pid order, cb->args[0] is the next pid
+ */
+static int lotterystats_task_dump(struct sk_buff *skb,
+				  struct netlink_callback *cb)
+{
+	struct pid_namespace *ns = current->nsproxy->pid_ns;
+	struct task_struct *p;
+	struct pid *pid;
+	void *hdr;
+	int nr = cb->args[0];
+
+	rcu_read_lock();
+	for (; (pid = find_ge_pid(nr, ns)); nr++) {
+		nr = pid_nr_ns(pid, ns);
+		p = pid_task(pid, PIDTYPE_PID);
+		if (!p || p->policy != SCHED_LOTTERY)
+			continue;
+
+		hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid,
+				  cb->nlh->nlmsg_seq, &family, NLM_F_MULTI,
+				  LOTTERYSTATS_CMD_GET_TASK);
+		if (!hdr)
+			break;
+		if (fill_task_stats(skb, p) < 0) {
+			genlmsg_cancel(skb, hdr);
+			break;
+		}
+		genlmsg_end(skb, hdr);
+	}
+	rcu_read_unlock();
+	cb->args[0] = nr;
+
+	return skb->len;
+}
+
+/*
+ * Multicast one snapshot with every possible cpu, if anyone listens
+ */
+static void send_snapshot(void)
+{
+	struct sk_buff *skb;
+	void *reply;
+	size_t size;
+	int cpu, rc;
+
+	if (!netlink_has_listeners(init_net.genl_sock, snapshot_group.id))
+		return;
+
+	size = nla_total_size(sizeof(u64)) +
+		num_possible_cpus() * cpu_stats_size();
+	if (prepare_reply(NULL, LOTTERYSTATS_CMD_SNAPSHOT, &skb, &reply, size))
+		return;
+
+	rc = nla_put_u64(skb, LOTTERYSTATS_ATTR_TIMESTAMP, sched_clock());
+	for_each_possible_cpu(cpu) {
+		if (rc < 0)
+			break;
+		rc = fill_cpu_stats(skb, cpu);
+	}
+	if (rc < 0) {
+		nlmsg_free(skb);
+		return;
+	}
+
+	genlmsg_end(skb, reply);
+	genlmsg_multicast(skb, 0, snapshot_group.id, GFP_KERNEL);
+}
+
+static void snapshot_work_fn(struct work_struct *work)
+{
+	unsigned int interval = ACCESS_ONCE(snapshot_interval);
+
+	if (!interval)
+		return;
+
+	send_snapshot();
+	schedule_delayed_work(&snapshot_work, msecs_to_jiffies(interval));
+}
+
+static int lotterystats_interval_cmd(struct sk_buff *skb,
+				     struct genl_info *info)
+{
+	unsigned int interval;
+
+	if (!info->attrs[LOTTERYSTATS_ATTR_INTERVAL])
+		return -EINVAL;
+
+	interval = nla_get_u32(info->attrs[LOTTERYSTATS_ATTR_INTERVAL]);
+
+	mutex_lock(&snapshot_mutex);
+	snapshot_interval = interval;
+	cancel_delayed_work_sync(&snapshot_work);
+	if (interval)
+		schedule_delayed_work(&snapshot_work,
+				      msecs_to_jiffies(interval));
+	mutex_unlock(&snapshot_mutex);
+
+	return 0;
+}
+
+static struct genl_ops lotterystats_cpu_ops = {
+	.cmd		= LOTTERYSTATS_CMD_GET_CPU,
+	.doit		= lotterystats_cpu_cmd,
+	.dumpit		= lotterystats_cpu_dump,
+	.policy		= lotterystats_policy,
+};
+
+static struct genl_ops lotterystats_task_ops = {
+	.cmd		= LOTTERYSTATS_CMD_GET_TASK,
+	.doit		= lotterystats_task_cmd,
+	.dumpit		= lotterystats_task_dump,
+	.policy		= lotterystats_policy,
+};
+
+static struct genl_ops lotterystats_interval_ops = {
+	.cmd		= LOTTERYSTATS_CMD_SET_INTERVAL,
+	.doit		= lotterystats_interval_cmd,
+	.policy		= lotterystats_policy,
+	.flags		= GENL_ADMIN_PERM,
+};
+
+static int __init lotterystats_init(void)
+{
+	int rc;
+
+	rc = genl_register_family(&family);
+	if (rc)
+		return rc;
+
+	rc = genl_register_mc_group(&family, &snapshot_group);
+	if (rc)
+		goto err;
+
+	rc = genl_register_ops(&family, &lotterystats_cpu_ops);
+	if (rc < 0)
+		goto err;
+
+	rc = genl_register_ops(&family, &lotterystats_task_ops);
+	if (rc < 0)
+		goto err;
+
+	rc = genl_register_ops(&family, &lotterystats_interval_ops);
+	if (rc < 0)
+		goto err;
+
+	pr_info("registered lotterystats version %d\n",
+	       LOTTERYSTATS_GENL_VERSION);
+	return 0;
+err:
+	/* Unregistering the family drops its ops and groups */
+	genl_unregister_family(&family);
+	return rc;
+}
+
+late_initcall(lotterystats_init);
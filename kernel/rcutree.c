@@ -46,6 +46,8 @@
 #include <linux/cpu.h>
 #include <linux/mutex.h>
 #include <linux/time.h>
+#include <linux/kthread.h>
+#include <linux/bootmem.h>
 
 #include "rcutree.h"
 
@@ -1325,9 +1327,231 @@ static void rcu_process_callbacks(struct softirq_action *unused)
 	smp_mb(); /* See above block comment. */
 }
 
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Callback offloading.  CPUs named by rcu_nocbs= never invoke RCU
+ * callbacks themselves: __call_rcu() appends them to ->nocb_head, and
+ * a per-CPU, per-flavor kthread takes the whole list, waits for a grace
+ * period and invokes it.  The list is taken in one go, so a burst of
+ * call_rcu() costs one grace-period wait rather than one per callback.
+ */
+static cpumask_var_t rcu_nocb_mask;
+static bool have_rcu_nocb_mask;
+
+static int __init rcu_nocb_setup(char *str)
+{
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+static void __init
+rcu_boot_init_nocb_percpu_data(int cpu, struct rcu_state *rsp)
+{
+	struct rcu_data *rdp = rsp->rda[cpu];
+
+	rdp->nocb = have_rcu_nocb_mask && cpumask_test_cpu(cpu, rcu_nocb_mask);
+	spin_lock_init(&rdp->nocb_lock);
+	rdp->nocb_head = NULL;
+	rdp->nocb_tail = &rdp->nocb_head;
+	rdp->nocb_qlen = 0;
+	init_waitqueue_head(&rdp->nocb_wq);
+	rdp->nocb_rsp = rsp;
+}
+
+/*
+ * Queue @head for @rdp's offload kthread if @rdp's CPU is offloaded,
+ * returning false if the caller is to queue it normally.  Callbacks
+ * queued before the kthread exists simply wait for it.  Must be called
+ * with irqs disabled.
+ */
+static bool rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *head)
+{
+	bool was_empty;
+
+	if (!rdp->nocb)
+		return false;
+
+	spin_lock(&rdp->nocb_lock);
+	was_empty = rdp->nocb_head == NULL;
+	*rdp->nocb_tail = head;
+	rdp->nocb_tail = &head->next;
+	rdp->nocb_qlen++;
+	spin_unlock(&rdp->nocb_lock);
+
+	if (was_empty && rdp->nocb_kthread)
+		wake_up(&rdp->nocb_wq);
+	return true;
+}
+
 static void
 __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
-	   struct rcu_state *rsp)
+	   struct rcu_state *rsp, bool nocb);
+
+/*
+ * Wait for a full grace period of @rdp's flavor.  The callback used for
+ * that is queued on whatever CPU we run on, bypassing offloading, or a
+ * kthread running on an offloaded CPU would wait for itself.
+ */
+static void rcu_nocb_wait_gp(struct rcu_data *rdp)
+{
+	struct rcu_synchronize rcu;
+
+	init_completion(&rcu.completion);
+	__call_rcu(&rcu.head, wakeme_after_rcu, rdp->nocb_rsp, false);
+	wait_for_completion(&rcu.completion);
+}
+
+static int rcu_nocb_kthread(void *arg)
+{
+	struct rcu_data *rdp = arg;
+	struct rcu_head *list, *next;
+	long count;
+
+	for (;;) {
+		wait_event_interruptible(rdp->nocb_wq,
+					 ACCESS_ONCE(rdp->nocb_head) != NULL);
+
+		spin_lock_irq(&rdp->nocb_lock);
+		list = rdp->nocb_head;
+		rdp->nocb_head = NULL;
+		rdp->nocb_tail = &rdp->nocb_head;
+		spin_unlock_irq(&rdp->nocb_lock);
+		if (list == NULL)
+			continue;
+
+		/* Everything on the list was queued before this GP began. */
+		rcu_nocb_wait_gp(rdp);
+
+		/* Callbacks expect to run with bottom halves disabled. */
+		count = 0;
+		while (list) {
+			next = list->next;
+			prefetch(next);
+			local_bh_disable();
+			list->func(list);
+			local_bh_enable();
+			list = next;
+			count++;
+			cond_resched();
+		}
+
+		spin_lock_irq(&rdp->nocb_lock);
+		rdp->nocb_qlen -= count;
+		spin_unlock_irq(&rdp->nocb_lock);
+	}
+	return 0;
+}
+
+/*
+ * Start the offload kthreads of one flavor.  They run anywhere until
+ * rcu_bind_nocb_kthreads() confines them once the other CPUs are up.
+ */
+static void __init
+rcu_spawn_nocb_kthreads_flavor(struct rcu_state *rsp, char abbr)
+{
+	struct rcu_data *rdp;
+	struct task_struct *t;
+	int cpu;
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		rdp = rsp->rda[cpu];
+		t = kthread_create(rcu_nocb_kthread, rdp, "rcuo%c/%d",
+				   abbr, cpu);
+		BUG_ON(IS_ERR(t));
+		rdp->nocb_kthread = t;
+		wake_up_process(t);
+	}
+}
+
+/*
+ * Move the offload kthreads of one flavor to the CPUs that aren't
+ * offloaded themselves.  A kthread whose housekeeping CPUs are all
+ * offline is left where it is.
+ */
+static void __init
+rcu_bind_nocb_kthreads_flavor(struct rcu_state *rsp,
+			      const struct cpumask *housekeeping)
+{
+	struct task_struct *t;
+	int cpu;
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		t = rsp->rda[cpu]->nocb_kthread;
+		if (set_cpus_allowed_ptr(t, housekeeping))
+			printk(KERN_WARNING
+			       "RCU: no online CPU to run %s on, left unbound.\n",
+			       t->comm);
+	}
+}
+
+static int __init rcu_spawn_nocb_kthreads(void)
+{
+	static char buf[256];
+
+	if (!have_rcu_nocb_mask)
+		return 0;
+
+	cpumask_and(rcu_nocb_mask, rcu_nocb_mask, cpu_possible_mask);
+	cpulist_scnprintf(buf, sizeof(buf), rcu_nocb_mask);
+	printk(KERN_INFO "RCU: offloading callbacks from CPUs %s.\n", buf);
+
+	rcu_spawn_nocb_kthreads_flavor(&rcu_sched_state, 's');
+	rcu_spawn_nocb_kthreads_flavor(&rcu_bh_state, 'b');
+	rcu_preempt_spawn_nocb_kthreads();
+	return 0;
+}
+early_initcall(rcu_spawn_nocb_kthreads);
+
+/*
+ * The kthreads are spawned before SMP bringup, when only the boot CPU
+ * is online and may be offloaded itself, so they are bound only now.
+ */
+static int __init rcu_bind_nocb_kthreads(void)
+{
+	cpumask_var_t housekeeping;
+
+	if (!have_rcu_nocb_mask)
+		return 0;
+	if (!alloc_cpumask_var(&housekeeping, GFP_KERNEL))
+		return -ENOMEM;
+
+	cpumask_andnot(housekeeping, cpu_possible_mask, rcu_nocb_mask);
+	if (!cpumask_empty(housekeeping)) {
+		rcu_bind_nocb_kthreads_flavor(&rcu_sched_state, housekeeping);
+		rcu_bind_nocb_kthreads_flavor(&rcu_bh_state, housekeeping);
+		rcu_preempt_bind_nocb_kthreads(housekeeping);
+	}
+
+	free_cpumask_var(housekeeping);
+	return 0;
+}
+core_initcall(rcu_bind_nocb_kthreads);
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static void __init
+rcu_boot_init_nocb_percpu_data(int cpu, struct rcu_state *rsp)
+{
+}
+
+static bool rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *head)
+{
+	return false;
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
+
+/*
+ * Queue a callback of flavor @rsp on this CPU, or for this CPU's offload
+ * kthread if it has one and @nocb allows it.
+ */
+static void
+__call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
+	   struct rcu_state *rsp, bool nocb)
 {
 	unsigned long flags;
 	struct rcu_data *rdp;
@@ -1337,14 +1561,19 @@ __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
 
 	smp_mb(); /* Ensure RCU update seen before callback registry. */
 
+	local_irq_save(flags);
+	rdp = rsp->rda[smp_processor_id()];
+	if (nocb && rcu_nocb_enqueue(rdp, head)) {
+		local_irq_restore(flags);
+		return;
+	}
+
 	/*
 	 * Opportunistically note grace-period endings and beginnings.
 	 * Note that we might see a beginning right after we see an
 	 * end, but never vice versa, since this CPU has to pass through
 	 * a quiescent state betweentimes.
 	 */
-	local_irq_save(flags);
-	rdp = rsp->rda[smp_processor_id()];
 	rcu_process_gp_end(rsp, rdp);
 	check_for_new_grace_period(rsp, rdp);
 
@@ -1385,7 +1614,7 @@ __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
  */
 void call_rcu_sched(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_sched_state);
+	__call_rcu(head, func, &rcu_sched_state, true);
 }
 EXPORT_SYMBOL_GPL(call_rcu_sched);
 
@@ -1394,7 +1623,7 @@ EXPORT_SYMBOL_GPL(call_rcu_sched);
  */
 void call_rcu_bh(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_bh_state);
+	__call_rcu(head, func, &rcu_bh_state, true);
 }
 EXPORT_SYMBOL_GPL(call_rcu_bh);
 
@@ -1506,6 +1735,56 @@ static void rcu_barrier_func(void *type)
 	call_rcu_func(head, rcu_barrier_callback);
 }
 
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * The offload kthread of an offline CPU keeps invoking whatever was
+ * queued before the CPU went down, so queue a barrier callback behind
+ * those too.  Lists which are already drained are skipped.  Called with
+ * preemption disabled, after rcu_barrier_func() ran on the online CPUs.
+ */
+static void rcu_barrier_nocb(struct rcu_state *rsp)
+{
+	struct rcu_data *rdp;
+	struct rcu_head *head;
+	unsigned long flags;
+	bool was_empty;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		rdp = rsp->rda[cpu];
+		if (!rdp->nocb || cpu_online(cpu))
+			continue;
+
+		head = &per_cpu(rcu_barrier_head, cpu);
+		head->func = rcu_barrier_callback;
+		head->next = NULL;
+
+		spin_lock_irqsave(&rdp->nocb_lock, flags);
+		if (!rdp->nocb_qlen) {
+			spin_unlock_irqrestore(&rdp->nocb_lock, flags);
+			continue;
+		}
+		atomic_inc(&rcu_barrier_cpu_count);
+		was_empty = rdp->nocb_head == NULL;
+		*rdp->nocb_tail = head;
+		rdp->nocb_tail = &head->next;
+		rdp->nocb_qlen++;
+		spin_unlock_irqrestore(&rdp->nocb_lock, flags);
+
+		if (was_empty && rdp->nocb_kthread)
+			wake_up(&rdp->nocb_wq);
+	}
+}
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static void rcu_barrier_nocb(struct rcu_state *rsp)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
+
 /*
  * Orchestrate the specified type of RCU barrier, waiting for all
  * RCU callbacks of the specified type to complete.
@@ -1531,6 +1810,7 @@ static void _rcu_barrier(struct rcu_state *rsp,
 	preempt_disable(); /* stop CPU_DYING from filling orphan_cbs_list */
 	rcu_adopt_orphan_cbs(rsp);
 	on_each_cpu(rcu_barrier_func, (void *)call_rcu_func, 1);
+	rcu_barrier_nocb(rsp);
 	preempt_enable(); /* CPU_DYING can again fill orphan_cbs_list */
 	if (atomic_dec_and_test(&rcu_barrier_cpu_count))
 		complete(&rcu_barrier_completion);
@@ -1579,6 +1859,8 @@ rcu_boot_init_percpu_data(int cpu, struct rcu_state *rsp)
 #endif /* #ifdef CONFIG_NO_HZ */
 	rdp->cpu = cpu;
 	spin_unlock_irqrestore(&rnp->lock, flags);
+
+	rcu_boot_init_nocb_percpu_data(cpu, rsp);
 }
 
 /*
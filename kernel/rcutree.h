@@ -200,6 +200,18 @@ struct rcu_data {
 	long n_rp_need_fqs;
 	long n_rp_need_nothing;
 
+#ifdef CONFIG_RCU_NOCB_CPU
+	/* 6) callback offloading, see rcu_nocb_kthread(). */
+	bool nocb;			/* Offload this CPU's callbacks. */
+	spinlock_t nocb_lock;		/* Protects the three below. */
+	struct rcu_head *nocb_head;	/* Callbacks for the kthread. */
+	struct rcu_head **nocb_tail;
+	long nocb_qlen;			/* # queued, including in flight. */
+	wait_queue_head_t nocb_wq;	/* The kthread sleeps here. */
+	struct task_struct *nocb_kthread;
+	struct rcu_state *nocb_rsp;	/* Flavor, for the GP wait. */
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 	int cpu;
 };
 
@@ -323,5 +335,10 @@ static int rcu_preempt_needs_cpu(int cpu);
 static void __cpuinit rcu_preempt_init_percpu_data(int cpu);
 static void rcu_preempt_send_cbs_to_orphanage(void);
 static void __init __rcu_init_preempt(void);
+#ifdef CONFIG_RCU_NOCB_CPU
+static void __init rcu_preempt_spawn_nocb_kthreads(void);
+static void __init
+rcu_preempt_bind_nocb_kthreads(const struct cpumask *housekeeping);
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
 
 #endif /* #else #ifdef RCU_TREE_NONCORE */
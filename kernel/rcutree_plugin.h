@@ -394,7 +394,7 @@ static void rcu_preempt_process_callbacks(void)
  */
 void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_preempt_state);
+	__call_rcu(head, func, &rcu_preempt_state, true);
 }
 EXPORT_SYMBOL_GPL(call_rcu);
 
@@ -460,6 +460,27 @@ static void __init __rcu_init_preempt(void)
 	RCU_INIT_FLAVOR(&rcu_preempt_state, rcu_preempt_data);
 }
 
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Spawn the callback-offload kthreads of preemptable RCU.
+ */
+static void __init rcu_preempt_spawn_nocb_kthreads(void)
+{
+	rcu_spawn_nocb_kthreads_flavor(&rcu_preempt_state, 'p');
+}
+
+/*
+ * Bind the callback-offload kthreads of preemptable RCU.
+ */
+static void __init
+rcu_preempt_bind_nocb_kthreads(const struct cpumask *housekeeping)
+{
+	rcu_bind_nocb_kthreads_flavor(&rcu_preempt_state, housekeeping);
+}
+
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 /*
  * Check for a task exiting while in a preemptable-RCU read-side
  * critical section, clean up if so.  No need to issue warnings,
@@ -642,4 +663,20 @@ static void __init __rcu_init_preempt(void)
 {
 }
 
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Because preemptable RCU does not exist, it has no callbacks to offload.
+ */
+static void __init rcu_preempt_spawn_nocb_kthreads(void)
+{
+}
+
+static void __init
+rcu_preempt_bind_nocb_kthreads(const struct cpumask *housekeeping)
+{
+}
+
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 #endif /* #else #ifdef CONFIG_TREE_PREEMPT_RCU */
@@ -97,6 +97,29 @@ static inline void mark_rt_mutex_waiters(struct rt_mutex *lock)
 }
 #endif
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+/*
+ * A SCHED_LOTTERY owner only takes the priority of waiters which would
+ * run as realtime tasks themselves. Lottery waiters at their own prio
+ * lend their tickets instead, so the owner stays in the lottery draw and
+ * under its runtime throttling. The waiters are sorted by prio, skip
+ * those until a realtime one shows up.
+ */
+static int rt_mutex_lottery_getprio(struct task_struct *task)
+{
+	struct rt_mutex_waiter *waiter;
+
+	plist_for_each_entry(waiter, &task->pi_waiters, pi_list_entry) {
+		if (waiter->task->policy == SCHED_LOTTERY &&
+		    waiter->pi_list_entry.prio >= waiter->task->normal_prio)
+			continue;
+		return min(waiter->pi_list_entry.prio, task->normal_prio);
+	}
+
+	return task->normal_prio;
+}
+#endif
+
 /*
  * Calculate task priority from the waiter list priority
  *
@@ -108,10 +131,120 @@ int rt_mutex_getprio(struct task_struct *task)
 	if (likely(!task_has_pi_waiters(task)))
 		return task->normal_prio;
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (task->policy == SCHED_LOTTERY)
+		return rt_mutex_lottery_getprio(task);
+#endif
+
 	return min(task_top_pi_waiter(task)->pi_list_entry.prio,
 		   task->normal_prio);
 }
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+/*
+ * Lottery tickets a blocked task lends to the owner of the lock. A
+ * SCHED_LOTTERY task lends all of its tickets, any other task only
+ * the ones it inherited itself, so that tickets still travel along
+ * a chain which passes through non-lottery tasks.
+ */
+static inline unsigned long long rt_mutex_lend_tickets(struct task_struct *task)
+{
+	if (task->policy == SCHED_LOTTERY)
+		return task->lt.tickets;
+
+	return task->lt.tickets - task->lt.normal_tickets;
+}
+
+/*
+ * Update the tickets @waiter lends to the owner of @lock. Returns
+ * nonzero when the amount changed. lock->wait_lock must be held.
+ */
+static int rt_mutex_lend(struct rt_mutex *lock, struct rt_mutex_waiter *waiter,
+			 struct task_struct *task)
+{
+	unsigned long long tickets = rt_mutex_lend_tickets(task);
+
+	if (waiter->tickets == tickets)
+		return 0;
+
+	lock->waiter_tickets -= waiter->tickets;
+	lock->waiter_tickets += tickets;
+	waiter->tickets = tickets;
+
+	return 1;
+}
+
+/*
+ * Take back the tickets @waiter lent when it leaves the wait list of
+ * @lock. Returns nonzero when there were any. lock->wait_lock must be
+ * held.
+ */
+static int rt_mutex_unlend(struct rt_mutex *lock,
+			   struct rt_mutex_waiter *waiter)
+{
+	unsigned long long tickets = waiter->tickets;
+
+	lock->waiter_tickets -= tickets;
+	waiter->tickets = 0;
+
+	return tickets != 0;
+}
+
+static inline int rt_mutex_lend_stale(struct rt_mutex_waiter *waiter,
+				      struct task_struct *task)
+{
+	return waiter->tickets != rt_mutex_lend_tickets(task);
+}
+
+/*
+ * Calculate the effective lottery tickets of a task: its own tickets
+ * plus the tickets lent by the waiters of every lock it owns.
+ *
+ * The waiter_tickets of those locks are read without their wait_lock.
+ * Whoever changes them readjusts the owner afterwards, so a stale
+ * value is corrected right away. task->pi_lock must be held.
+ */
+unsigned long long rt_mutex_gettickets(struct task_struct *task)
+{
+	struct rt_mutex_waiter *waiter;
+	unsigned long long tickets = task->lt.normal_tickets;
+
+	plist_for_each_entry(waiter, &task->pi_waiters, pi_list_entry)
+		tickets += waiter->lock->waiter_tickets;
+
+	/* Keep a boosted owner within the bound of a single task */
+	return min(tickets, LOTTERY_MAX_TICKETS);
+}
+
+/*
+ * Lend or take back lottery tickets, after the waiters of the locks
+ * the task owns got modified. task->pi_lock must be held.
+ */
+static void __rt_mutex_adjust_tickets(struct task_struct *task)
+{
+	unsigned long long tickets = rt_mutex_gettickets(task);
+
+	if (task->lt.tickets != tickets)
+		rt_mutex_settickets(task, tickets);
+}
+#else
+static inline int rt_mutex_lend(struct rt_mutex *lock,
+				struct rt_mutex_waiter *waiter,
+				struct task_struct *task)
+{
+	return 0;
+}
+
+static inline int rt_mutex_unlend(struct rt_mutex *lock,
+				  struct rt_mutex_waiter *waiter)
+{
+	return 0;
+}
+
+# define rt_mutex_lend_stale(w, t)		0
+# define __rt_mutex_adjust_tickets(t)		do { } while (0)
+#endif
+
 /*
  * Adjust the priority of a task, after its pi_waiters got modified.
  *
@@ -123,6 +256,8 @@ static void __rt_mutex_adjust_prio(struct task_struct *task)
 
 	if (task->prio != prio)
 		rt_mutex_setprio(task, prio);
+
+	__rt_mutex_adjust_tickets(task);
 }
 
 /*
@@ -161,7 +296,7 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 {
 	struct rt_mutex *lock;
 	struct rt_mutex_waiter *waiter, *top_waiter = orig_waiter;
-	int detect_deadlock, ret = 0, depth = 0;
+	int detect_deadlock, ret = 0, depth = 0, lent;
 	unsigned long flags;
 
 	detect_deadlock = debug_rt_mutex_detect_deadlock(orig_waiter,
@@ -225,9 +360,10 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 
 	/*
 	 * When deadlock detection is off then we check, if further
-	 * priority adjustment is necessary.
+	 * priority or ticket adjustment is necessary.
 	 */
-	if (!detect_deadlock && waiter->list_entry.prio == task->prio)
+	if (!detect_deadlock && waiter->list_entry.prio == task->prio &&
+	    !rt_mutex_lend_stale(waiter, task))
 		goto out_unlock_pi;
 
 	lock = waiter->lock;
@@ -251,6 +387,7 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 	plist_del(&waiter->list_entry, &lock->wait_list);
 	waiter->list_entry.prio = task->prio;
 	plist_add(&waiter->list_entry, &lock->wait_list);
+	lent = rt_mutex_lend(lock, waiter, task);
 
 	/* Release the task */
 	spin_unlock_irqrestore(&task->pi_lock, flags);
@@ -275,6 +412,10 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 		waiter->pi_list_entry.prio = waiter->list_entry.prio;
 		plist_add(&waiter->pi_list_entry, &task->pi_waiters);
 		__rt_mutex_adjust_prio(task);
+
+	} else if (lent) {
+		/* Only the tickets of the owner change */
+		__rt_mutex_adjust_prio(task);
 	}
 
 	spin_unlock_irqrestore(&task->pi_lock, flags);
@@ -282,8 +423,15 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 	top_waiter = rt_mutex_top_waiter(lock);
 	spin_unlock(&lock->wait_lock);
 
-	if (!detect_deadlock && waiter != top_waiter)
-		goto out_put_task;
+	if (!detect_deadlock && waiter != top_waiter) {
+		if (!lent)
+			goto out_put_task;
+		/*
+		 * Keep walking to pass the tickets on, but in
+		 * deboosting mode: the owner's top waiter is not ours.
+		 */
+		top_waiter = NULL;
+	}
 
 	goto again;
 
@@ -417,8 +565,9 @@ static int task_blocks_on_rt_mutex(struct rt_mutex *lock,
 {
 	struct task_struct *owner = rt_mutex_owner(lock);
 	struct rt_mutex_waiter *top_waiter = waiter;
+	struct rt_mutex_waiter *orig_waiter = waiter;
 	unsigned long flags;
-	int chain_walk = 0, res;
+	int chain_walk = 0, lent, res;
 
 	spin_lock_irqsave(&task->pi_lock, flags);
 	__rt_mutex_adjust_prio(task);
@@ -426,11 +575,15 @@ static int task_blocks_on_rt_mutex(struct rt_mutex *lock,
 	waiter->lock = lock;
 	plist_node_init(&waiter->list_entry, task->prio);
 	plist_node_init(&waiter->pi_list_entry, task->prio);
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	waiter->tickets = 0;
+#endif
 
 	/* Get the top priority waiter on the lock */
 	if (rt_mutex_has_waiters(lock))
 		top_waiter = rt_mutex_top_waiter(lock);
 	plist_add(&waiter->list_entry, &lock->wait_list);
+	lent = rt_mutex_lend(lock, waiter, task);
 
 	task->pi_blocked_on = waiter;
 
@@ -446,6 +599,20 @@ static int task_blocks_on_rt_mutex(struct rt_mutex *lock,
 			chain_walk = 1;
 		spin_unlock_irqrestore(&owner->pi_lock, flags);
 	}
+	else if (lent) {
+		/*
+		 * Not the top waiter, but the owner still gets our
+		 * tickets. Walk the chain in deboosting mode, as the
+		 * waiter is not on the owner's pi_waiters list.
+		 */
+		spin_lock_irqsave(&owner->pi_lock, flags);
+		__rt_mutex_adjust_prio(owner);
+		if (owner->pi_blocked_on) {
+			chain_walk = 1;
+			orig_waiter = NULL;
+		}
+		spin_unlock_irqrestore(&owner->pi_lock, flags);
+	}
 	else if (debug_rt_mutex_detect_deadlock(waiter, detect_deadlock))
 		chain_walk = 1;
 
@@ -461,8 +628,8 @@ static int task_blocks_on_rt_mutex(struct rt_mutex *lock,
 
 	spin_unlock(&lock->wait_lock);
 
-	res = rt_mutex_adjust_prio_chain(owner, detect_deadlock, lock, waiter,
-					 task);
+	res = rt_mutex_adjust_prio_chain(owner, detect_deadlock, lock,
+					 orig_waiter, task);
 
 	spin_lock(&lock->wait_lock);
 
@@ -487,6 +654,7 @@ static void wakeup_next_waiter(struct rt_mutex *lock)
 
 	waiter = rt_mutex_top_waiter(lock);
 	plist_del(&waiter->list_entry, &lock->wait_list);
+	rt_mutex_unlend(lock, waiter);
 
 	/*
 	 * Remove it from current->pi_waiters. We do not adjust a
@@ -522,6 +690,8 @@ static void wakeup_next_waiter(struct rt_mutex *lock)
 
 		next = rt_mutex_top_waiter(lock);
 		plist_add(&next->pi_list_entry, &pendowner->pi_waiters);
+		/* The remaining waiters fund the pending owner */
+		__rt_mutex_adjust_tickets(pendowner);
 	}
 	spin_unlock_irqrestore(&pendowner->pi_lock, flags);
 
@@ -539,25 +709,29 @@ static void remove_waiter(struct rt_mutex *lock,
 	int first = (waiter == rt_mutex_top_waiter(lock));
 	struct task_struct *owner = rt_mutex_owner(lock);
 	unsigned long flags;
-	int chain_walk = 0;
+	int chain_walk = 0, lent;
 
 	spin_lock_irqsave(&current->pi_lock, flags);
 	plist_del(&waiter->list_entry, &lock->wait_list);
+	lent = rt_mutex_unlend(lock, waiter);
 	waiter->task = NULL;
 	current->pi_blocked_on = NULL;
 	spin_unlock_irqrestore(&current->pi_lock, flags);
 
-	if (first && owner != current) {
+	if ((first || lent) && owner != current) {
 
 		spin_lock_irqsave(&owner->pi_lock, flags);
 
-		plist_del(&waiter->pi_list_entry, &owner->pi_waiters);
+		if (first) {
+			plist_del(&waiter->pi_list_entry, &owner->pi_waiters);
 
-		if (rt_mutex_has_waiters(lock)) {
-			struct rt_mutex_waiter *next;
+			if (rt_mutex_has_waiters(lock)) {
+				struct rt_mutex_waiter *next;
 
-			next = rt_mutex_top_waiter(lock);
-			plist_add(&next->pi_list_entry, &owner->pi_waiters);
+				next = rt_mutex_top_waiter(lock);
+				plist_add(&next->pi_list_entry,
+					  &owner->pi_waiters);
+			}
 		}
 		__rt_mutex_adjust_prio(owner);
 
@@ -595,7 +769,8 @@ void rt_mutex_adjust_pi(struct task_struct *task)
 	spin_lock_irqsave(&task->pi_lock, flags);
 
 	waiter = task->pi_blocked_on;
-	if (!waiter || waiter->list_entry.prio == task->prio) {
+	if (!waiter || (waiter->list_entry.prio == task->prio &&
+			!rt_mutex_lend_stale(waiter, task))) {
 		spin_unlock_irqrestore(&task->pi_lock, flags);
 		return;
 	}
@@ -972,6 +1147,9 @@ void __rt_mutex_init(struct rt_mutex *lock, const char *name)
 	lock->owner = NULL;
 	spin_lock_init(&lock->wait_lock);
 	plist_head_init(&lock->wait_list, &lock->wait_lock);
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	lock->waiter_tickets = 0;
+#endif
 
 	debug_rt_mutex_init(lock, name);
 }
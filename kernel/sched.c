@@ -71,11 +71,13 @@
 #include <linux/debugfs.h>
 #include <linux/ctype.h>
 #include <linux/ftrace.h>
+#include <linux/lotterystats.h>
 
 #include <asm/tlb.h>
 #include <asm/irq_regs.h>
 
 #include "sched_cpupri.h"
+#include "workqueue_sched.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/sched.h>
@@ -231,6 +233,31 @@ static void destroy_rt_bandwidth(struct rt_bandwidth *rt_b)
 }
 #endif
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+/**
+ * @brief Runtime the lottery class may use per period, like rt_bandwidth
+ */
+struct lottery_bandwidth {
+	/* nests inside the rq lock: */
+	spinlock_t		lottery_runtime_lock;
+	ktime_t			lottery_period;
+	u64			lottery_runtime;
+	struct hrtimer		lottery_period_timer;
+};
+
+static struct lottery_bandwidth def_lottery_bandwidth;
+
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+/**
+ * @brief Lottery runtime used by a task group on one cpu
+ */
+struct lottery_group_rq {
+	u64 lottery_time; /*runtime used in the current period */
+	int lottery_throttled; /*tasks of the group are parked */
+};
+#endif
+#endif
+
 /*
  * sched_domains_mutex serializes calls to arch_init_sched_domains,
  * detach_destroy_domains and partition_sched_domains.
@@ -270,6 +297,17 @@ struct task_group {
 	struct rt_bandwidth rt_bandwidth;
 #endif
 
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	/* lottery runtime used by this group on each cpu */
+	struct lottery_group_rq *lottery_rq;
+
+	struct lottery_bandwidth lottery_bandwidth;
+
+	/* tickets held by the group's SCHED_LOTTERY tasks, and their ceiling */
+	atomic64_t lottery_tickets;
+	atomic64_t lottery_tickets_max;
+#endif
+
 	struct rcu_head rcu;
 	struct list_head list;
 
@@ -521,13 +559,60 @@ static struct root_domain def_root_domain;
 #endif
 
 #ifdef CONFIG_SCHED_LOTTERY_POLICY
+/**
+ * @brief Tasks of one ticket class for the bucketed run queue
+ */
+struct lottery_bucket {
+	unsigned int start; /*first slot of the class in lottery_bucket_tasks */
+	unsigned int nr; /*number of tasks in the class */
+	unsigned long long tickets; /*sum of tickets of the class */
+};
+
+#define LOTTERY_NR_BUCKETS	64
+
 /**
  * @brief Structure for run queue of lottery scheduling
  */
 struct lottery_rq {
 	struct list_head lottery_runnable_head; /*head for list based scheduler */
 	struct rb_root lottery_rb_root; /*root for rbtree based scheduler */
+	struct lottery_bucket lottery_buckets[LOTTERY_NR_BUCKETS]; /*ticket classes for bucketed scheduler */
+	unsigned long long lottery_bucket_map; /*bitmap of non-empty buckets */
+	struct sched_lottery_entity **lottery_bucket_tasks; /*tasks of all classes, by class */
+	unsigned int lottery_bucket_nr; /*number of tasks in lottery_bucket_tasks */
+	unsigned int lottery_bucket_size; /*capacity of lottery_bucket_tasks */
+	unsigned long long *lottery_array_tickets; /*tickets for array based scheduler */
+	struct sched_lottery_entity **lottery_array_tasks; /*tasks parallel to lottery_array_tickets */
+	unsigned int lottery_array_nr; /*number of tasks in the arrays */
+	unsigned int lottery_array_size; /*capacity of the arrays */
+	struct sched_lottery_entity **lottery_wait_heap; /*min-heap of tasks on wait_deadline */
+	unsigned int lottery_wait_nr; /*number of tasks in the heap */
+	unsigned int lottery_wait_size; /*capacity of the heap */
 	unsigned long long max_tickets; /*sum of tickets of all tasks in run queue */
+	unsigned long nr_running; /*number of tasks in run queue */
+	unsigned int backend; /*LOTTERY_RQ_BACKEND_* currently holding the tasks */
+	struct delayed_work lottery_grow_work; /*grows the arrays outside the rq lock */
+	unsigned int lottery_grow_nr; /*tasks lottery_grow_work makes room for */
+	unsigned long nr_picks; /*draws won on this run queue */
+	unsigned long nr_enqueues; /*tasks added to this run queue */
+	unsigned long nr_forced; /*picks forced by the wait bound */
+#ifdef CONFIG_SMP
+	unsigned long nr_gang; /*picks given to the gang holding the round */
+	struct task_struct *gang_next; /*thread of the gang to run this round */
+#endif
+	unsigned long pick_hist[LOTTERYSTATS_HIST_BUCKETS]; /*picks by log2 of latency in ns */
+	u64 lottery_time; /*runtime used in the current period */
+	u64 lottery_runtime; /*runtime allowed per period */
+	int lottery_throttled; /*budget spent, the class steps aside */
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	struct list_head lottery_throttled_head; /*tasks of throttled groups */
+#endif
+	u64 lottery_rng; /*generator state, see lottery_seed_state() */
+#ifdef CONFIG_SCHED_DEBUG
+	unsigned long long *lottery_draws; /*recorded or replayed winning tickets */
+	unsigned int lottery_draws_nr; /*number of tickets in lottery_draws */
+	unsigned int lottery_draws_pos; /*next ticket to replay */
+#endif
 };
 #endif
 
@@ -607,6 +692,9 @@ struct rq {
 	struct list_head migration_queue;
 
 	u64 rt_avg;
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	u64 lottery_avg;	/* lottery share of rt_avg, see lottery_cpuload() */
+#endif
 	u64 age_stamp;
 	u64 idle_stamp;
 	u64 avg_idle;
@@ -1296,6 +1384,9 @@ static void sched_avg_update(struct rq *rq)
 		asm("" : "+rm" (rq->age_stamp));
 		rq->age_stamp += period;
 		rq->rt_avg /= 2;
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+		rq->lottery_avg /= 2;
+#endif
 	}
 }
 
@@ -1305,6 +1396,35 @@ static void sched_rt_avg_update(struct rq *rq, u64 rt_delta)
 	sched_avg_update(rq);
 }
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+static void sched_lottery_avg_update(struct rq *rq, u64 delta)
+{
+	rq->lottery_avg += delta;
+	sched_rt_avg_update(rq, delta);
+}
+
+/*
+ * Load the lottery class puts on @rq, scaled by the share of the recent
+ * time it ran: a cpu busy with lottery tasks all the time weighs as much
+ * as one nice 0 task. The class does not balance, so this only makes
+ * CFS place and pull its own tasks away from such a cpu.
+ */
+static unsigned long lottery_cpuload(struct rq *rq)
+{
+	u64 total = sched_avg_period() + (rq->clock - rq->age_stamp);
+
+	if (unlikely((s64)total < SCHED_LOAD_SCALE))
+		total = SCHED_LOAD_SCALE;
+
+	return div64_u64(min(rq->lottery_avg, total) * NICE_0_LOAD, total);
+}
+#else
+static inline unsigned long lottery_cpuload(struct rq *rq)
+{
+	return 0;
+}
+#endif
+
 #else /* !CONFIG_SMP */
 static void resched_task(struct task_struct *p)
 {
@@ -1315,6 +1435,15 @@ static void resched_task(struct task_struct *p)
 static void sched_rt_avg_update(struct rq *rq, u64 rt_delta)
 {
 }
+
+static inline void sched_lottery_avg_update(struct rq *rq, u64 delta)
+{
+}
+
+static inline unsigned long lottery_cpuload(struct rq *rq)
+{
+	return 0;
+}
 #endif /* CONFIG_SMP */
 
 #if BITS_PER_LONG == 32
@@ -1528,7 +1657,9 @@ static int tg_nop(struct task_group *tg, void *data)
 /* Used instead of source_load when we know the type == 0 */
 static unsigned long weighted_cpuload(const int cpu)
 {
-	return cpu_rq(cpu)->load.weight;
+	struct rq *rq = cpu_rq(cpu);
+
+	return rq->load.weight + lottery_cpuload(rq);
 }
 
 /*
@@ -2113,6 +2244,9 @@ void set_task_cpu(struct task_struct *p, unsigned int new_cpu)
 		p->se.nr_migrations++;
 		perf_sw_event(PERF_COUNT_SW_CPU_MIGRATIONS,
 				     1, 1, NULL, 0);
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+		lottery_migrate_wait(p, new_cpu);
+#endif
 	}
 
 	__set_task_cpu(p, new_cpu);
@@ -2515,6 +2649,10 @@ out_activate:
 	activate_task(rq, p, 1);
 	success = 1;
 
+	/* A pool worker counts as running again as soon as it is runnable */
+	if (unlikely(p->flags & PF_WQ_WORKER))
+		wq_worker_waking_up(p);
+
 	/*
 	 * Only attribute actual wakeups done by this task.
 	 */
@@ -2645,7 +2783,14 @@ static void __sched_fork(struct task_struct *p)
  */
 void sched_fork(struct task_struct *p, int clone_flags)
 {
-	int cpu = get_cpu();
+	int cpu;
+
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (p->policy == SCHED_LOTTERY)
+		lottery_fork(p);
+#endif
+
+	cpu = get_cpu();
 
 	__sched_fork(p);
 	/*
@@ -2679,8 +2824,9 @@ void sched_fork(struct task_struct *p, int clone_flags)
 
 	/*
 	 * Make sure we do not leak PI boosting priority to the child.
+	 * normal_prio is the parent's unless the policy was reset above.
 	 */
-	p->prio = current->normal_prio;
+	p->prio = p->normal_prio;
 
 	if (!rt_prio(p->prio))
 		p->sched_class = &fair_sched_class;
@@ -2706,6 +2852,16 @@ void sched_fork(struct task_struct *p, int clone_flags)
 	put_cpu();
 }
 
+/*
+ * Undo sched_fork() for a child which never ran:
+ */
+void sched_fork_cleanup(struct task_struct *p)
+{
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	sched_lottery_exit(p);
+#endif
+}
+
 /*
  * wake_up_new_task - wake up a newly created task for the first time.
  *
@@ -3140,7 +3296,8 @@ static void calc_load_account_active(struct rq *this_rq)
  */
 static void update_cpu_load(struct rq *this_rq)
 {
-	unsigned long this_load = this_rq->load.weight;
+	unsigned long this_load = this_rq->load.weight +
+				  lottery_cpuload(this_rq);
 	int i, scale;
 
 	this_rq->nr_load_updates++;
@@ -5603,6 +5760,14 @@ need_resched_nonpreemptible:
 	if (sched_feat(HRTICK))
 		hrtick_clear(rq);
 
+	/*
+	 * A pool worker about to block may be the last runnable one of its
+	 * pool; let the workqueue code hand pending work to an idle worker.
+	 */
+	if (unlikely(prev->flags & PF_WQ_WORKER) && prev->state &&
+	    !(preempt_count() & PREEMPT_ACTIVE))
+		wq_worker_sleeping(prev);
+
 	spin_lock_irq(&rq->lock);
 	update_rq_clock(rq);
 	clear_tsk_need_resched(prev);
@@ -5615,6 +5780,10 @@ need_resched_nonpreemptible:
 		switch_count = &prev->nvcsw;
 	}
 
+	/* Woken or signalled before it got dequeued, it never slept */
+	if (unlikely(prev->flags & PF_WQ_WORKER) && prev->se.on_rq)
+		wq_worker_waking_up(prev);
+
 	pre_schedule(rq, prev);
 
 	if (unlikely(!rq->nr_running))
@@ -6180,6 +6349,16 @@ void rt_mutex_setprio(struct task_struct *p, int prio)
 	if (running)
 		p->sched_class->put_prev_task(rq, p);
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	/*
+	 * Lottery tasks have an RT prio as well, so test for them first.
+	 * Only a realtime waiter boosts them above their own prio, see
+	 * rt_mutex_getprio(), and takes them to the RT class.
+	 */
+	if (p->policy == SCHED_LOTTERY && prio == p->normal_prio)
+		p->sched_class = &lottery_sched_class;
+	else
+#endif
 	if (rt_prio(prio))
 		p->sched_class = &rt_sched_class;
 	else
@@ -6197,6 +6376,40 @@ void rt_mutex_setprio(struct task_struct *p, int prio)
 	task_rq_unlock(rq, &flags);
 }
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+/*
+ * rt_mutex_settickets - set the effective lottery tickets of a task
+ * @p: task
+ * @tickets: own tickets plus the ones lent by rt_mutex waiters
+ *
+ * This function changes the 'effective' tickets of a task. It does
+ * not touch ->lt.normal_tickets like sched_setscheduler().
+ *
+ * Used by the rt_mutex code to let a lock owner inherit the tickets
+ * of the tasks blocked on it.
+ */
+void rt_mutex_settickets(struct task_struct *p, unsigned long long tickets)
+{
+	unsigned long flags;
+	int on_rq;
+	struct rq *rq;
+
+	rq = task_rq_lock(p, &flags);
+	update_rq_clock(rq);
+
+	/* The lottery run queue caches the tickets of queued tasks */
+	on_rq = p->se.on_rq && p->sched_class == &lottery_sched_class;
+	if (on_rq)
+		dequeue_task(rq, p, 0);
+
+	p->lt.tickets = tickets;
+
+	if (on_rq)
+		enqueue_task(rq, p, 0, false);
+	task_rq_unlock(rq, &flags);
+}
+#endif
+
 #endif
 
 void set_user_nice(struct task_struct *p, long nice)
@@ -6408,6 +6621,10 @@ static int __sched_setscheduler(struct task_struct *p, int policy,
 	const struct sched_class *prev_class;
 	struct rq *rq;
 	int reset_on_fork;
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	struct user_struct *old_user;
+	int unprivileged = 0;
+#endif
 
 	/* may grab non-irq protected spin_locks */
 	BUG_ON(in_interrupt());
@@ -6441,11 +6658,32 @@ recheck:
 		return -EINVAL;
 	if (rt_policy(policy) != (param->sched_priority != 0))
 		return -EINVAL;
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (policy == SCHED_LOTTERY && param->tickets > LOTTERY_MAX_TICKETS)
+		return -EINVAL;
+#endif
 
 	/*
 	 * Allow unprivileged RT tasks to decrease priority:
 	 */
 	if (user && !capable(CAP_SYS_NICE)) {
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+		unprivileged = 1;
+		if (policy == SCHED_LOTTERY) {
+			unsigned long rlim_tickets;
+
+			if (!lock_task_sighand(p, &flags))
+				return -ESRCH;
+			rlim_tickets = p->signal->rlim[RLIMIT_LOTTERY].rlim_cur;
+			unlock_task_sighand(p, &flags);
+
+			/* can't raise tickets above the rlimit */
+			if (param->tickets > rlim_tickets &&
+			    (p->policy != SCHED_LOTTERY ||
+			     param->tickets > p->lt.normal_tickets))
+				return -EPERM;
+		}
+#endif
 		if (rt_policy(policy)) {
 			unsigned long rlim_rtprio;
 
@@ -6478,10 +6716,6 @@ recheck:
 		if (p->sched_reset_on_fork && !reset_on_fork)
 			return -EPERM;
 	}
-#ifdef CONFIG_SCHED_LOTTERY_POLICY
-	if(policy==SCHED_LOTTERY)
-		p->lt.tickets = param->tickets;
-#endif
 	if (user) {
 #ifdef CONFIG_RT_GROUP_SCHED
 		/*
@@ -6515,6 +6749,16 @@ recheck:
 		spin_unlock_irqrestore(&p->pi_lock, flags);
 		goto recheck;
 	}
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	retval = lottery_account_tickets(p,
+			policy == SCHED_LOTTERY ? param->tickets : 0,
+			user, unprivileged, &old_user);
+	if (retval) {
+		__task_rq_unlock(rq);
+		spin_unlock_irqrestore(&p->pi_lock, flags);
+		return retval;
+	}
+#endif
 	update_rq_clock(rq);
 	on_rq = p->se.on_rq;
 	running = task_current(rq, p);
@@ -6528,6 +6772,12 @@ recheck:
 	oldprio = p->prio;
 	prev_class = p->sched_class;
 	__setscheduler(rq, p, policy, param->sched_priority);
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	/* we are holding p->pi_lock already, like __setscheduler() */
+	if (policy == SCHED_LOTTERY)
+		p->lt.normal_tickets = param->tickets;
+	p->lt.tickets = rt_mutex_gettickets(p);
+#endif
 
 	if (running)
 		p->sched_class->set_curr_task(rq);
@@ -6539,6 +6789,11 @@ recheck:
 	__task_rq_unlock(rq);
 	spin_unlock_irqrestore(&p->pi_lock, flags);
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (old_user)
+		free_uid(old_user);
+#endif
+
 	rt_mutex_adjust_pi(p);
 
 	return 0;
@@ -6673,7 +6928,12 @@ SYSCALL_DEFINE2(sched_getparam, pid_t, pid, struct sched_param __user *, param)
 	if (retval)
 		goto out_unlock;
 
+	memset(&lp, 0, sizeof(lp));
 	lp.sched_priority = p->rt_priority;
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (p->policy == SCHED_LOTTERY)
+		lp.tickets = p->lt.normal_tickets;
+#endif
 	rcu_read_unlock();
 
 	/*
@@ -6688,6 +6948,230 @@ out_unlock:
 	return retval;
 }
 
+/*
+ * Copy a sched_lottery_attr from userspace. A structure larger than ours is
+ * fine as long as the part we do not know about is zero.
+ */
+static int sched_copy_attr(struct sched_lottery_attr __user *uattr,
+			   struct sched_lottery_attr *attr)
+{
+	u32 size;
+	int ret;
+
+	memset(attr, 0, sizeof(*attr));
+
+	ret = get_user(size, &uattr->size);
+	if (ret)
+		return ret;
+
+	/* Bail out on silly large: */
+	if (size > PAGE_SIZE)
+		goto err_size;
+
+	/* ABI compatibility quirk: */
+	if (!size)
+		size = SCHED_LOTTERY_ATTR_SIZE_VER0;
+
+	if (size < SCHED_LOTTERY_ATTR_SIZE_VER0)
+		goto err_size;
+
+	if (size > sizeof(*attr)) {
+		unsigned char __user *addr;
+		unsigned char __user *end;
+		unsigned char val;
+
+		addr = (void __user *)uattr + sizeof(*attr);
+		end  = (void __user *)uattr + size;
+
+		for (; addr < end; addr++) {
+			ret = get_user(val, addr);
+			if (ret)
+				return ret;
+			if (val)
+				goto err_size;
+		}
+		size = sizeof(*attr);
+	}
+
+	if (copy_from_user(attr, uattr, size))
+		return -EFAULT;
+
+	return 0;
+
+err_size:
+	put_user(sizeof(*attr), &uattr->size);
+	return -E2BIG;
+}
+
+static int sched_lottery_setattr(struct task_struct *p,
+				 const struct sched_lottery_attr *attr)
+{
+	struct sched_param param = { .sched_priority = attr->sched_priority };
+	int policy = attr->sched_policy;
+	int fair = policy == SCHED_NORMAL || policy == SCHED_BATCH;
+	int retval;
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	unsigned int quantum = 1;
+	unsigned long flags;
+	struct rq *rq;
+#endif
+
+	if (policy < 0 || attr->sched_flags & ~SCHED_LOTTERY_FLAG_RESET_ON_FORK)
+		return -EINVAL;
+
+	if (fair) {
+		if (attr->sched_nice < -20 || attr->sched_nice > 19)
+			return -EINVAL;
+		if (attr->sched_nice < task_nice(p) &&
+		    !can_nice(p, attr->sched_nice))
+			return -EPERM;
+		retval = security_task_setnice(p, attr->sched_nice);
+		if (retval)
+			return retval;
+	}
+
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	param.tickets = attr->sched_tickets;
+	if (policy == SCHED_LOTTERY) {
+		if (attr->sched_quantum > (u64)LOTTERY_MAX_QUANTUM * TICK_NSEC)
+			return -EINVAL;
+		if (attr->sched_quantum)
+			quantum = DIV_ROUND_UP((unsigned long)attr->sched_quantum,
+					       TICK_NSEC);
+		/* A longer quantum is a bigger share, like more tickets */
+		if (quantum > p->lt.quantum && !capable(CAP_SYS_NICE))
+			return -EPERM;
+	}
+#endif
+
+	if (attr->sched_flags & SCHED_LOTTERY_FLAG_RESET_ON_FORK)
+		policy |= SCHED_RESET_ON_FORK;
+
+	retval = sched_setscheduler(p, policy, &param);
+	if (retval)
+		return retval;
+
+	if (fair)
+		set_user_nice(p, attr->sched_nice);
+
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (attr->sched_policy == SCHED_LOTTERY) {
+		rq = task_rq_lock(p, &flags);
+		p->lt.quantum = quantum;
+		if (p->lt.time_slice > quantum)
+			p->lt.time_slice = quantum;
+		task_rq_unlock(rq, &flags);
+	}
+#endif
+
+	return 0;
+}
+
+/**
+ * sys_sched_lottery_setattr - same as above, but with sched_lottery_attr
+ * @pid: the pid in question.
+ * @uattr: structure containing the extended parameters.
+ * @flags: for future extension.
+ */
+SYSCALL_DEFINE3(sched_lottery_setattr, pid_t, pid,
+		struct sched_lottery_attr __user *, uattr, unsigned int, flags)
+{
+	struct sched_lottery_attr attr;
+	struct task_struct *p;
+	int retval;
+
+	if (!uattr || pid < 0 || flags)
+		return -EINVAL;
+
+	retval = sched_copy_attr(uattr, &attr);
+	if (retval)
+		return retval;
+
+	rcu_read_lock();
+	retval = -ESRCH;
+	p = find_process_by_pid(pid);
+	if (p != NULL)
+		get_task_struct(p);
+	rcu_read_unlock();
+
+	if (p) {
+		retval = sched_lottery_setattr(p, &attr);
+		put_task_struct(p);
+	}
+
+	return retval;
+}
+
+/*
+ * Copy the kernel size attribute structure to userspace, truncated to
+ * the size the caller knows about.
+ */
+static int sched_read_attr(struct sched_lottery_attr __user *uattr,
+			   struct sched_lottery_attr *attr,
+			   unsigned int usize)
+{
+	attr->size = min_t(unsigned int, usize, sizeof(*attr));
+
+	if (copy_to_user(uattr, attr, attr->size))
+		return -EFAULT;
+
+	return 0;
+}
+
+/**
+ * sys_sched_lottery_getattr - like sched_getparam, but with sched_lottery_attr
+ * @pid: the pid in question.
+ * @uattr: structure containing the extended parameters.
+ * @size: sizeof(attr) for fwd/bwd comp.
+ * @flags: for future extension.
+ */
+SYSCALL_DEFINE4(sched_lottery_getattr, pid_t, pid,
+		struct sched_lottery_attr __user *, uattr,
+		unsigned int, size, unsigned int, flags)
+{
+	struct sched_lottery_attr attr;
+	struct task_struct *p;
+	int retval;
+
+	if (!uattr || pid < 0 || size > PAGE_SIZE ||
+	    size < SCHED_LOTTERY_ATTR_SIZE_VER0 || flags)
+		return -EINVAL;
+
+	rcu_read_lock();
+	p = find_process_by_pid(pid);
+	retval = -ESRCH;
+	if (!p)
+		goto out_unlock;
+
+	retval = security_task_getscheduler(p);
+	if (retval)
+		goto out_unlock;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.sched_policy = p->policy;
+	if (p->sched_reset_on_fork)
+		attr.sched_flags |= SCHED_LOTTERY_FLAG_RESET_ON_FORK;
+	if (task_has_rt_policy(p))
+		attr.sched_priority = p->rt_priority;
+	else
+		attr.sched_nice = task_nice(p);
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (p->policy == SCHED_LOTTERY) {
+		attr.sched_tickets = p->lt.normal_tickets;
+		attr.sched_quantum = (u64)p->lt.quantum * TICK_NSEC;
+	}
+	/* Tasks of any policy may run on tickets lent through an rt_mutex */
+	attr.sched_tickets_effective = p->lt.tickets;
+#endif
+	rcu_read_unlock();
+
+	return sched_read_attr(uattr, &attr, size);
+
+out_unlock:
+	rcu_read_unlock();
+	return retval;
+}
+
 long sched_setaffinity(pid_t pid, const struct cpumask *in_mask)
 {
 	cpumask_var_t cpus_allowed, new_mask;
@@ -9627,6 +10111,16 @@ void __init sched_init(void)
 #endif /* CONFIG_USER_SCHED */
 #endif /* CONFIG_RT_GROUP_SCHED */
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	init_lottery_bandwidth(&def_lottery_bandwidth,
+			global_lottery_period(), global_lottery_runtime());
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	init_task_group.lottery_rq = init_lottery_group_rq;
+	init_lottery_bandwidth(&init_task_group.lottery_bandwidth,
+			global_lottery_period(), RUNTIME_INF);
+#endif
+#endif
+
 #ifdef CONFIG_GROUP_SCHED
 	list_add(&init_task_group.list, &task_groups);
 	INIT_LIST_HEAD(&init_task_group.children);
@@ -9652,14 +10146,13 @@ void __init sched_init(void)
 		rq->calc_load_update = jiffies + LOAD_FREQ;
 		init_cfs_rq(&rq->cfs, rq);
 		init_rt_rq(&rq->rt, rq);
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+		init_lottery_rq(&rq->lottery_rq, i);
+#endif
 #ifdef CONFIG_FAIR_GROUP_SCHED
 		init_task_group.shares = init_task_group_load;
 		INIT_LIST_HEAD(&rq->leaf_cfs_rq_list);
 #ifdef CONFIG_CGROUP_SCHED
-
-#ifdef CONFIG_SCHED_LOTTERY_POLICY
-		init_lottery_rq(&rq->lottery_rq);
-#endif
 		/*
 		 * How much cpu bandwidth does init_task_group get?
 		 *
@@ -9788,6 +10281,7 @@ void __init sched_init(void)
 
 #ifdef CONFIG_SCHED_LOTTERY_POLICY
 	init_lottery_event_log();
+	init_lottery_gang();
 #endif
 
 	scheduler_running = 1;
@@ -10108,11 +10602,47 @@ static inline void unregister_rt_sched_group(struct task_group *tg, int cpu)
 }
 #endif /* CONFIG_RT_GROUP_SCHED */
 
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+static void free_lottery_sched_group(struct task_group *tg)
+{
+	/* the bandwidth timer is only set up once lottery_rq exists */
+	if (tg->lottery_rq)
+		destroy_lottery_bandwidth(&tg->lottery_bandwidth);
+	kfree(tg->lottery_rq);
+}
+
+static
+int alloc_lottery_sched_group(struct task_group *tg, struct task_group *parent)
+{
+	tg->lottery_rq = kzalloc(sizeof(struct lottery_group_rq) * nr_cpu_ids,
+				 GFP_KERNEL);
+	if (!tg->lottery_rq)
+		return 0;
+
+	init_lottery_bandwidth(&tg->lottery_bandwidth,
+			ktime_to_ns(def_lottery_bandwidth.lottery_period),
+			RUNTIME_INF);
+
+	return 1;
+}
+#else /* !CONFIG_LOTTERY_GROUP_SCHED */
+static inline void free_lottery_sched_group(struct task_group *tg)
+{
+}
+
+static inline
+int alloc_lottery_sched_group(struct task_group *tg, struct task_group *parent)
+{
+	return 1;
+}
+#endif /* CONFIG_LOTTERY_GROUP_SCHED */
+
 #ifdef CONFIG_GROUP_SCHED
 static void free_sched_group(struct task_group *tg)
 {
 	free_fair_sched_group(tg);
 	free_rt_sched_group(tg);
+	free_lottery_sched_group(tg);
 	kfree(tg);
 }
 
@@ -10133,6 +10663,9 @@ struct task_group *sched_create_group(struct task_group *parent)
 	if (!alloc_rt_sched_group(tg, parent))
 		goto err;
 
+	if (!alloc_lottery_sched_group(tg, parent))
+		goto err;
+
 	spin_lock_irqsave(&task_group_lock, flags);
 	for_each_possible_cpu(i) {
 		register_fair_sched_group(tg, i);
@@ -10204,6 +10737,9 @@ void sched_move_task(struct task_struct *tsk)
 		tsk->sched_class->put_prev_task(rq, tsk);
 
 	set_task_rq(tsk, task_cpu(tsk));
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	lottery_move_tickets(tsk);
+#endif
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	if (tsk->sched_class->moved_group)
@@ -10627,6 +11163,10 @@ cpu_cgroup_destroy(struct cgroup_subsys *ss, struct cgroup *cgrp)
 static int
 cpu_cgroup_can_attach_task(struct cgroup *cgrp, struct task_struct *tsk)
 {
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	if (!sched_lottery_can_attach(cgroup_tg(cgrp), tsk))
+		return -EPERM;
+#endif
 #ifdef CONFIG_RT_GROUP_SCHED
 	if (!sched_rt_can_attach(cgroup_tg(cgrp), tsk))
 		return -EINVAL;
@@ -10715,6 +11255,48 @@ static u64 cpu_rt_period_read_uint(struct cgroup *cgrp, struct cftype *cft)
 }
 #endif /* CONFIG_RT_GROUP_SCHED */
 
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+static int cpu_lottery_runtime_write(struct cgroup *cgrp, struct cftype *cft,
+				     s64 val)
+{
+	return sched_group_set_lottery_runtime(cgroup_tg(cgrp), val);
+}
+
+static s64 cpu_lottery_runtime_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return sched_group_lottery_runtime(cgroup_tg(cgrp));
+}
+
+static int cpu_lottery_period_write_uint(struct cgroup *cgrp,
+					 struct cftype *cftype, u64 period_us)
+{
+	return sched_group_set_lottery_period(cgroup_tg(cgrp), period_us);
+}
+
+static u64 cpu_lottery_period_read_uint(struct cgroup *cgrp, struct cftype *cft)
+{
+	return sched_group_lottery_period(cgroup_tg(cgrp));
+}
+
+static int cpu_lottery_tickets_max_write(struct cgroup *cgrp,
+					 struct cftype *cftype, u64 tickets)
+{
+	/* read under rq locks which can't be taken here, hence the atomic */
+	atomic64_set(&cgroup_tg(cgrp)->lottery_tickets_max, tickets);
+	return 0;
+}
+
+static u64 cpu_lottery_tickets_max_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return atomic64_read(&cgroup_tg(cgrp)->lottery_tickets_max);
+}
+
+static u64 cpu_lottery_tickets_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return atomic64_read(&cgroup_tg(cgrp)->lottery_tickets);
+}
+#endif /* CONFIG_LOTTERY_GROUP_SCHED */
+
 static struct cftype cpu_files[] = {
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	{
@@ -10735,6 +11317,27 @@ static struct cftype cpu_files[] = {
 		.write_u64 = cpu_rt_period_write_uint,
 	},
 #endif
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	{
+		.name = "lottery_runtime_us",
+		.read_s64 = cpu_lottery_runtime_read,
+		.write_s64 = cpu_lottery_runtime_write,
+	},
+	{
+		.name = "lottery_period_us",
+		.read_u64 = cpu_lottery_period_read_uint,
+		.write_u64 = cpu_lottery_period_write_uint,
+	},
+	{
+		.name = "lottery_tickets_max",
+		.read_u64 = cpu_lottery_tickets_max_read,
+		.write_u64 = cpu_lottery_tickets_max_write,
+	},
+	{
+		.name = "lottery_tickets",
+		.read_u64 = cpu_lottery_tickets_read,
+	},
+#endif
 };
 
 static int cpu_cgroup_populate(struct cgroup_subsys *ss, struct cgroup *cont)
@@ -246,6 +246,87 @@ void print_rt_rq(struct seq_file *m, int cpu, struct rt_rq *rt_rq)
 #undef P
 }
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+static int lottery_rb_height(struct rb_node *node)
+{
+	int l, r;
+
+	if (!node)
+		return 0;
+
+	l = lottery_rb_height(node->rb_left);
+	r = lottery_rb_height(node->rb_right);
+
+	return 1 + max(l, r);
+}
+
+void print_lottery_rq(struct seq_file *m, int cpu, struct lottery_rq *lt_rq)
+{
+	struct rq *rq = cpu_rq(cpu);
+	struct task_struct *g, *p;
+	unsigned long flags;
+	int left = 0, right = 0;
+
+	SEQ_printf(m, "\nlottery_rq[%d]:\n", cpu);
+
+#define P(x) \
+	SEQ_printf(m, "  .%-30s: %Ld\n", #x, (long long)(lt_rq->x))
+#define PN(x) \
+	SEQ_printf(m, "  .%-30s: %Ld.%06ld\n", #x, SPLIT_NS(lt_rq->x))
+
+	P(nr_running);
+	P(max_tickets);
+	SEQ_printf(m, "  .%-30s: %s\n", "backend",
+		   lottery_rq_backend_name[lt_rq->backend]);
+	if (lt_rq->backend == LOTTERY_RQ_BACKEND_RBTREE) {
+		spin_lock_irqsave(&rq->lock, flags);
+		if (lt_rq->lottery_rb_root.rb_node) {
+			left = lottery_rb_height(
+				lt_rq->lottery_rb_root.rb_node->rb_left);
+			right = lottery_rb_height(
+				lt_rq->lottery_rb_root.rb_node->rb_right);
+		}
+		spin_unlock_irqrestore(&rq->lock, flags);
+
+		SEQ_printf(m, "  .%-30s: %d\n", "rb_depth",
+			   lt_rq->lottery_rb_root.rb_node ?
+			   1 + max(left, right) : 0);
+		SEQ_printf(m, "  .%-30s: %d\n", "rb_imbalance",
+			   left > right ? left - right : right - left);
+	}
+	P(nr_picks);
+	P(nr_enqueues);
+	P(nr_forced);
+#ifdef CONFIG_SMP
+	P(nr_gang);
+#endif
+	P(lottery_throttled);
+	PN(lottery_time);
+	PN(lottery_runtime);
+
+#undef PN
+#undef P
+
+	SEQ_printf(m, "\n  %15s %5s %21s %21s\n",
+		   "task", "PID", "tickets", "normal_tickets");
+
+	read_lock_irqsave(&tasklist_lock, flags);
+
+	do_each_thread(g, p) {
+		if (!p->se.on_rq || task_cpu(p) != cpu ||
+		    p->sched_class != &lottery_sched_class)
+			continue;
+
+		SEQ_printf(m, "%c %15s %5d %21Lu %21Lu\n",
+			   task_current(rq, p) ? 'R' : ' ',
+			   p->comm, p->pid, p->lt.tickets,
+			   p->lt.normal_tickets);
+	} while_each_thread(g, p);
+
+	read_unlock_irqrestore(&tasklist_lock, flags);
+}
+#endif
+
 static void print_cpu(struct seq_file *m, int cpu)
 {
 	struct rq *rq = cpu_rq(cpu);
@@ -305,6 +386,9 @@ static void print_cpu(struct seq_file *m, int cpu)
 #endif
 	print_cfs_stats(m, cpu);
 	print_rt_stats(m, cpu);
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	print_lottery_stats(m, cpu);
+#endif
 
 	print_rq(m, rq, cpu);
 }
@@ -463,6 +547,16 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.load.weight);
 	P(policy);
 	P(prio);
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	if (p->policy == SCHED_LOTTERY) {
+		P(lt.tickets);
+		P(lt.normal_tickets);
+		P(lt.charged_tickets);
+		P(lt.quantum);
+		PN(lt.wait_start);
+		PN(lt.wait_deadline);
+	}
+#endif
 #undef PN
 #undef __PN
 #undef P
@@ -18,45 +18,91 @@
 
 #include <linux/random.h>
 #include <linux/rbtree_augmented.h>
+#include <linux/relay.h>
 #include <linux/proc_lottery.h>
 
 /**
- * @brief 1 enables list based rq; 0 enables rb tree based rq
+ * @brief Run queue backend, set with lottery_rq= at boot or through
+ * kernel.sched_lottery_rq_backend at runtime
  */
-#define LOTTERY_RQ_LIST 1
+unsigned int sysctl_sched_lottery_rq_backend = LOTTERY_RQ_BACKEND_LIST;
 
 /**
- * @brief event buffer
+ * @brief Names of the run queue backends, for lottery_rq= and sched_debug
  */
-static struct lottery_event_log lottery_event_log;
+static const char * const lottery_rq_backend_name[LOTTERY_NR_RQ_BACKENDS] = {
+	[LOTTERY_RQ_BACKEND_LIST]	= "list",
+	[LOTTERY_RQ_BACKEND_RBTREE]	= "rbtree",
+	[LOTTERY_RQ_BACKEND_ADAPTIVE]	= "adaptive",
+	[LOTTERY_RQ_BACKEND_BUCKET]	= "bucket",
+	[LOTTERY_RQ_BACKEND_ARRAY]	= "array",
+};
 
 /**
- * @brief Structure to hold statistics informations
+ * @brief Adaptive mode switches a run queue to the rbtree above this many
+ * tasks and back to the list below half of it
  */
-static struct lottery_stats stats;
+unsigned int sysctl_sched_lottery_adaptive_nr = 32;
 
-/*Static declarations*/
-void lottery_log(enum lottery_action action, char* format, ...);
+/**
+ * @brief Operations implemented by each run queue backend
+ */
+struct lottery_rq_ops {
+	int (*insert)(struct lottery_rq *rq, struct sched_lottery_entity *p);
+	void (*remove)(struct lottery_rq *rq, struct sched_lottery_entity *p);
+	struct sched_lottery_entity *(*first)(struct lottery_rq *rq);
+	struct sched_lottery_entity *(*lookup)(struct lottery_rq *rq,
+					       unsigned long long lottery);
+	void (*release)(struct lottery_rq *rq);
+};
 
 /**
- * @brief Updates the start time and total run time
- *
- * @param rq Pointer to the run queue
+ * @brief Events of all cpus, sliced into the per cpu rings at boot
  */
-static void update_curr_lottery(struct rq* rq)
-{
-	struct task_struct *curr = rq->curr;
-	u64 delta_exec;
+static struct lottery_event lottery_events[LOTTERY_MAX_EVENT_LINES];
 
-	delta_exec = rq->clock - curr->se.exec_start;
-	if (unlikely((s64)delta_exec < 0))
-		delta_exec = 0;
+/**
+ * @brief Per cpu ring of events, written only by its own cpu
+ */
+static DEFINE_PER_CPU(struct lottery_event_log, lottery_event_log);
 
-	curr->se.sum_exec_runtime += delta_exec;
+/**
+ * @brief Sequence number of the next event
+ */
+static atomic64_t lottery_event_seq = ATOMIC64_INIT(0);
 
-	curr->se.exec_start = rq->clock;
-}
+/**
+ * @brief Names of the actions, as printed in the log
+ */
+const char * const lottery_action_name[] = {
+	[LOTTERY_ENQUEUE]		= "ENQUEUE",
+	[LOTTERY_DEQUEUE]		= "DEQUEUE",
+	[LOTTERY_CONTEXT_SWITCH]	= "CONTEXT_SWITCH",
+	[LOTTERY_PICK_TIME]		= "PICK_NEXT",
+	[LOTTERY_PREEMPT]		= "PREEMPT",
+	[LOTTERY_TICK]			= "TICK",
+	[LOTTERY_MSG]			= "LOG",
+};
+
+/**
+ * @brief Relay channel streaming the events, NULL while not streaming.
+ * Writers run under rcu_read_lock_sched().
+ */
+static struct rchan *lottery_relay_chan;
+
+/**
+ * @brief Per cpu line formatted for the relay channel
+ */
+static DEFINE_PER_CPU(char [LOTTERY_MSG_SIZE + 64], lottery_relay_line);
+
+/**
+ * @brief Structure to hold statistics informations
+ */
+static struct lottery_stats stats;
 
+/*Static declarations*/
+void lottery_log(enum lottery_action action, char* format, ...);
+static const struct sched_class lottery_sched_class;
 
 /**
  * @brief Registers the event to the event log
@@ -70,35 +116,348 @@ static void register_lottery_event(unsigned long long t,
 				   enum lottery_action  a,
 				   char *format, va_list a_list)
 {
-	lottery_event_log.lottery_event[lottery_event_log.tail].action=a;
-	lottery_event_log.lottery_event[lottery_event_log.tail].timestamp=t;
+	struct lottery_event_log *log;
+	struct lottery_event *event;
+	struct rchan *chan;
+	unsigned long flags;
+	char *line;
+	int len;
+
+	local_irq_save(flags);
+	log = &__get_cpu_var(lottery_event_log);
+	/* Not sliced yet */
+	if (!log->lines) {
+		local_irq_restore(flags);
+		return;
+	}
+
+	/*
+	 * Only readers contend on the lock. The sequence number is taken
+	 * under it, so a reader which takes the lock after reading the
+	 * counter finds every event numbered below it.
+	 */
+	spin_lock(&log->lock);
+	event = &log->lottery_event[log->tail];
+	event->action=a;
+	event->timestamp=t;
+	event->seq = atomic64_inc_return(&lottery_event_seq) - 1;
+
+	vsnprintf(event->msg, LOTTERY_MSG_SIZE-1, format, a_list);
+
+	log->tail = (log->tail + 1) % log->lines;
+	if(log->size == log->lines)
+		log->head = (log->head + 1) % log->lines;
+	else
+		log->size++;
+
+	/* Stream the same line as the log file, while the slot is ours */
+	rcu_read_lock_sched();
+	chan = rcu_dereference(lottery_relay_chan);
+	if (chan) {
+		line = __get_cpu_var(lottery_relay_line);
+		len = snprintf(line, LOTTERY_MSG_SIZE + 64,
+			       "[%llu] <%s>  {%s}\n", event->timestamp,
+			       lottery_action_name[event->action], event->msg);
+		__relay_write(chan, line,
+			      min(len, LOTTERY_MSG_SIZE + 64 - 1));
+	}
+	rcu_read_unlock_sched();
+	spin_unlock_irqrestore(&log->lock, flags);
+}
 
-	vsnprintf(lottery_event_log.lottery_event[lottery_event_log.tail].msg,
-		  LOTTERY_MSG_SIZE-1, format, a_list);
+/**
+ * @brief Finds the oldest event of a cpu numbered in [seq, last)
+ *
+ * @param log Ring of the cpu, locked by the caller
+ * @param seq Lowest sequence number wanted
+ * @param last Sequence number not to reach
+ *
+ * @return The event, NULL if the ring holds none in the range
+ */
+static struct lottery_event *lottery_find_event(struct lottery_event_log *log,
+						unsigned long long seq,
+						unsigned long long last)
+{
+	struct lottery_event *event;
+	unsigned int lo = 0, hi = log->size, mid;
+
+	/* The ring is sorted by sequence number, from head on */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		event = &log->lottery_event[(log->head + mid) % log->lines];
+		if (event->seq < seq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == log->size)
+		return NULL;
 
-	lottery_event_log.tail = (lottery_event_log.tail + 1) %
-		LOTTERY_MAX_EVENT_LINES;
+	event = &log->lottery_event[(log->head + lo) % log->lines];
+	return event->seq < last ? event : NULL;
+}
 
-	if(lottery_event_log.size == LOTTERY_MAX_EVENT_LINES) {
-		if (lottery_event_log.cursor == lottery_event_log.head) {
-			lottery_event_log.cursor =
-				(lottery_event_log.cursor + 1) %
-				LOTTERY_MAX_EVENT_LINES;
-			lottery_event_log.flag = 0;
+/**
+ * @brief Copies an event out of the event log
+ *
+ * @param seq Sequence number of the event, moved up to the oldest event
+ * still logged if it was overwritten
+ * @param event Where the event is copied
+ *
+ * @return 0 on success, -ENOENT if the event was not logged yet
+ */
+int lottery_read_event(unsigned long long *seq, struct lottery_event *event)
+{
+	struct lottery_event_log *log;
+	struct lottery_event *found;
+	unsigned long long last;
+	unsigned long flags;
+	int cpu, ret = -ENOENT;
+
+	/*
+	 * Events numbered from last on may still be written, leave them
+	 * to the next call so none is skipped.
+	 */
+	last = atomic64_read(&lottery_event_seq);
+	for_each_possible_cpu(cpu) {
+		log = &per_cpu(lottery_event_log, cpu);
+		if (!log->lines)
+			continue;
+
+		spin_lock_irqsave(&log->lock, flags);
+		found = lottery_find_event(log, *seq, last);
+		if (found) {
+			*event = *found;
+			last = found->seq;
+			ret = 0;
 		}
+		spin_unlock_irqrestore(&log->lock, flags);
+	}
 
-		lottery_event_log.head =
-			(lottery_event_log.head + 1) % LOTTERY_MAX_EVENT_LINES;
-	} else {
-		lottery_event_log.size++;
+	if (!ret)
+		*seq = event->seq;
+	return ret;
+}
+
+/**
+ * @brief Drops the logged events, readers continue with the next one
+ */
+void lottery_clear_event_log(void)
+{
+	struct lottery_event_log *log;
+	unsigned long flags;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		log = &per_cpu(lottery_event_log, cpu);
+		spin_lock_irqsave(&log->lock, flags);
+		log->head = log->tail = log->size = 0;
+		spin_unlock_irqrestore(&log->lock, flags);
+	}
+}
+
+
+/**
+ * Seeded draws
+ */
+
+/**
+ * @brief Seed for the lottery generators, set with lottery_seed= at boot or
+ * through debugfs. 0 seeds each generator from the entropy pool instead.
+ */
+static u64 lottery_seed;
+
+/**
+ * @brief Derives the generator state of a cpu from the seed. Without a seed
+ * the state comes from the entropy pool, whose global lock is thus taken once
+ * per (re)seed instead of once per draw. Must not be called under an rq lock.
+ *
+ * @param seed Seed shared by all cpus, 0 for none
+ * @param cpu Cpu the state is for
+ *
+ * @return Non zero generator state
+ */
+static u64 lottery_seed_state(u64 seed, int cpu)
+{
+	u64 state;
+
+	if (seed)
+		state = seed ^ ((u64)(cpu + 1) * 0x9e3779b97f4a7c15ULL);
+	else
+		get_random_bytes(&state, sizeof(state));
+
+	return state ? state : 1;
+}
+
+static int __init setup_lottery_seed(char *str)
+{
+	lottery_seed = simple_strtoull(str, NULL, 0);
+	return 1;
+}
+__setup("lottery_seed=", setup_lottery_seed);
+
+/**
+ * @brief Returns 64 random bits from a generator. It is xorshift64*, so the
+ * same seed gives the same sequence.
+ *
+ * @param state Non zero generator state
+ *
+ * @return Random value
+ */
+static u64 lottery_next_random(u64 *state)
+{
+	u64 x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * 2685821657736338717ULL;
+}
+
+/**
+ * @brief Returns 64 random bits for a draw on this run queue
+ *
+ * @param rq Pointer to the run queue
+ *
+ * @return Random value
+ */
+static inline u64 lottery_random(struct lottery_rq *rq)
+{
+	return lottery_next_random(&rq->lottery_rng);
+}
+
+#ifdef CONFIG_SCHED_DEBUG
+/**
+ * @brief Draw modes, switched through debugfs
+ */
+enum {
+	LOTTERY_DRAW_LIVE,
+	LOTTERY_DRAW_RECORD,
+	LOTTERY_DRAW_REPLAY,
+};
+
+/**
+ * @brief Winning tickets kept per cpu for record and replay
+ */
+#define LOTTERY_MAX_DRAWS	65536
+
+static unsigned int lottery_draw_mode = LOTTERY_DRAW_LIVE;
+
+/**
+ * @brief Returns the winning ticket, recording or replaying it as asked
+ *
+ * @param rq Pointer to the run queue
+ *
+ * @return Ticket from 0 to max_tickets - 1
+ */
+static unsigned long long lottery_draw(struct lottery_rq *rq)
+{
+	unsigned long long lottery;
+
+	if (lottery_draw_mode == LOTTERY_DRAW_REPLAY &&
+	    rq->lottery_draws_pos < rq->lottery_draws_nr) {
+		lottery = rq->lottery_draws[rq->lottery_draws_pos++];
+		/* A diverging workload may ask for fewer tickets */
+		return lottery % rq->max_tickets;
 	}
+
+	lottery = lottery_random(rq) % rq->max_tickets;
+
+	if (lottery_draw_mode == LOTTERY_DRAW_RECORD && rq->lottery_draws &&
+	    rq->lottery_draws_nr < LOTTERY_MAX_DRAWS)
+		rq->lottery_draws[rq->lottery_draws_nr++] = lottery;
+
+	return lottery;
+}
+#else
+static inline unsigned long long lottery_draw(struct lottery_rq *rq)
+{
+	return lottery_random(rq) % rq->max_tickets;
 }
+#endif /* CONFIG_SCHED_DEBUG */
 
 
+/**
+ * Functions for list based run queue
+ */
+
+/**
+ * @brief Inserts a node to list run queue
+ *
+ * @param rq Pointer to the run queue
+ * @param p Pointer to Lottery entity in task struct
+ *
+ * @return Always 0
+ */
+static int insert_lottery_task_list(struct lottery_rq *rq,
+				    struct sched_lottery_entity *p)
+{
+	list_add(&p->lottery_runnable_node, &rq->lottery_runnable_head);
+	return 0;
+}
+
+/**
+ * @brief Remove a node from list run queue
+ *
+ * @param rq Pointer to the run queue
+ * @param p Pointer to Lottery entity in task struct
+ */
+static void remove_lottery_task_list(struct lottery_rq *rq,
+				     struct sched_lottery_entity *p)
+{
+	list_del(&p->lottery_runnable_node);
+}
+
+/**
+ * @brief Returns any node of the list run queue
+ *
+ * @param rq Pointer to the run queue
+ *
+ * @return First entity in the list or NULL if empty
+ */
+static struct sched_lottery_entity *
+first_lottery_task_list(struct lottery_rq *rq)
+{
+	if (list_empty(&rq->lottery_runnable_head))
+		return NULL;
+
+	return list_first_entry(&rq->lottery_runnable_head,
+				struct sched_lottery_entity,
+				lottery_runnable_node);
+}
+
+/**
+ * @brief Finds the winner of the lottery in list run queue
+ *
+ * @param rq Pointer to the run queue
+ * @param lottery Winning ticket from 0 to max_tickets - 1
+ *
+ * @return Pointer to the entity holding the winning ticket
+ */
+static struct sched_lottery_entity *
+lookup_lottery_task_list(struct lottery_rq *rq, unsigned long long lottery)
+{
+	struct sched_lottery_entity *lottery_task;
+	unsigned long long iterator = 0;
+
+	/* Iterate across the list and get cumulative sum for each node.
+	 * The winner will have cumulative sum greater than lottery_ticket.
+	 */
+	list_for_each_entry(lottery_task, &rq->lottery_runnable_head,
+			    lottery_runnable_node) {
+		iterator += lottery_task->tickets;
+
+		if (iterator > lottery)
+			return lottery_task;
+	}
+	return NULL;
+}
+
 /**
  * Functions for RbTree based run queue
  */
-#if LOTTERY_RQ_LIST == 0
 
 /**
  * @brief Computes the total tickets in left subtree
@@ -223,39 +582,1949 @@ static void remove_lottery_task_rb_tree(struct lottery_rq *rq,
  *
  * @param rq Pointer to the run queue
  * @param p Pointer to Lottery entity in task struct
+ *
+ * @return Always 0
  */
-static void insert_lottery_task_rb_tree(struct lottery_rq *rq,
-					struct sched_lottery_entity *p)
+static int insert_lottery_task_rb_tree(struct lottery_rq *rq,
+				       struct sched_lottery_entity *p)
 {
 	struct rb_node **link = &rq->lottery_rb_root.rb_node;
 	struct rb_node *parent = NULL;
 	struct sched_lottery_entity *myparent;
 
-	/* Required for enqueue followed by dequeue */
-	p->left_tickets = 0;
-	p->right_tickets = 0;
+	/* Required for enqueue followed by dequeue */
+	p->left_tickets = 0;
+	p->right_tickets = 0;
+
+	/* We dont care about equal key nodes as rotation of tree will take care
+	 * of it and removal is always directly with pointer
+	 */
+	while (*link) {
+		parent=*link;
+		myparent = rb_entry(parent, struct sched_lottery_entity,
+				    lottery_rb_node);
+		if (myparent->tickets >= p->tickets) {
+			myparent->left_tickets += p->tickets;
+			link = &(*link)->rb_left;
+		}
+		else {
+			myparent->right_tickets += p->tickets;
+			link = &(*link)->rb_right;
+		}
+	}
+	rb_link_node(&p->lottery_rb_node, parent, link);
+	rb_insert_augmented(&p->lottery_rb_node,
+			    &rq->lottery_rb_root, &augment_callbacks);
+	return 0;
+}
+
+/**
+ * @brief Returns any node of the rbtree run queue
+ *
+ * @param rq Pointer to the run queue
+ *
+ * @return Leftmost entity in the tree or NULL if empty
+ */
+static struct sched_lottery_entity *
+first_lottery_task_rb_tree(struct lottery_rq *rq)
+{
+	struct rb_node *node = rb_first(&rq->lottery_rb_root);
+
+	if (!node)
+		return NULL;
+
+	return rb_entry(node, struct sched_lottery_entity, lottery_rb_node);
+}
+
+/**
+ * @brief Finds the winner of the lottery in rbtree run queue
+ *
+ * @param rq Pointer to the run queue
+ * @param lottery Winning ticket from 0 to max_tickets - 1
+ *
+ * @return Pointer to the entity holding the winning ticket
+ */
+static struct sched_lottery_entity *
+lookup_lottery_task_rb_tree(struct lottery_rq *rq, unsigned long long lottery)
+{
+	struct sched_lottery_entity *lottery_task;
+	struct rb_node *node = rq->lottery_rb_root.rb_node;
+
+	/* If lottery_ticket is less than left_tickets then iterate in left
+	 * direction.
+	 * If lottery_ticket is less than left + curr_tickets then curr is
+	 * winner.
+	 * Otherwise iterate in right direction for lottery_ticket -
+	 * (left_tickets + curr_tickets).
+	 */
+	while (node) {
+		lottery_task = rb_entry(node, struct sched_lottery_entity,
+					lottery_rb_node);
+		if (lottery < lottery_task->left_tickets)
+			node = node->rb_left;
+		else if (lottery < (lottery_task->left_tickets +
+				    lottery_task->tickets))
+			return lottery_task;
+		else {
+			lottery -= (lottery_task->tickets +
+				    lottery_task->left_tickets);
+			node = node->rb_right;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Functions for ticket class bucketed run queue
+ *
+ * Bucket k holds the tasks with 2^k to 2^(k+1) - 1 tickets. The buckets are
+ * consecutive runs, in class order, of one dense array which is grown by
+ * lottery_rq_grow() outside the rq lock, so nothing is allocated under it.
+ * A draw walks the non-empty buckets by their ticket sum and then picks a task
+ * inside the bucket by rejection sampling, which accepts with probability of
+ * at least 1/2 per try as all tasks in a bucket are within a factor of two.
+ */
+
+/**
+ * @brief Tries of rejection sampling before scanning the bucket linearly
+ */
+#define LOTTERY_BUCKET_MAX_TRIES	64
+
+/**
+ * @brief Computes the ticket class of a task
+ *
+ * @param tickets Tickets held by the task
+ *
+ * @return Index of the bucket for the task
+ */
+static inline unsigned int lottery_bucket_class(unsigned long long tickets)
+{
+	if (unlikely(!tickets))
+		return 0;
+
+	return fls64(tickets) - 1;
+}
+
+/**
+ * @brief Moves a task of the bucketed run queue to another slot
+ *
+ * @param rq Pointer to the run queue
+ * @param from Slot of the task
+ * @param to Free slot
+ */
+static inline void lottery_bucket_move(struct lottery_rq *rq,
+				       unsigned int from, unsigned int to)
+{
+	struct sched_lottery_entity *p = rq->lottery_bucket_tasks[from];
+
+	rq->lottery_bucket_tasks[to] = p;
+	p->rq_idx = to;
+}
+
+/**
+ * @brief Inserts a node to bucketed run queue. The first task of every
+ * non-empty bucket above the class of the node moves to the end of its bucket,
+ * which opens a slot at the end of the class in at most LOTTERY_NR_BUCKETS
+ * moves.
+ *
+ * @param rq Pointer to the run queue
+ * @param p Pointer to Lottery entity in task struct
+ *
+ * @return 0 on success, -ENOMEM if no room was reserved for the node
+ */
+static int insert_lottery_task_bucket(struct lottery_rq *rq,
+				      struct sched_lottery_entity *p)
+{
+	unsigned int k = lottery_bucket_class(p->tickets);
+	unsigned long long map = rq->lottery_bucket_map & ~((2ULL << k) - 1);
+	unsigned int hole = rq->lottery_bucket_nr;
+	struct lottery_bucket *b;
+	unsigned int j;
+
+	if (unlikely(rq->lottery_bucket_nr == rq->lottery_bucket_size))
+		return -ENOMEM;
+
+	while (map) {
+		j = fls64(map) - 1;
+		b = &rq->lottery_buckets[j];
+		lottery_bucket_move(rq, b->start, hole);
+		hole = b->start++;
+		map &= ~(1ULL << j);
+	}
+
+	b = &rq->lottery_buckets[k];
+	if (!b->nr)
+		b->start = hole;
+	p->rq_idx = hole;
+	rq->lottery_bucket_tasks[hole] = p;
+	rq->lottery_bucket_nr++;
+	b->nr++;
+	b->tickets += p->tickets;
+	rq->lottery_bucket_map |= 1ULL << k;
+
+	return 0;
+}
+
+/**
+ * @brief Remove a node from bucketed run queue by moving the last task of the
+ * bucket into its slot, and then the last task of every bucket above into the
+ * hole left before it
+ *
+ * @param rq Pointer to the run queue
+ * @param p Pointer to Lottery entity in task struct
+ */
+static void remove_lottery_task_bucket(struct lottery_rq *rq,
+				       struct sched_lottery_entity *p)
+{
+	unsigned int k = lottery_bucket_class(p->tickets);
+	unsigned long long map = rq->lottery_bucket_map & ~((2ULL << k) - 1);
+	struct lottery_bucket *b = &rq->lottery_buckets[k];
+	unsigned int hole = b->start + --b->nr;
+
+	lottery_bucket_move(rq, hole, p->rq_idx);
+	b->tickets -= p->tickets;
+	if (!b->nr)
+		rq->lottery_bucket_map &= ~(1ULL << k);
+
+	while (map) {
+		b = &rq->lottery_buckets[__ffs64(map)];
+		lottery_bucket_move(rq, b->start + b->nr - 1, hole);
+		hole = --b->start + b->nr;
+		map &= map - 1;
+	}
+	rq->lottery_bucket_nr--;
+}
+
+/**
+ * @brief Returns any node of the bucketed run queue
+ *
+ * @param rq Pointer to the run queue
+ *
+ * @return Last entity of the highest non-empty bucket or NULL if empty
+ */
+static struct sched_lottery_entity *
+first_lottery_task_bucket(struct lottery_rq *rq)
+{
+	if (!rq->lottery_bucket_nr)
+		return NULL;
+
+	return rq->lottery_bucket_tasks[rq->lottery_bucket_nr - 1];
+}
+
+/**
+ * @brief Finds the winner of the lottery in bucketed run queue
+ *
+ * @param rq Pointer to the run queue
+ * @param lottery Winning ticket from 0 to max_tickets - 1
+ *
+ * @return Pointer to the entity picked from the winning bucket
+ */
+static struct sched_lottery_entity *
+lookup_lottery_task_bucket(struct lottery_rq *rq, unsigned long long lottery)
+{
+	struct lottery_bucket *b = NULL;
+	struct sched_lottery_entity *lottery_task;
+	unsigned long long map = rq->lottery_bucket_map;
+	unsigned long long draw;
+	unsigned int k = 0, idx, tries;
+
+	/* Walk the non-empty buckets with cumulative sum of their tickets */
+	while (map) {
+		k = __ffs64(map);
+		b = &rq->lottery_buckets[k];
+		if (lottery < b->tickets)
+			break;
+		lottery -= b->tickets;
+		map &= map - 1;
+	}
+	if (unlikely(!map))
+		return NULL;
+
+	/* Pick a task uniformly and accept it with probability of
+	 * tickets / 2^(k+1), the upper bound of tickets in the bucket.
+	 */
+	for (tries = 0; tries < LOTTERY_BUCKET_MAX_TRIES; tries++) {
+		draw = lottery_random(rq);
+		idx = ((draw >> 32) * b->nr) >> 32;
+		lottery_task = rq->lottery_bucket_tasks[b->start + idx];
+		draw = lottery_random(rq) >> (63 - k);
+		if (draw < lottery_task->tickets)
+			return lottery_task;
+	}
+
+	/* Unlucky streak, use the residual ticket for a linear scan */
+	for (idx = 0; idx < b->nr; idx++) {
+		lottery_task = rq->lottery_bucket_tasks[b->start + idx];
+		if (lottery < lottery_task->tickets)
+			return lottery_task;
+		lottery -= lottery_task->tickets;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Frees the bucket array once the run queue left this backend
+ *
+ * @param rq Pointer to the run queue
+ */
+static void release_lottery_task_bucket(struct lottery_rq *rq)
+{
+	kfree(rq->lottery_bucket_tasks);
+	rq->lottery_bucket_tasks = NULL;
+	rq->lottery_bucket_size = 0;
+}
+
+/**
+ * Functions for compact array based run queue
+ *
+ * The tickets live in their own dense u64 array, parallel to the array of
+ * task pointers, so the draw scans contiguous memory instead of chasing
+ * pointers through task_structs. Removal swaps the last task into the hole.
+ * lottery_rq_grow() sizes both arrays outside the rq lock, so nothing is
+ * allocated under it.
+ */
+
+/**
+ * @brief Tickets summed per step of the prefix scan, one cache line of u64
+ */
+#define LOTTERY_ARRAY_STRIDE		8
+
+/**
+ * @brief Inserts a node to array run queue
+ *
+ * @param rq Pointer to the run queue
+ * @param p Pointer to Lottery entity in task struct
+ *
+ * @return 0 on success, -ENOMEM if no room was reserved for the node
+ */
+static int insert_lottery_task_array(struct lottery_rq *rq,
+				     struct sched_lottery_entity *p)
+{
+	if (unlikely(rq->lottery_array_nr == rq->lottery_array_size))
+		return -ENOMEM;
+
+	p->rq_idx = rq->lottery_array_nr++;
+	rq->lottery_array_tickets[p->rq_idx] = p->tickets;
+	rq->lottery_array_tasks[p->rq_idx] = p;
+
+	return 0;
+}
+
+/**
+ * @brief Remove a node from array run queue by moving the last task into its
+ * slot
+ *
+ * @param rq Pointer to the run queue
+ * @param p Pointer to Lottery entity in task struct
+ */
+static void remove_lottery_task_array(struct lottery_rq *rq,
+				      struct sched_lottery_entity *p)
+{
+	unsigned int last = --rq->lottery_array_nr;
+
+	rq->lottery_array_tickets[p->rq_idx] = rq->lottery_array_tickets[last];
+	rq->lottery_array_tasks[p->rq_idx] = rq->lottery_array_tasks[last];
+	rq->lottery_array_tasks[p->rq_idx]->rq_idx = p->rq_idx;
+}
+
+/**
+ * @brief Returns any node of the array run queue
+ *
+ * @param rq Pointer to the run queue
+ *
+ * @return Last entity of the array or NULL if empty
+ */
+static struct sched_lottery_entity *
+first_lottery_task_array(struct lottery_rq *rq)
+{
+	if (!rq->lottery_array_nr)
+		return NULL;
+
+	return rq->lottery_array_tasks[rq->lottery_array_nr - 1];
+}
+
+/**
+ * @brief Finds the winner of the lottery in array run queue
+ *
+ * @param rq Pointer to the run queue
+ * @param lottery Winning ticket from 0 to max_tickets - 1
+ *
+ * @return Pointer to the entity holding the winning ticket
+ */
+static struct sched_lottery_entity *
+lookup_lottery_task_array(struct lottery_rq *rq, unsigned long long lottery)
+{
+	const unsigned long long *t = rq->lottery_array_tickets;
+	unsigned int nr = rq->lottery_array_nr;
+	unsigned long long sum;
+	unsigned int i = 0, j;
+
+	/* Skip whole strides while the ticket is past their sum. The inner
+	 * sum has no branches so the compiler can vectorize it.
+	 */
+	for (; i + LOTTERY_ARRAY_STRIDE <= nr; i += LOTTERY_ARRAY_STRIDE) {
+		sum = 0;
+		for (j = 0; j < LOTTERY_ARRAY_STRIDE; j++)
+			sum += t[i + j];
+		if (lottery < sum)
+			break;
+		lottery -= sum;
+	}
+
+	for (; i < nr; i++) {
+		if (lottery < t[i])
+			return rq->lottery_array_tasks[i];
+		lottery -= t[i];
+	}
+	return NULL;
+}
+
+/**
+ * @brief Frees the arrays once the run queue left this backend
+ *
+ * @param rq Pointer to the run queue
+ */
+static void release_lottery_task_array(struct lottery_rq *rq)
+{
+	kfree(rq->lottery_array_tickets);
+	kfree(rq->lottery_array_tasks);
+	rq->lottery_array_tickets = NULL;
+	rq->lottery_array_tasks = NULL;
+	rq->lottery_array_size = 0;
+}
+
+/**
+ * @brief Run queue backends indexed by LOTTERY_RQ_BACKEND_*
+ */
+static const struct lottery_rq_ops lottery_rq_ops[] = {
+	[LOTTERY_RQ_BACKEND_LIST] = {
+		.insert		= insert_lottery_task_list,
+		.remove		= remove_lottery_task_list,
+		.first		= first_lottery_task_list,
+		.lookup		= lookup_lottery_task_list,
+	},
+	[LOTTERY_RQ_BACKEND_RBTREE] = {
+		.insert		= insert_lottery_task_rb_tree,
+		.remove		= remove_lottery_task_rb_tree,
+		.first		= first_lottery_task_rb_tree,
+		.lookup		= lookup_lottery_task_rb_tree,
+	},
+	[LOTTERY_RQ_BACKEND_BUCKET] = {
+		.insert		= insert_lottery_task_bucket,
+		.remove		= remove_lottery_task_bucket,
+		.first		= first_lottery_task_bucket,
+		.lookup		= lookup_lottery_task_bucket,
+		.release	= release_lottery_task_bucket,
+	},
+	[LOTTERY_RQ_BACKEND_ARRAY] = {
+		.insert		= insert_lottery_task_array,
+		.remove		= remove_lottery_task_array,
+		.first		= first_lottery_task_array,
+		.lookup		= lookup_lottery_task_array,
+		.release	= release_lottery_task_array,
+	},
+};
+
+/**
+ * @brief Decides which backend a run queue should use
+ *
+ * @param rq Pointer to the run queue
+ *
+ * @return Backend other than LOTTERY_RQ_BACKEND_ADAPTIVE
+ */
+static unsigned int lottery_rq_pick_backend(struct lottery_rq *rq)
+{
+	unsigned int backend = sysctl_sched_lottery_rq_backend;
+
+	if (backend != LOTTERY_RQ_BACKEND_ADAPTIVE)
+		return backend;
+
+	/* Hysteresis between the two thresholds keeps a run queue hovering
+	 * around the limit from converting on every enqueue/dequeue. The
+	 * lower one is inclusive so that a limit of 1 can still switch back.
+	 */
+	if (rq->nr_running > sysctl_sched_lottery_adaptive_nr)
+		return LOTTERY_RQ_BACKEND_RBTREE;
+	if (rq->nr_running <= sysctl_sched_lottery_adaptive_nr / 2)
+		return LOTTERY_RQ_BACKEND_LIST;
+
+	return rq->backend;
+}
+
+/**
+ * @brief Moves all the tasks of a run queue to another backend. Must be called
+ * with the rq lock held.
+ *
+ * @param rq Pointer to the run queue
+ * @param backend Backend which should hold the tasks afterwards
+ *
+ * @return 0 on success, -ENOMEM if the new backend could not take all tasks in
+ * which case the run queue stays on the old backend
+ */
+static int lottery_rq_convert(struct lottery_rq *rq, unsigned int backend)
+{
+	const struct lottery_rq_ops *from = &lottery_rq_ops[rq->backend];
+	const struct lottery_rq_ops *to = &lottery_rq_ops[backend];
+	struct sched_lottery_entity *p;
+
+	if (rq->backend == backend)
+		return 0;
+
+	while ((p = from->first(rq)) != NULL) {
+		from->remove(rq, p);
+		if (likely(!to->insert(rq, p)))
+			continue;
+
+		/* Roll back. The old backend keeps its capacity until it is
+		 * released, so re-inserting there cannot fail.
+		 */
+		from->insert(rq, p);
+		while ((p = to->first(rq)) != NULL) {
+			to->remove(rq, p);
+			from->insert(rq, p);
+		}
+		if (to->release)
+			to->release(rq);
+		return -ENOMEM;
+	}
+	if (from->release)
+		from->release(rq);
+	rq->backend = backend;
+
+	stats.lottery_rq_switch++;
+	return 0;
+}
+
+/**
+ * @brief Inserts a task to the run queue, falling back to the list if the
+ * backend could not allocate memory
+ *
+ * @param rq Pointer to the run queue
+ * @param p Pointer to Lottery entity in task struct
+ */
+static void lottery_rq_insert(struct lottery_rq *rq,
+			      struct sched_lottery_entity *p)
+{
+	if (likely(!lottery_rq_ops[rq->backend].insert(rq, p)))
+		return;
+
+	lottery_rq_convert(rq, LOTTERY_RQ_BACKEND_LIST);
+	insert_lottery_task_list(rq, p);
+}
+
+/**
+ * @brief Serializes growing the run queue arrays
+ */
+static DEFINE_MUTEX(lottery_reserve_mutex);
+
+/**
+ * @brief Smallest capacity of a run queue array
+ */
+#define LOTTERY_RESERVE_MIN	32
+
+/**
+ * @brief Grows the arrays of a run queue to hold nr tasks. The arrays are
+ * allocated before the rq lock is taken and swapped in under it; the lock is
+ * not taken at all if nothing has to grow. Called with lottery_reserve_mutex
+ * held.
+ *
+ * @param rq Pointer to the run queue
+ * @param nr Number of tasks to make room for
+ *
+ * @return 0 on success, -ENOMEM if the arrays could not be allocated
+ */
+static int lottery_rq_reserve(struct rq *rq, unsigned int nr)
+{
+	struct lottery_rq *lt_rq = &rq->lottery_rq;
+	unsigned int backend = sysctl_sched_lottery_rq_backend;
+	struct sched_lottery_entity **tasks = NULL, **heap = NULL;
+	unsigned long long *tickets = NULL;
+	void *old_tasks = NULL, *old_tickets = NULL, *old_heap = NULL;
+	unsigned int size;
+	unsigned long flags;
+	int ret = -ENOMEM;
+
+	size = roundup_pow_of_two(max_t(unsigned int, nr, LOTTERY_RESERVE_MIN));
+
+	/* The wait heap is used by all backends */
+	if (lt_rq->lottery_wait_size < nr) {
+		heap = kmalloc(size * sizeof(*heap), GFP_KERNEL);
+		if (!heap)
+			goto out;
+	}
+
+	if ((backend == LOTTERY_RQ_BACKEND_BUCKET &&
+	     lt_rq->lottery_bucket_size < nr) ||
+	    (backend == LOTTERY_RQ_BACKEND_ARRAY &&
+	     lt_rq->lottery_array_size < nr)) {
+		tasks = kmalloc(size * sizeof(*tasks), GFP_KERNEL);
+		if (!tasks)
+			goto out;
+	}
+	if (backend == LOTTERY_RQ_BACKEND_ARRAY &&
+	    lt_rq->lottery_array_size < nr) {
+		tickets = kmalloc(size * sizeof(*tickets), GFP_KERNEL);
+		if (!tickets)
+			goto out;
+	}
+
+	if (!heap && !tasks)
+		return 0;
+
+	spin_lock_irqsave(&rq->lock, flags);
+	if (heap && lt_rq->lottery_wait_size < size) {
+		memcpy(heap, lt_rq->lottery_wait_heap,
+		       lt_rq->lottery_wait_nr * sizeof(*heap));
+		old_heap = lt_rq->lottery_wait_heap;
+		lt_rq->lottery_wait_heap = heap;
+		lt_rq->lottery_wait_size = size;
+		heap = NULL;
+	}
+	/* Recheck, the backend may have released its arrays meanwhile */
+	if (tickets && lt_rq->lottery_array_size < size) {
+		memcpy(tasks, lt_rq->lottery_array_tasks,
+		       lt_rq->lottery_array_nr * sizeof(*tasks));
+		memcpy(tickets, lt_rq->lottery_array_tickets,
+		       lt_rq->lottery_array_nr * sizeof(*tickets));
+		old_tasks = lt_rq->lottery_array_tasks;
+		old_tickets = lt_rq->lottery_array_tickets;
+		lt_rq->lottery_array_tasks = tasks;
+		lt_rq->lottery_array_tickets = tickets;
+		lt_rq->lottery_array_size = size;
+		tasks = NULL;
+		tickets = NULL;
+	} else if (tasks && !tickets && lt_rq->lottery_bucket_size < size) {
+		memcpy(tasks, lt_rq->lottery_bucket_tasks,
+		       lt_rq->lottery_bucket_nr * sizeof(*tasks));
+		old_tasks = lt_rq->lottery_bucket_tasks;
+		lt_rq->lottery_bucket_tasks = tasks;
+		lt_rq->lottery_bucket_size = size;
+		tasks = NULL;
+	}
+	/* An insert which found no room left the run queue on the list */
+	lottery_rq_convert(lt_rq, lottery_rq_pick_backend(lt_rq));
+	spin_unlock_irqrestore(&rq->lock, flags);
+
+	kfree(old_tasks);
+	kfree(old_tickets);
+	kfree(old_heap);
+	ret = 0;
+out:
+	kfree(tasks);
+	kfree(tickets);
+	kfree(heap);
+	return ret;
+}
+
+/**
+ * @brief Work which grows the arrays of one run queue to the size asked for
+ * by lottery_rq_check_room()
+ *
+ * @param work Pointer to lottery_grow_work of the run queue
+ */
+static void lottery_rq_grow(struct work_struct *work)
+{
+	struct lottery_rq *lt_rq = container_of(work, struct lottery_rq,
+						lottery_grow_work.work);
+	struct rq *rq = container_of(lt_rq, struct rq, lottery_rq);
+
+	mutex_lock(&lottery_reserve_mutex);
+	lottery_rq_reserve(rq, ACCESS_ONCE(lt_rq->lottery_grow_nr));
+	mutex_unlock(&lottery_reserve_mutex);
+}
+
+/**
+ * @brief Asks for bigger arrays once a run queue is about to fill them. Each
+ * run queue is sized for its own tasks only. Called with the rq lock held, so
+ * the growth is left to lottery_grow_work; arming its timer does not allocate
+ * or wake anybody.
+ *
+ * @param lt_rq Pointer to the lottery run queue
+ */
+static void lottery_rq_check_room(struct lottery_rq *lt_rq)
+{
+	unsigned int nr = lt_rq->nr_running;
+	unsigned int size = lt_rq->lottery_wait_size;
+
+	switch (lottery_rq_pick_backend(lt_rq)) {
+	case LOTTERY_RQ_BACKEND_BUCKET:
+		size = min(size, lt_rq->lottery_bucket_size);
+		break;
+	case LOTTERY_RQ_BACKEND_ARRAY:
+		size = min(size, lt_rq->lottery_array_size);
+		break;
+	}
+
+	/* Grow at three quarters so that a burst of wakeups still fits */
+	if (likely(nr + nr / 3 < size))
+		return;
+	if (nr * 2 <= lt_rq->lottery_grow_nr || !keventd_up())
+		return;
+
+	lt_rq->lottery_grow_nr = nr * 2;
+	schedule_delayed_work(&lt_rq->lottery_grow_work, 1);
+}
+
+/**
+ * @brief Handler for the backend sysctls which converts every run queue to
+ * the newly selected backend
+ *
+ * @return 0 on success or error from proc_dointvec_minmax
+ */
+int sched_lottery_rq_handler(struct ctl_table *table, int write,
+			     void __user *buffer, size_t *lenp,
+			     loff_t *ppos)
+{
+	int ret, cpu;
+	unsigned long flags;
+	struct rq *rq;
+
+	mutex_lock(&lottery_reserve_mutex);
+	ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+
+	if (!ret && write) {
+		/* A run queue which gets no room stays on its backend */
+		for_each_possible_cpu(cpu) {
+			rq = cpu_rq(cpu);
+			lottery_rq_reserve(rq, rq->lottery_rq.nr_running * 2);
+			spin_lock_irqsave(&rq->lock, flags);
+			lottery_rq_convert(&rq->lottery_rq,
+				lottery_rq_pick_backend(&rq->lottery_rq));
+			spin_unlock_irqrestore(&rq->lock, flags);
+		}
+	}
+	mutex_unlock(&lottery_reserve_mutex);
+
+	return ret;
+}
+
+/**
+ * @brief Parses lottery_rq= boot parameter
+ *
+ * @param str One of list, rbtree, adaptive, bucket or array
+ *
+ * @return 1 if the parameter was consumed
+ */
+static int __init setup_lottery_rq(char *str)
+{
+	int i;
+
+	for (i = 0; i < LOTTERY_NR_RQ_BACKENDS; i++) {
+		if (!strcmp(str, lottery_rq_backend_name[i])) {
+			sysctl_sched_lottery_rq_backend = i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+__setup("lottery_rq=", setup_lottery_rq);
+
+/**
+ * @brief Period over which the lottery runtime is measured, in us
+ */
+unsigned int sysctl_sched_lottery_period = 1000000;
+
+/**
+ * @brief Part of the period the lottery class may run, in us. Once it is
+ * used up the class steps aside to CFS until the next period; -1 disables
+ * throttling
+ */
+int sysctl_sched_lottery_runtime = 950000;
+
+static inline u64 global_lottery_period(void)
+{
+	return (u64)sysctl_sched_lottery_period * NSEC_PER_USEC;
+}
+
+static inline u64 global_lottery_runtime(void)
+{
+	if (sysctl_sched_lottery_runtime < 0)
+		return RUNTIME_INF;
+
+	return (u64)sysctl_sched_lottery_runtime * NSEC_PER_USEC;
+}
+
+static inline int lottery_bandwidth_enabled(void)
+{
+	return sysctl_sched_lottery_runtime >= 0;
+}
+
+static int do_sched_lottery_period_timer(struct lottery_bandwidth *lt_b,
+					 int overrun);
+
+static enum hrtimer_restart sched_lottery_period_timer(struct hrtimer *timer)
+{
+	struct lottery_bandwidth *lt_b =
+		container_of(timer, struct lottery_bandwidth,
+			     lottery_period_timer);
+	ktime_t now;
+	int overrun;
+	int idle = 0;
+
+	for (;;) {
+		now = hrtimer_cb_get_time(timer);
+		overrun = hrtimer_forward(timer, now, lt_b->lottery_period);
+
+		if (!overrun)
+			break;
+
+		idle = do_sched_lottery_period_timer(lt_b, overrun);
+	}
+
+	return idle ? HRTIMER_NORESTART : HRTIMER_RESTART;
+}
+
+static void init_lottery_bandwidth(struct lottery_bandwidth *lt_b,
+				   u64 period, u64 runtime)
+{
+	lt_b->lottery_period = ns_to_ktime(period);
+	lt_b->lottery_runtime = runtime;
+
+	spin_lock_init(&lt_b->lottery_runtime_lock);
+
+	hrtimer_init(&lt_b->lottery_period_timer,
+		     CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	lt_b->lottery_period_timer.function = sched_lottery_period_timer;
+}
+
+static void start_lottery_bandwidth(struct lottery_bandwidth *lt_b)
+{
+	ktime_t now;
+
+	if (!lottery_bandwidth_enabled() || lt_b->lottery_runtime == RUNTIME_INF)
+		return;
+
+	if (hrtimer_active(&lt_b->lottery_period_timer))
+		return;
+
+	spin_lock(&lt_b->lottery_runtime_lock);
+	for (;;) {
+		unsigned long delta;
+		ktime_t soft, hard;
+
+		if (hrtimer_active(&lt_b->lottery_period_timer))
+			break;
+
+		now = hrtimer_cb_get_time(&lt_b->lottery_period_timer);
+		hrtimer_forward(&lt_b->lottery_period_timer, now,
+				lt_b->lottery_period);
+
+		soft = hrtimer_get_softexpires(&lt_b->lottery_period_timer);
+		hard = hrtimer_get_expires(&lt_b->lottery_period_timer);
+		delta = ktime_to_ns(ktime_sub(hard, soft));
+		__hrtimer_start_range_ns(&lt_b->lottery_period_timer, soft,
+					 delta, HRTIMER_MODE_ABS_PINNED, 0);
+	}
+	spin_unlock(&lt_b->lottery_runtime_lock);
+}
+
+/**
+ * @brief Bounded wait: a runnable task which has not won for this many times
+ * its expected wait (one tick divided by its ticket share) is scheduled
+ * without a draw. 0 turns the guard off
+ */
+unsigned int sysctl_sched_lottery_wait_factor = 0;
+
+/**
+ * @brief Computes when a task has waited too long for a win
+ *
+ * @param lt_rq Pointer to the lottery run queue
+ * @param t Lottery entity, counted in max_tickets
+ *
+ * @return Deadline in rq->clock time
+ */
+static u64 lottery_wait_deadline(struct lottery_rq *lt_rq,
+				 struct sched_lottery_entity *t)
+{
+	u64 share, bound;
+
+	/* Expected number of draws until t wins, at least one */
+	share = div64_u64(lt_rq->max_tickets, t->tickets ? t->tickets : 1);
+	if (!share)
+		share = 1;
+
+	bound = (u64)sysctl_sched_lottery_wait_factor * TICK_NSEC;
+	if (share > div64_u64(~0ULL - t->wait_start, bound))
+		return ~0ULL;
+
+	return t->wait_start + share * bound;
+}
+
+static inline void lottery_wait_swap(struct lottery_rq *lt_rq,
+				     unsigned int a, unsigned int b)
+{
+	struct sched_lottery_entity **heap = lt_rq->lottery_wait_heap;
+	struct sched_lottery_entity *tmp = heap[a];
+
+	heap[a] = heap[b];
+	heap[b] = tmp;
+	heap[a]->wait_idx = a;
+	heap[b]->wait_idx = b;
+}
+
+static void lottery_wait_sift_up(struct lottery_rq *lt_rq, unsigned int idx)
+{
+	struct sched_lottery_entity **heap = lt_rq->lottery_wait_heap;
+
+	while (idx) {
+		unsigned int parent = (idx - 1) / 2;
+
+		if (heap[parent]->wait_deadline <= heap[idx]->wait_deadline)
+			break;
+		lottery_wait_swap(lt_rq, parent, idx);
+		idx = parent;
+	}
+}
+
+static void lottery_wait_sift_down(struct lottery_rq *lt_rq, unsigned int idx)
+{
+	struct sched_lottery_entity **heap = lt_rq->lottery_wait_heap;
+
+	for (;;) {
+		unsigned int child = 2 * idx + 1, min = idx;
+
+		if (child < lt_rq->lottery_wait_nr &&
+		    heap[child]->wait_deadline < heap[min]->wait_deadline)
+			min = child;
+		child++;
+		if (child < lt_rq->lottery_wait_nr &&
+		    heap[child]->wait_deadline < heap[min]->wait_deadline)
+			min = child;
+		if (min == idx)
+			break;
+		lottery_wait_swap(lt_rq, idx, min);
+		idx = min;
+	}
+}
+
+/**
+ * @brief Tracks the wait of a runnable task in the min-heap on deadline. The
+ * heap is grown by lottery_rq_grow(); a task which does not fit is simply not
+ * guarded until then.
+ *
+ * @param lt_rq Pointer to the lottery run queue
+ * @param t Lottery entity, counted in max_tickets
+ */
+static void lottery_wait_insert(struct lottery_rq *lt_rq,
+				struct sched_lottery_entity *t)
+{
+	if (!sysctl_sched_lottery_wait_factor)
+		return;
+
+	if (unlikely(lt_rq->lottery_wait_nr == lt_rq->lottery_wait_size))
+		return;
+
+	t->wait_deadline = lottery_wait_deadline(lt_rq, t);
+	t->wait_idx = lt_rq->lottery_wait_nr++;
+	lt_rq->lottery_wait_heap[t->wait_idx] = t;
+	lottery_wait_sift_up(lt_rq, t->wait_idx);
+}
+
+/**
+ * @brief Stops tracking the wait of a task
+ *
+ * @param lt_rq Pointer to the lottery run queue
+ * @param t Lottery entity
+ */
+static void lottery_wait_remove(struct lottery_rq *lt_rq,
+				struct sched_lottery_entity *t)
+{
+	unsigned int idx = t->wait_idx;
+
+	if (t->wait_idx < 0)
+		return;
+
+	t->wait_idx = -1;
+	if (idx == --lt_rq->lottery_wait_nr)
+		return;
+
+	lt_rq->lottery_wait_heap[idx] =
+		lt_rq->lottery_wait_heap[lt_rq->lottery_wait_nr];
+	lt_rq->lottery_wait_heap[idx]->wait_idx = idx;
+	lottery_wait_sift_up(lt_rq, idx);
+	lottery_wait_sift_down(lt_rq, lt_rq->lottery_wait_heap[idx]->wait_idx);
+}
+
+/**
+ * @brief Returns the task which waited past its bound, if any
+ *
+ * @param rq Pointer to the run queue
+ */
+static struct sched_lottery_entity *lottery_wait_overdue(struct rq *rq)
+{
+	struct lottery_rq *lt_rq = &rq->lottery_rq;
+	struct sched_lottery_entity *t;
+
+	if (!sysctl_sched_lottery_wait_factor || !lt_rq->lottery_wait_nr)
+		return NULL;
+
+	t = lt_rq->lottery_wait_heap[0];
+	if (t->wait_deadline > rq->clock)
+		return NULL;
+
+	stats.lottery_forced++;
+	lt_rq->nr_forced++;
+	lottery_log(LOTTERY_MSG, "PID:%d forced after %llu NS",
+		    t->task->pid, rq->clock - t->wait_start);
+	return t;
+}
+
+/**
+ * @brief Carries the wait of a task over to another cpu. rq->clock is per
+ * cpu, so wait_start is rebased on the clock of the new run queue.
+ *
+ * @param p Task being moved
+ * @param new_cpu Cpu the task moves to
+ */
+static void lottery_migrate_wait(struct task_struct *p, int new_cpu)
+{
+	s64 waited = cpu_rq(task_cpu(p))->clock - p->lt.wait_start;
+	u64 now = cpu_rq(new_cpu)->clock;
+
+	if (!p->lt.wait_start)
+		return;
+
+	if (waited < 0)
+		waited = 0;
+	/* 0 means asleep, keep the task waiting */
+	p->lt.wait_start = now > waited ? now - waited : 1;
+}
+
+/**
+ * @brief Restarts the wait of a task which just won
+ *
+ * @param rq Pointer to the run queue
+ * @param t Lottery entity of the winner
+ */
+static void lottery_wait_won(struct rq *rq, struct sched_lottery_entity *t)
+{
+	t->wait_start = rq->clock;
+	lottery_wait_remove(&rq->lottery_rq, t);
+	lottery_wait_insert(&rq->lottery_rq, t);
+}
+
+/**
+ * @brief Adds a task to the draw. Like RT tasks it adds nothing to rq->load,
+ * which the balancer could never move as the class does not balance; its
+ * runtime counts in weighted_cpuload() and cpu_load[] through
+ * lottery_cpuload() instead.
+ *
+ * @param rq Pointer to the run queue
+ * @param t Lottery entity of the task
+ */
+static void __enqueue_lottery_entity(struct rq *rq,
+				     struct sched_lottery_entity *t)
+{
+	struct lottery_rq *lt_rq = &rq->lottery_rq;
+
+	lt_rq->max_tickets += t->tickets;
+	lt_rq->nr_running++;
+	lottery_rq_insert(lt_rq, t);
+	lottery_rq_convert(lt_rq, lottery_rq_pick_backend(lt_rq));
+
+	/* Only time spent runnable counts as waiting */
+	if (!t->wait_start)
+		t->wait_start = rq->clock;
+	lottery_wait_insert(lt_rq, t);
+	lottery_rq_check_room(lt_rq);
+}
+
+/**
+ * @brief Removes a task from the draw
+ *
+ * @param rq Pointer to the run queue
+ * @param t Lottery entity of the task
+ */
+static void __dequeue_lottery_entity(struct rq *rq,
+				     struct sched_lottery_entity *t)
+{
+	struct lottery_rq *lt_rq = &rq->lottery_rq;
+
+	lottery_wait_remove(lt_rq, t);
+	lottery_rq_ops[lt_rq->backend].remove(lt_rq, t);
+	lt_rq->max_tickets -= t->tickets;
+	lt_rq->nr_running--;
+	lottery_rq_convert(lt_rq, lottery_rq_pick_backend(lt_rq));
+}
+
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+/**
+ * @brief Lottery runtime of the root task group, which is never throttled
+ */
+static struct lottery_group_rq init_lottery_group_rq[NR_CPUS];
+
+static DEFINE_MUTEX(lottery_constraints_mutex);
+
+static void destroy_lottery_bandwidth(struct lottery_bandwidth *lt_b)
+{
+	hrtimer_cancel(&lt_b->lottery_period_timer);
+}
+
+static inline struct lottery_group_rq *
+lottery_group_rq(struct task_group *tg, struct rq *rq)
+{
+	return &tg->lottery_rq[cpu_of(rq)];
+}
+
+/**
+ * @brief Takes a task of a throttled group out of the draw until the group
+ * gets runtime again. The task stays queued as far as the core is concerned.
+ *
+ * @param rq Pointer to the run queue
+ * @param t Lottery entity of the task
+ */
+static void lottery_park(struct rq *rq, struct sched_lottery_entity *t)
+{
+	__dequeue_lottery_entity(rq, t);
+	list_add_tail(&t->lottery_runnable_node,
+		      &rq->lottery_rq.lottery_throttled_head);
+	t->throttled = 1;
+}
+
+/**
+ * @brief Forgets a parked task which leaves the run queue
+ *
+ * @return 1 if the task was parked, 0 if it is in the draw
+ */
+static int lottery_unpark(struct sched_lottery_entity *t)
+{
+	if (!t->throttled)
+		return 0;
+
+	list_del(&t->lottery_runnable_node);
+	t->throttled = 0;
+
+	return 1;
+}
+
+/**
+ * @brief Puts the parked tasks of a group back into the draw
+ *
+ * @param rq Pointer to the run queue, locked
+ * @param tg Task group which got runtime again
+ */
+static void lottery_unpark_group(struct rq *rq, struct task_group *tg)
+{
+	struct sched_lottery_entity *t, *n;
+	int queued = 0;
+
+	list_for_each_entry_safe(t, n, &rq->lottery_rq.lottery_throttled_head,
+				 lottery_runnable_node) {
+		if (task_group(t->task) != tg)
+			continue;
+
+		lottery_unpark(t);
+		/* time spent parked is not waiting for a draw */
+		t->wait_start = 0;
+		__enqueue_lottery_entity(rq, t);
+		queued = 1;
+	}
+
+	if (queued)
+		resched_task(rq->curr);
+}
+
+static inline int lottery_group_throttled(struct rq *rq, struct task_struct *p)
+{
+	return lottery_group_rq(task_group(p), rq)->lottery_throttled;
+}
+
+/**
+ * @brief Charges runtime to the group of the current task
+ */
+static void lottery_group_charge(struct rq *rq, struct task_struct *curr,
+				 u64 delta_exec)
+{
+	struct task_group *tg = task_group(curr);
+	struct lottery_group_rq *lg_rq = lottery_group_rq(tg, rq);
+	u64 runtime = tg->lottery_bandwidth.lottery_runtime;
+
+	if (runtime == RUNTIME_INF)
+		return;
+
+	start_lottery_bandwidth(&tg->lottery_bandwidth);
+
+	lg_rq->lottery_time += delta_exec;
+	if (!lg_rq->lottery_throttled && lg_rq->lottery_time > runtime) {
+		lg_rq->lottery_throttled = 1;
+		stats.lottery_throttle++;
+		resched_task(curr);
+	}
+}
+
+/**
+ * @brief Hands out the runtime of a new period to a group on one cpu
+ *
+ * @param rq Pointer to the run queue, locked
+ * @param tg Task group
+ * @param overrun Number of periods which elapsed
+ *
+ * @return 1 if the group has nothing left to refresh on this cpu
+ */
+static int lottery_group_refresh(struct rq *rq, struct task_group *tg,
+				 int overrun)
+{
+	struct lottery_group_rq *lg_rq = lottery_group_rq(tg, rq);
+	u64 runtime = tg->lottery_bandwidth.lottery_runtime;
+	int unlimited = !lottery_bandwidth_enabled() || runtime == RUNTIME_INF;
+
+	if (unlimited)
+		lg_rq->lottery_time = 0;
+	else if (lg_rq->lottery_time)
+		lg_rq->lottery_time -= min(lg_rq->lottery_time,
+					   overrun * runtime);
+
+	if (lg_rq->lottery_throttled &&
+	    (unlimited || lg_rq->lottery_time < runtime)) {
+		lg_rq->lottery_throttled = 0;
+		lottery_unpark_group(rq, tg);
+	}
+
+	return !lg_rq->lottery_time && !lg_rq->lottery_throttled;
+}
+
+static int tg_set_lottery_bandwidth(struct task_group *tg,
+				    u64 period, u64 runtime)
+{
+	unsigned long flags;
+	int i;
+
+	/* The root group is bounded by the sysctl only */
+	if (tg == &init_task_group)
+		return -EINVAL;
+
+	if (runtime != RUNTIME_INF && runtime > period)
+		return -EINVAL;
+
+	mutex_lock(&lottery_constraints_mutex);
+	spin_lock_irq(&tg->lottery_bandwidth.lottery_runtime_lock);
+	tg->lottery_bandwidth.lottery_period = ns_to_ktime(period);
+	tg->lottery_bandwidth.lottery_runtime = runtime;
+	spin_unlock_irq(&tg->lottery_bandwidth.lottery_runtime_lock);
+
+	for_each_possible_cpu(i) {
+		struct rq *rq = cpu_rq(i);
+
+		spin_lock_irqsave(&rq->lock, flags);
+		lottery_group_refresh(rq, tg, 0);
+		spin_unlock_irqrestore(&rq->lock, flags);
+	}
+	mutex_unlock(&lottery_constraints_mutex);
+
+	return 0;
+}
+
+static int sched_group_set_lottery_runtime(struct task_group *tg,
+					   long runtime_us)
+{
+	u64 runtime, period;
+
+	period = ktime_to_ns(tg->lottery_bandwidth.lottery_period);
+	runtime = (u64)runtime_us * NSEC_PER_USEC;
+	if (runtime_us < 0)
+		runtime = RUNTIME_INF;
+
+	return tg_set_lottery_bandwidth(tg, period, runtime);
+}
+
+static long sched_group_lottery_runtime(struct task_group *tg)
+{
+	u64 runtime_us;
+
+	if (tg->lottery_bandwidth.lottery_runtime == RUNTIME_INF)
+		return -1;
+
+	runtime_us = tg->lottery_bandwidth.lottery_runtime;
+	do_div(runtime_us, NSEC_PER_USEC);
+	return runtime_us;
+}
+
+static int sched_group_set_lottery_period(struct task_group *tg,
+					  long period_us)
+{
+	u64 runtime, period;
+
+	period = (u64)period_us * NSEC_PER_USEC;
+	runtime = tg->lottery_bandwidth.lottery_runtime;
+
+	if (period == 0)
+		return -EINVAL;
+
+	return tg_set_lottery_bandwidth(tg, period, runtime);
+}
+
+static long sched_group_lottery_period(struct task_group *tg)
+{
+	u64 period_us;
+
+	period_us = ktime_to_ns(tg->lottery_bandwidth.lottery_period);
+	do_div(period_us, NSEC_PER_USEC);
+	return period_us;
+}
+#else
+static inline int lottery_unpark(struct sched_lottery_entity *t)
+{
+	return 0;
+}
+
+static inline int lottery_group_throttled(struct rq *rq, struct task_struct *p)
+{
+	return 0;
+}
+
+static inline void lottery_park(struct rq *rq, struct sched_lottery_entity *t)
+{
+}
+
+static inline void lottery_group_charge(struct rq *rq,
+					struct task_struct *curr,
+					u64 delta_exec)
+{
+}
+#endif /* CONFIG_LOTTERY_GROUP_SCHED */
+
+/**
+ * @brief Charges runtime of the current task to the run queue budget, and to
+ * the budget of its group
+ *
+ * @param rq Pointer to the run queue
+ * @param curr Current lottery task
+ * @param delta_exec Runtime to charge
+ */
+static void lottery_charge(struct rq *rq, struct task_struct *curr,
+			   u64 delta_exec)
+{
+	struct lottery_rq *lt_rq = &rq->lottery_rq;
+
+	if (!lottery_bandwidth_enabled())
+		return;
+
+	if (lt_rq->lottery_runtime != RUNTIME_INF) {
+		start_lottery_bandwidth(&def_lottery_bandwidth);
+
+		lt_rq->lottery_time += delta_exec;
+		if (!lt_rq->lottery_throttled &&
+		    lt_rq->lottery_time > lt_rq->lottery_runtime) {
+			lt_rq->lottery_throttled = 1;
+			stats.lottery_throttle++;
+			lottery_log(LOTTERY_MSG, "Throttled after %llu NS",
+				    lt_rq->lottery_time);
+			resched_task(curr);
+		}
+	}
+
+	lottery_group_charge(rq, curr, delta_exec);
+}
+
+/**
+ * @brief Hands out the runtime of a new period to a run queue
+ *
+ * @param rq Pointer to the run queue, locked
+ * @param overrun Number of periods which elapsed
+ *
+ * @return 1 if the run queue has nothing left to refresh
+ */
+static int lottery_rq_refresh(struct rq *rq, int overrun)
+{
+	struct lottery_rq *lt_rq = &rq->lottery_rq;
+	u64 runtime = lt_rq->lottery_runtime;
+	int unlimited = !lottery_bandwidth_enabled() || runtime == RUNTIME_INF;
+
+	if (unlimited)
+		lt_rq->lottery_time = 0;
+	else if (lt_rq->lottery_time)
+		lt_rq->lottery_time -= min(lt_rq->lottery_time,
+					   overrun * runtime);
+
+	if (lt_rq->lottery_throttled &&
+	    (unlimited || lt_rq->lottery_time < runtime)) {
+		lt_rq->lottery_throttled = 0;
+		if (lt_rq->nr_running)
+			resched_task(rq->curr);
+	}
+
+	return !lt_rq->lottery_time && !lt_rq->lottery_throttled;
+}
+
+static int do_sched_lottery_period_timer(struct lottery_bandwidth *lt_b,
+					 int overrun)
+{
+	int i, idle = 1;
+
+	for_each_online_cpu(i) {
+		struct rq *rq = cpu_rq(i);
+
+		spin_lock(&rq->lock);
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+		if (lt_b != &def_lottery_bandwidth)
+			idle &= lottery_group_refresh(rq,
+				container_of(lt_b, struct task_group,
+					     lottery_bandwidth), overrun);
+		else
+#endif
+			idle &= lottery_rq_refresh(rq, overrun);
+		spin_unlock(&rq->lock);
+	}
+
+	return idle;
+}
+
+/**
+ * @brief Handler for kernel.sched_lottery_period_us and
+ * kernel.sched_lottery_runtime_us
+ */
+int sched_lottery_handler(struct ctl_table *table, int write,
+			  void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int ret, i;
+	unsigned int old_period;
+	int old_runtime;
+	unsigned long flags;
+	static DEFINE_MUTEX(mutex);
+
+	mutex_lock(&mutex);
+	old_period = sysctl_sched_lottery_period;
+	old_runtime = sysctl_sched_lottery_runtime;
+
+	ret = proc_dointvec(table, write, buffer, lenp, ppos);
+
+	if (!ret && write) {
+		if (!sysctl_sched_lottery_period ||
+		    (global_lottery_runtime() != RUNTIME_INF &&
+		     global_lottery_runtime() > global_lottery_period())) {
+			sysctl_sched_lottery_period = old_period;
+			sysctl_sched_lottery_runtime = old_runtime;
+			ret = -EINVAL;
+			goto out;
+		}
+
+		spin_lock_irqsave(&def_lottery_bandwidth.lottery_runtime_lock,
+				  flags);
+		def_lottery_bandwidth.lottery_runtime = global_lottery_runtime();
+		def_lottery_bandwidth.lottery_period =
+			ns_to_ktime(global_lottery_period());
+		spin_unlock_irqrestore(&def_lottery_bandwidth.lottery_runtime_lock,
+				       flags);
+
+		for_each_possible_cpu(i) {
+			struct rq *rq = cpu_rq(i);
+
+			spin_lock_irqsave(&rq->lock, flags);
+			rq->lottery_rq.lottery_runtime = global_lottery_runtime();
+			lottery_rq_refresh(rq, 0);
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+			{
+				struct task_group *tg;
+
+				/* Groups may have been throttled for good */
+				rcu_read_lock();
+				list_for_each_entry_rcu(tg, &task_groups, list)
+					lottery_group_refresh(rq, tg, 0);
+				rcu_read_unlock();
+			}
+#endif
+			spin_unlock_irqrestore(&rq->lock, flags);
+		}
+	}
+out:
+	mutex_unlock(&mutex);
+
+	return ret;
+}
+
+#ifdef CONFIG_SMP
+/**
+ * Gang lottery
+ */
+
+/**
+ * @brief Length of a gang round in us, 0 turns gang mode off. Each round a
+ * draw over the tickets of every cpu picks a winning task, and all runnable
+ * threads of its process run together on their cpus until the next round.
+ */
+unsigned int sysctl_sched_lottery_gang = 0;
+
+/**
+ * @brief Shortest gang round in us, shorter rounds would spend the cpus on
+ * draws and IPIs
+ */
+#define LOTTERY_GANG_MIN_US	100
+
+/**
+ * @brief Global draw state. The timer only schedules the round tasklet,
+ * which walks the winner's threads with interrupts on and is the only user
+ * of the kick mask. The lock protects the generator against reseeding.
+ */
+static struct lottery_gang {
+	spinlock_t lock;
+	struct hrtimer timer;
+	struct tasklet_struct round;
+	u64 rng; /* generator state, see lottery_seed_state() */
+	struct cpumask kick; /* cpus whose gang thread changed this round */
+} lottery_gang;
+
+static inline u64 lottery_gang_period(void)
+{
+	return (u64)sysctl_sched_lottery_gang * NSEC_PER_USEC;
+}
+
+/**
+ * @brief Draws the winner of a round over the tickets of all online cpus, so
+ * a process wins in proportion to the tickets of its runnable threads
+ *
+ * @return The winning task under rcu_read_lock(), which the caller drops,
+ * or NULL without the lock when no lottery task is runnable
+ */
+static struct task_struct *lottery_gang_draw(void)
+{
+	unsigned long long total = 0, lottery;
+	struct task_struct *p = NULL;
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		total += ACCESS_ONCE(cpu_rq(cpu)->lottery_rq.max_tickets);
+	if (!total)
+		return NULL;
+
+	spin_lock_irq(&lottery_gang.lock);
+	lottery = lottery_next_random(&lottery_gang.rng) % total;
+	spin_unlock_irq(&lottery_gang.lock);
+
+	for_each_online_cpu(cpu) {
+		struct rq *rq = cpu_rq(cpu);
+		struct lottery_rq *lt_rq = &rq->lottery_rq;
+		struct sched_lottery_entity *t;
+
+		spin_lock_irq(&rq->lock);
+		if (lottery >= lt_rq->max_tickets) {
+			lottery -= lt_rq->max_tickets;
+			spin_unlock_irq(&rq->lock);
+			continue;
+		}
+		t = lottery_rq_ops[lt_rq->backend].lookup(lt_rq, lottery);
+		if (t) {
+			p = t->task;
+			/* Keeps the task around once the rq is unlocked */
+			rcu_read_lock();
+		}
+		spin_unlock_irq(&rq->lock);
+		break;
+	}
+
+	/* Tickets went away since they were summed, no winner this round */
+	return p;
+}
+
+/**
+ * @brief Marks a runnable lottery thread of the winner on each cpu as the
+ * thread to run this round, the first one found on a cpu is kept
+ *
+ * @param p Winning task, under rcu_read_lock()
+ */
+static void lottery_gang_assign(struct task_struct *p)
+{
+	struct task_struct *t = p;
+
+	do {
+		struct rq *rq = task_rq(t);
+
+		if (t->policy != SCHED_LOTTERY)
+			continue;
+
+		spin_lock_irq(&rq->lock);
+		if (task_rq(t) == rq && t->se.on_rq &&
+		    t->sched_class == &lottery_sched_class &&
+		    !rq->lottery_rq.gang_next) {
+			rq->lottery_rq.gang_next = t;
+			cpumask_set_cpu(cpu_of(rq), &lottery_gang.kick);
+		}
+		spin_unlock_irq(&rq->lock);
+	} while_each_thread(p, t);
+}
+
+/**
+ * @brief Ends the current round on every cpu
+ */
+static void lottery_gang_clear(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		struct rq *rq = cpu_rq(cpu);
+
+		spin_lock_irq(&rq->lock);
+		if (rq->lottery_rq.gang_next) {
+			rq->lottery_rq.gang_next = NULL;
+			cpumask_set_cpu(cpu, &lottery_gang.kick);
+		}
+		spin_unlock_irq(&rq->lock);
+	}
+}
+
+/**
+ * @brief Kicks the cpus of lottery_gang.kick, so each switches to its new
+ * gang thread or back to the lottery. resched_task() sends a reschedule IPI
+ * to remote cpus, which never waits for the target.
+ */
+static void lottery_gang_kick_cpus(void)
+{
+	int cpu;
+
+	for_each_cpu(cpu, &lottery_gang.kick) {
+		struct rq *rq = cpu_rq(cpu);
+
+		spin_lock_irq(&rq->lock);
+		if (rq->curr != rq->lottery_rq.gang_next)
+			resched_task(rq->curr);
+		spin_unlock_irq(&rq->lock);
+	}
+	cpumask_clear(&lottery_gang.kick);
+}
+
+/**
+ * @brief Runs a round in softirq context: ends the previous one, draws the
+ * winner when gang mode is on and kicks the cpus whose gang thread changed
+ */
+static void lottery_gang_round(unsigned long data)
+{
+	struct task_struct *p;
+
+	lottery_gang_clear();
+	if (lottery_gang_period()) {
+		p = lottery_gang_draw();
+		if (p) {
+			lottery_gang_assign(p);
+			rcu_read_unlock();
+		}
+	}
+	lottery_gang_kick_cpus();
+}
+
+static enum hrtimer_restart sched_lottery_gang_timer(struct hrtimer *timer)
+{
+	u64 period = lottery_gang_period();
+
+	tasklet_schedule(&lottery_gang.round);
+	if (!period)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, ns_to_ktime(period));
+	return HRTIMER_RESTART;
+}
+
+/**
+ * @brief Returns the gang thread of this cpu when it may run
+ *
+ * @param rq Pointer to the run queue
+ *
+ * @return Lottery entity of the gang thread, NULL to draw
+ */
+static struct sched_lottery_entity *lottery_gang_pick(struct rq *rq)
+{
+	struct task_struct *p = rq->lottery_rq.gang_next;
+
+	if (likely(!p))
+		return NULL;
+
+	/* Its group ran out of runtime, sit the round out */
+	if (lottery_group_throttled(rq, p)) {
+		rq->lottery_rq.gang_next = NULL;
+		return NULL;
+	}
+
+	rq->lottery_rq.nr_gang++;
+	return &p->lt;
+}
+
+static inline int lottery_gang_running(struct rq *rq)
+{
+	return rq->curr == rq->lottery_rq.gang_next;
+}
+
+/**
+ * @brief Handler for kernel.sched_lottery_gang_us, starts and stops rounds.
+ * Takes 0 or a period of LOTTERY_GANG_MIN_US up to extra2.
+ */
+int sched_lottery_gang_handler(struct ctl_table *table, int write,
+			       void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	static DEFINE_MUTEX(mutex);
+	unsigned int old_gang;
+	int ret;
+
+	mutex_lock(&mutex);
+	old_gang = sysctl_sched_lottery_gang;
+	ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+
+	if (!ret && write && sysctl_sched_lottery_gang &&
+	    sysctl_sched_lottery_gang < LOTTERY_GANG_MIN_US) {
+		sysctl_sched_lottery_gang = old_gang;
+		ret = -EINVAL;
+	}
+
+	if (!ret && write) {
+		if (sysctl_sched_lottery_gang) {
+			if (!hrtimer_active(&lottery_gang.timer))
+				hrtimer_start(&lottery_gang.timer,
+					      ns_to_ktime(lottery_gang_period()),
+					      HRTIMER_MODE_REL);
+		} else {
+			/* The round sees gang mode off and only clears */
+			hrtimer_cancel(&lottery_gang.timer);
+			tasklet_schedule(&lottery_gang.round);
+		}
+	}
+	mutex_unlock(&mutex);
+
+	return ret;
+}
+
+static void lottery_gang_reseed(u64 seed)
+{
+	u64 state = lottery_seed_state(seed, nr_cpu_ids);
+	unsigned long flags;
+
+	spin_lock_irqsave(&lottery_gang.lock, flags);
+	lottery_gang.rng = state;
+	spin_unlock_irqrestore(&lottery_gang.lock, flags);
+}
+
+static void init_lottery_gang(void)
+{
+	spin_lock_init(&lottery_gang.lock);
+	hrtimer_init(&lottery_gang.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	lottery_gang.timer.function = sched_lottery_gang_timer;
+	tasklet_init(&lottery_gang.round, lottery_gang_round, 0);
+	lottery_gang.rng = lottery_seed_state(lottery_seed, nr_cpu_ids);
+	cpumask_clear(&lottery_gang.kick);
+}
+#else
+static inline struct sched_lottery_entity *lottery_gang_pick(struct rq *rq)
+{
+	return NULL;
+}
+
+static inline int lottery_gang_running(struct rq *rq)
+{
+	return 0;
+}
+
+static inline void lottery_gang_reseed(u64 seed)
+{
+}
+
+static inline void init_lottery_gang(void)
+{
+}
+#endif /* CONFIG_SMP */
+
+/**
+ * Ticket ceilings
+ */
+
+/**
+ * @brief Ceiling on the tickets held by the SCHED_LOTTERY tasks of one user,
+ * enforced on unprivileged callers of sched_setscheduler(). 0 for none
+ */
+unsigned long sysctl_sched_lottery_user_tickets = 0;
+
+/**
+ * @brief Charges the tickets of a task to its user and task group in place
+ * of what it was charged before. The rq lock of the task serializes charges.
+ *
+ * @param p Task whose tickets are set
+ * @param tickets Tickets to charge, 0 to drop the charge
+ * @param check_group Refuse to raise the tickets above the group ceiling
+ * @param check_user Refuse to raise the tickets above the user ceiling
+ * @param old_user Set to a reference the caller drops with free_uid() once
+ * the locks are released
+ *
+ * @return 0 on success, -EPERM if a ceiling would be crossed
+ */
+static int lottery_account_tickets(struct task_struct *p,
+				   unsigned long long tickets,
+				   int check_group, int check_user,
+				   struct user_struct **old_user)
+{
+	struct sched_lottery_entity *t = &p->lt;
+	struct user_struct *up = NULL;
+	unsigned long long held;
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	struct task_group *tg = NULL;
+	unsigned long long max;
+#endif
+
+	*old_user = NULL;
+
+	/* The charge is dropped for good once the task is exiting */
+	if (p->flags & PF_EXITING)
+		tickets = 0;
+
+	rcu_read_lock();
+	if (tickets) {
+		/* Charge in full first, so racing tasks see each other */
+		up = __task_cred(p)->user;
+		held = atomic64_add_return(tickets, &up->lottery_tickets);
+		if (up == t->user)
+			held -= t->charged_tickets;
+		if (check_user && sysctl_sched_lottery_user_tickets &&
+		    held > sysctl_sched_lottery_user_tickets &&
+		    (up != t->user || tickets > t->charged_tickets))
+			goto fail_user;
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+		tg = task_group(p);
+		held = atomic64_add_return(tickets, &tg->lottery_tickets);
+		if (tg == t->tg)
+			held -= t->charged_tickets;
+		max = atomic64_read(&tg->lottery_tickets_max);
+		if (check_group && max && held > max &&
+		    (tg != t->tg || tickets > t->charged_tickets))
+			goto fail_group;
+#endif
+	}
+
+	if (t->user) {
+		atomic64_sub(t->charged_tickets, &t->user->lottery_tickets);
+		*old_user = t->user;
+	}
+	t->user = up ? get_uid(up) : NULL;
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	if (t->tg)
+		atomic64_sub(t->charged_tickets, &t->tg->lottery_tickets);
+	t->tg = tg;
+#endif
+	t->charged_tickets = tickets;
+	rcu_read_unlock();
+
+	return 0;
+
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+fail_group:
+	atomic64_sub(tickets, &tg->lottery_tickets);
+#endif
+fail_user:
+	atomic64_sub(tickets, &up->lottery_tickets);
+	rcu_read_unlock();
+
+	return -EPERM;
+}
+
+/**
+ * @brief Charges the tickets of a SCHED_LOTTERY child in sched_fork(). A child
+ * which would cross RLIMIT_LOTTERY or the ceiling of its user or task group
+ * is reset to SCHED_NORMAL, like sched_reset_on_fork does for RT tasks.
+ *
+ * @param p Child, not yet visible to anybody else
+ */
+static void lottery_fork(struct task_struct *p)
+{
+	int unprivileged = !capable(CAP_SYS_NICE);
+	struct user_struct *old_user;
+
+	if (unprivileged && p->lt.normal_tickets >
+	    current->signal->rlim[RLIMIT_LOTTERY].rlim_cur)
+		goto reset;
+
+	if (!lottery_account_tickets(p, p->lt.normal_tickets, 1,
+				     unprivileged, &old_user))
+		return;
+
+reset:
+	p->policy = SCHED_NORMAL;
+	p->rt_priority = 0;
+	p->normal_prio = p->static_prio;
+}
+
+/**
+ * @brief Drops the tickets charged for an exiting task, before it leaves its
+ * task group
+ *
+ * @param p Exiting task
+ */
+void sched_lottery_exit(struct task_struct *p)
+{
+	struct user_struct *up;
+	unsigned long flags;
+	struct rq *rq;
+
+	rq = task_rq_lock(p, &flags);
+	lottery_account_tickets(p, 0, 0, 0, &up);
+	task_rq_unlock(rq, &flags);
+
+	if (up)
+		free_uid(up);
+}
+
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+/**
+ * @brief Moves the charge of a task to its new task group, called with the
+ * rq lock held once task_group() changed
+ *
+ * @param p Task moved
+ */
+static void lottery_move_tickets(struct task_struct *p)
+{
+	struct sched_lottery_entity *t = &p->lt;
+
+	if (!t->tg)
+		return;
+
+	atomic64_sub(t->charged_tickets, &t->tg->lottery_tickets);
+	t->tg = task_group(p);
+	atomic64_add(t->charged_tickets, &t->tg->lottery_tickets);
+}
+
+/**
+ * @brief Checks that a task fits under the ticket ceiling of a group
+ *
+ * @param tg Destination group
+ * @param p Task to attach
+ *
+ * @return 1 if the task may join the group
+ */
+static int sched_lottery_can_attach(struct task_group *tg,
+				    struct task_struct *p)
+{
+	unsigned long long max = atomic64_read(&tg->lottery_tickets_max);
+
+	if (tg == p->lt.tg || !max)
+		return 1;
+
+	return atomic64_read(&tg->lottery_tickets) + p->lt.charged_tickets <=
+		max;
+}
+#endif /* CONFIG_LOTTERY_GROUP_SCHED */
+
+/**
+ * @brief Updates the start time and total run time
+ *
+ * @param rq Pointer to the run queue
+ */
+static void update_curr_lottery(struct rq* rq)
+{
+	struct task_struct *curr = rq->curr;
+	u64 delta_exec;
+
+	if (curr->sched_class != &lottery_sched_class)
+		return;
 
-	/* We dont care about equal key nodes as rotation of tree will take care
-	 * of it and removal is always directly with pointer
+	delta_exec = rq->clock - curr->se.exec_start;
+	if (unlikely((s64)delta_exec < 0))
+		delta_exec = 0;
+
+	curr->se.sum_exec_runtime += delta_exec;
+
+	curr->se.exec_start = rq->clock;
+
+	/*
+	 * Lower cpu_power like RT and add runtime scaled load, so CFS
+	 * balances and wakes up away from this cpu
 	 */
-	while (*link) {
-		parent=*link;
-		myparent = rb_entry(parent, struct sched_lottery_entity,
-				    lottery_rb_node);
-		if (myparent->tickets >= p->tickets) {
-			myparent->left_tickets += p->tickets;
-			link = &(*link)->rb_left;
-		}
-		else {
-			myparent->right_tickets += p->tickets;
-			link = &(*link)->rb_right;
-		}
-	}
-	rb_link_node(&p->lottery_rb_node, parent, link);
-	rb_insert_augmented(&p->lottery_rb_node,
-			    &rq->lottery_rb_root, &augment_callbacks);
+	sched_lottery_avg_update(rq, delta_exec);
+
+	lottery_charge(rq, curr, delta_exec);
 }
-#endif
 
 /**
  * @brief Conduct lottery for picking next suitable task
@@ -269,17 +2538,14 @@ static struct sched_lottery_entity * conduct_lottery(struct rq *trq)
 	unsigned long long lottery;
 	struct lottery_rq *rq = &trq->lottery_rq;
 	struct sched_lottery_entity *lottery_task=NULL;
-#if LOTTERY_RQ_LIST
-	struct list_head *ptr=NULL;
-	unsigned long long iterator = 0;
-#else
-	struct rb_node *node = rq->lottery_rb_root.rb_node;
-#endif
+
+	/* Nothing to draw between, the only task wins */
+	if (rq->nr_running == 1)
+		return lottery_rq_ops[rq->backend].first(rq);
 
 	if (likely(rq->max_tickets > 0)) {
-		/* Creates a random number from 1 to max_tickets */
-		get_random_bytes(&lottery, sizeof(unsigned long long));
-		lottery = lottery % (rq->max_tickets - 1) + 1;
+		/* Creates a random number from 0 to max_tickets - 1 */
+		lottery = lottery_draw(rq);
 	}
 	else {
 		/* Required as linux periodically checks by calling if any task
@@ -288,43 +2554,9 @@ static struct sched_lottery_entity * conduct_lottery(struct rq *trq)
 		return NULL;
 	}
 
-#if LOTTERY_RQ_LIST
-	/* Iterate across the list and get cumulative sum for each node.
-	 * The winner will have cumulative sum greater than lottery_ticket.
-	 */
-	list_for_each(ptr,&rq->lottery_runnable_head){
-		lottery_task=list_entry(ptr,struct sched_lottery_entity,
-					lottery_runnable_node);
-
-		iterator += lottery_task->tickets;
-
-		if (iterator > lottery) {
-			return lottery_task;
-		}
-	}
-#else
-	/* If left + curr_tickets is geq lottery_ticket then curr is winner.
-	 * If lottery_ticket is leq than left_tickets then iterate in left
-	 * direction.
-	 * If lottery_ticket is greater then left_tickets + curr_tickets then
-	 * iterate in right direction for lottery_ticket - (left_tickets +
-	 * curr_tickets).
-	 */
-	while (node) {
-		lottery_task = rb_entry(node, struct sched_lottery_entity,
-					lottery_rb_node);
-		if (lottery <= lottery_task->left_tickets)
-			node = node->rb_left;
-		else if (lottery <= (lottery_task->left_tickets +
-				     lottery_task->tickets))
-			return lottery_task;
-		else {
-			lottery -= (lottery_task->tickets +
-				    lottery_task->left_tickets);
-			node = node->rb_right;
-		}
-	}
-#endif
+	lottery_task = lottery_rq_ops[rq->backend].lookup(rq, lottery);
+	if (likely(lottery_task))
+		return lottery_task;
 
 	/* Should never hit */
 	panic("No task found in run queue for lottery scheduling");
@@ -344,6 +2576,9 @@ static void check_preempt_curr_lottery(struct rq *rq,
 				       struct task_struct *p, int flags)
 {
 	struct sched_lottery_entity *t=NULL;
+	/* The gang thread keeps the cpu against lottery tasks for the round */
+	if (p->sched_class == &lottery_sched_class && lottery_gang_running(rq))
+		return;
 	/* If more tickets then ask for resched */
 	if(p->lt.tickets > rq->curr->lt.tickets) {
 		lottery_log(LOTTERY_PREEMPT,
@@ -367,9 +2602,32 @@ static struct task_struct *pick_next_task_lottery(struct rq *rq)
 	struct sched_lottery_entity *t=NULL;
 	unsigned long long old_time = sched_clock();
 
-	t= conduct_lottery(rq);
+	/* Out of runtime for this period, let CFS run */
+	if (unlikely(rq->lottery_rq.lottery_throttled))
+		return NULL;
+
+	for (;;) {
+		/* A task past its wait bound goes first, then the thread
+		 * of the gang holding the round, else draw
+		 */
+		t = lottery_wait_overdue(rq);
+		if (likely(!t))
+			t = lottery_gang_pick(rq);
+		if (likely(!t))
+			t = conduct_lottery(rq);
+		if (likely(!t || !lottery_group_throttled(rq, t->task)))
+			break;
+		lottery_park(rq, t);
+	}
 	if(likely(t)){
-		stats.lottery_latency += sched_clock() - old_time;
+		u64 latency = sched_clock() - old_time;
+
+		rq->lottery_rq.nr_picks++;
+		rq->lottery_rq.pick_hist[min(fls64(latency),
+					     LOTTERYSTATS_HIST_BUCKETS - 1)]++;
+		lottery_wait_won(rq, t);
+		t->time_slice = t->quantum;
+		stats.lottery_latency += latency;
 		stats.lottery_iteration++;
 		t->task->se.exec_start = rq->clock;
 		lottery_log(LOTTERY_PICK_TIME,
@@ -392,13 +2650,8 @@ static void enqueue_task_lottery(struct rq *rq,
 				 struct task_struct *p, int wakeup, bool head)
 {
 	if(likely(p)){
-		rq->lottery_rq.max_tickets += p->lt.tickets;
-#if LOTTERY_RQ_LIST
-		list_add(&p->lt.lottery_runnable_node,
-			 &rq->lottery_rq.lottery_runnable_head);
-#else
-		insert_lottery_task_rb_tree(&rq->lottery_rq, &p->lt);
-#endif
+		__enqueue_lottery_entity(rq, &p->lt);
+		rq->lottery_rq.nr_enqueues++;
 		lottery_log(LOTTERY_ENQUEUE, "PID:%d with tickets %llu",
 			    p->pid,p->lt.tickets);
 
@@ -424,12 +2677,14 @@ static void dequeue_task_lottery(struct rq *rq,
 			    t->tickets);
 
 		update_curr_lottery(rq);
-#if LOTTERY_RQ_LIST
-		list_del(&(t->lottery_runnable_node));
-#else
-		remove_lottery_task_rb_tree(&rq->lottery_rq, t);
+		if (!lottery_unpark(t))
+			__dequeue_lottery_entity(rq, t);
+#ifdef CONFIG_SMP
+		if (rq->lottery_rq.gang_next == p)
+			rq->lottery_rq.gang_next = NULL;
 #endif
-		rq->lottery_rq.max_tickets -= t->tickets;
+		if (sleep)
+			t->wait_start = 0;
 
 		stats.lottery_dequeue++;
 	}
@@ -451,6 +2706,7 @@ static void put_prev_task_lottery(struct rq *rq, struct task_struct *prev)
 
 /**
  * @brief Called for every tick and re-schedules the current process every tick
+ * while it competes with other lottery tasks
  *
  * @param rq Pointer to the run queue
  * @param p NOT USED
@@ -460,12 +2716,28 @@ static void task_tick_lottery(struct rq *rq, struct task_struct *p, int queued)
 {
 	update_curr_lottery(rq);
 
+	/* Alone in the run queue: a draw could only pick it again. A task
+	 * arriving later is drawn against it from the next tick on.
+	 */
+	if (rq->lottery_rq.nr_running <= 1)
+		return;
+
+	/* The gang round decides when the gang thread stops */
+	if (lottery_gang_running(rq))
+		return;
+
+	/* Keep running until the quantum of the winner is used up */
+	if (p->lt.time_slice > 1) {
+		p->lt.time_slice--;
+		return;
+	}
+
 	lottery_log(LOTTERY_PICK_TIME, "PID: %d with %llu tickets",
 		    rq->curr->pid,
 		    rq->curr->lt.tickets);
 
-	/* Reschedule every tick, if current process is lucky then it will again
-	 * execute
+	/* Reschedule at the end of the quantum, if current process is lucky
+	 * then it will again execute
 	 */
 	resched_task(rq->curr);
 }
@@ -554,12 +2826,18 @@ static void switched_to_lottery(struct rq *rq, struct task_struct *p,
  * @param rq Pointer to the run queue
  * @param task Task for which time slice is needed
  *
- * @return HZ as each process runs for only 1 tick
+ * @return The quantum of the task in jiffies, the time it runs between
+ * draws, or 0 (no timeslice) when the task has the run queue to itself
  */
 static unsigned int get_rr_interval_lottery(struct rq *rq,
 					    struct task_struct *task)
 {
-	return HZ;
+	unsigned long others = rq->lottery_rq.nr_running;
+
+	if (task->se.on_rq && others)
+		others--;
+
+	return others ? task->lt.quantum : 0;
 }
 
 static int select_task_rq_lottery(struct rq *rq, struct task_struct *p, int sd_flag, int flags)
@@ -609,16 +2887,6 @@ static void switched_from_lottery(struct rq *rq, struct task_struct *p,
 
 }
 
-/**
- * @brief Returns the event log buffer head
- *
- * @return the head of the event log buffer
- */
-struct lottery_event_log * get_lottery_event_log(void)
-{
-	return &lottery_event_log;
-}
-
 /**
  * @brief Resets the statistics structure
  */
@@ -629,6 +2897,9 @@ void lottery_reset_stats(void) {
 	stats.lottery_dequeue = 0;
 	stats.lottery_yield = 0;
 	stats.lottery_prempt = 0;
+	stats.lottery_rq_switch = 0;
+	stats.lottery_throttle = 0;
+	stats.lottery_forced = 0;
 }
 
 /**
@@ -659,13 +2930,49 @@ void lottery_log(enum lottery_action action, char* format, ...)
 #endif
 }
 
+/**
+ * @brief Reads the state and counters of the lottery run queue of a cpu
+ *
+ * @param cpu Cpu to read
+ * @param st Where the values are stored
+ */
+void lottery_read_cpu_stats(int cpu, struct lottery_cpu_stats *st)
+{
+	struct rq *rq = cpu_rq(cpu);
+	struct lottery_rq *lt_rq = &rq->lottery_rq;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&rq->lock, flags);
+	st->nr_running = lt_rq->nr_running;
+	st->tickets = lt_rq->max_tickets;
+	st->backend = lt_rq->backend;
+	st->picks = lt_rq->nr_picks;
+	st->enqueues = lt_rq->nr_enqueues;
+	st->forced = lt_rq->nr_forced;
+	st->throttled = lt_rq->lottery_throttled;
+	st->runtime = lt_rq->lottery_time;
+	for (i = 0; i < LOTTERYSTATS_HIST_BUCKETS; i++)
+		st->pick_hist[i] = lt_rq->pick_hist[i];
+	spin_unlock_irqrestore(&rq->lock, flags);
+}
+
 /**
  * @brief Initiliazes the event log head,tail,cursor
  */
 void init_lottery_event_log(void)
 {
-	lottery_event_log.head = lottery_event_log.tail =
-		lottery_event_log.cursor = lottery_event_log.size = 0;
+	struct lottery_event_log *log;
+	unsigned int lines = LOTTERY_MAX_EVENT_LINES / nr_cpu_ids;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		log = &per_cpu(lottery_event_log, cpu);
+		spin_lock_init(&log->lock);
+		log->lottery_event = &lottery_events[cpu * lines];
+		log->head = log->tail = log->size = 0;
+		log->lines = lines;
+	}
 	lottery_log(LOTTERY_MSG, "Initialize event log for lottery scheduling");
 }
 
@@ -674,13 +2981,50 @@ void init_lottery_event_log(void)
  * @brief Initializes the run queue
  *
  * @param lottery_rq Pointer to the run queue
+ * @param cpu Cpu of the run queue, rq->cpu is not set yet
  */
-void init_lottery_rq(struct lottery_rq *lottery_rq)
+void init_lottery_rq(struct lottery_rq *lottery_rq, int cpu)
 {
-#if LOTTERY_RQ_LIST
 	INIT_LIST_HEAD(&lottery_rq->lottery_runnable_head);
-#else
 	lottery_rq->lottery_rb_root=RB_ROOT;
+	memset(lottery_rq->lottery_buckets, 0,
+	       sizeof(lottery_rq->lottery_buckets));
+	lottery_rq->lottery_bucket_map = 0;
+	lottery_rq->lottery_bucket_tasks = NULL;
+	lottery_rq->lottery_bucket_nr = 0;
+	lottery_rq->lottery_bucket_size = 0;
+	lottery_rq->lottery_array_tickets = NULL;
+	lottery_rq->lottery_array_tasks = NULL;
+	lottery_rq->lottery_array_nr = 0;
+	lottery_rq->lottery_array_size = 0;
+	lottery_rq->lottery_wait_heap = NULL;
+	lottery_rq->lottery_wait_nr = 0;
+	lottery_rq->lottery_wait_size = 0;
+	INIT_DELAYED_WORK(&lottery_rq->lottery_grow_work, lottery_rq_grow);
+	lottery_rq->lottery_grow_nr = 0;
+	lottery_rq->max_tickets = 0;
+	lottery_rq->nr_running = 0;
+	lottery_rq->nr_picks = 0;
+	lottery_rq->nr_enqueues = 0;
+	lottery_rq->nr_forced = 0;
+#ifdef CONFIG_SMP
+	lottery_rq->nr_gang = 0;
+	lottery_rq->gang_next = NULL;
+#endif
+	memset(lottery_rq->pick_hist, 0, sizeof(lottery_rq->pick_hist));
+	lottery_rq->lottery_time = 0;
+	lottery_rq->lottery_runtime = global_lottery_runtime();
+	lottery_rq->lottery_throttled = 0;
+#ifdef CONFIG_LOTTERY_GROUP_SCHED
+	INIT_LIST_HEAD(&lottery_rq->lottery_throttled_head);
+#endif
+	lottery_rq->backend = LOTTERY_RQ_BACKEND_LIST;
+	lottery_rq->backend = lottery_rq_pick_backend(lottery_rq);
+	lottery_rq->lottery_rng = lottery_seed_state(lottery_seed, cpu);
+#ifdef CONFIG_SCHED_DEBUG
+	lottery_rq->lottery_draws = NULL;
+	lottery_rq->lottery_draws_nr = 0;
+	lottery_rq->lottery_draws_pos = 0;
 #endif
 }
 
@@ -722,3 +3066,485 @@ static const struct sched_class lottery_sched_class = {
 
 	.prio_changed		= prio_changed_lottery,
 };
+
+#ifdef CONFIG_SCHED_DEBUG
+extern void print_lottery_rq(struct seq_file *m, int cpu,
+			     struct lottery_rq *lt_rq);
+
+static void print_lottery_stats(struct seq_file *m, int cpu)
+{
+	print_lottery_rq(m, cpu, &cpu_rq(cpu)->lottery_rq);
+}
+#endif /* CONFIG_SCHED_DEBUG */
+
+#ifdef CONFIG_SCHED_DEBUG
+/*
+ * debugfs interface for reproducible draws, in <debugfs>/lottery:
+ *
+ *   seed       write "<seed>" to reseed every cpu or "<cpu> <seed>" for one,
+ *              0 reseeds from the entropy pool; reading shows the state
+ *              of each cpu's generator
+ *   draw_mode  "live", "record" or "replay"
+ *   draws      "<cpu> <ticket>" per line; reading dumps the recorded
+ *              tickets, writing appends tickets to replay (truncate first)
+ */
+static DEFINE_MUTEX(lottery_draws_mutex);
+
+static const char * const lottery_draw_mode_name[] = {
+	[LOTTERY_DRAW_LIVE]	= "live",
+	[LOTTERY_DRAW_RECORD]	= "record",
+	[LOTTERY_DRAW_REPLAY]	= "replay",
+};
+
+static void lottery_reseed(int cpu, u64 seed)
+{
+	struct rq *rq = cpu_rq(cpu);
+	u64 state = lottery_seed_state(seed, cpu);
+	unsigned long flags;
+
+	spin_lock_irqsave(&rq->lock, flags);
+	rq->lottery_rq.lottery_rng = state;
+	spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+static int lottery_seed_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		seq_printf(m, "%d %Lu\n", cpu,
+			   (unsigned long long)cpu_rq(cpu)->lottery_rq.lottery_rng);
+	return 0;
+}
+
+static ssize_t lottery_seed_write(struct file *filp, const char __user *ubuf,
+				  size_t cnt, loff_t *ppos)
+{
+	char buf[64];
+	unsigned long long seed;
+	int cpu;
+
+	if (cnt > 63)
+		cnt = 63;
+
+	if (copy_from_user(&buf, ubuf, cnt))
+		return -EFAULT;
+
+	buf[cnt] = 0;
+
+	if (sscanf(buf, "%d %Lu", &cpu, &seed) == 2) {
+		if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_possible(cpu))
+			return -EINVAL;
+		lottery_reseed(cpu, seed);
+	} else if (sscanf(buf, "%Lu", &seed) == 1) {
+		lottery_seed = seed;
+		for_each_possible_cpu(cpu)
+			lottery_reseed(cpu, seed);
+		lottery_gang_reseed(seed);
+	} else {
+		return -EINVAL;
+	}
+
+	*ppos += cnt;
+
+	return cnt;
+}
+
+static int lottery_seed_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, lottery_seed_show, NULL);
+}
+
+static const struct file_operations lottery_seed_fops = {
+	.open		= lottery_seed_open,
+	.write		= lottery_seed_write,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int lottery_draw_mode_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lottery_draw_mode_name); i++) {
+		if (i == lottery_draw_mode)
+			seq_printf(m, "[%s] ", lottery_draw_mode_name[i]);
+		else
+			seq_printf(m, "%s ", lottery_draw_mode_name[i]);
+	}
+	seq_puts(m, "\n");
+
+	return 0;
+}
+
+/**
+ * @brief Allocates the per cpu draw buffers, kept once allocated so the
+ * recorded tickets can be read back after going live again
+ *
+ * @return 0 on success, -ENOMEM otherwise
+ */
+static int lottery_draws_alloc(void)
+{
+	unsigned long long *draws;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rq *rq = cpu_rq(cpu);
+		unsigned long flags;
+
+		if (rq->lottery_rq.lottery_draws)
+			continue;
+
+		draws = vmalloc(LOTTERY_MAX_DRAWS * sizeof(*draws));
+		if (!draws)
+			return -ENOMEM;
+
+		spin_lock_irqsave(&rq->lock, flags);
+		rq->lottery_rq.lottery_draws = draws;
+		rq->lottery_rq.lottery_draws_nr = 0;
+		rq->lottery_rq.lottery_draws_pos = 0;
+		spin_unlock_irqrestore(&rq->lock, flags);
+	}
+
+	return 0;
+}
+
+static ssize_t lottery_draw_mode_write(struct file *filp,
+				       const char __user *ubuf,
+				       size_t cnt, loff_t *ppos)
+{
+	char buf[64], *cmp;
+	unsigned int mode;
+	int cpu, ret = 0;
+
+	if (cnt > 63)
+		cnt = 63;
+
+	if (copy_from_user(&buf, ubuf, cnt))
+		return -EFAULT;
+
+	buf[cnt] = 0;
+	cmp = strstrip(buf);
+
+	for (mode = 0; mode < ARRAY_SIZE(lottery_draw_mode_name); mode++)
+		if (!strcmp(cmp, lottery_draw_mode_name[mode]))
+			break;
+
+	if (mode == ARRAY_SIZE(lottery_draw_mode_name))
+		return -EINVAL;
+
+	mutex_lock(&lottery_draws_mutex);
+	if (mode != LOTTERY_DRAW_LIVE)
+		ret = lottery_draws_alloc();
+	if (ret)
+		goto out;
+
+	for_each_possible_cpu(cpu) {
+		struct rq *rq = cpu_rq(cpu);
+		unsigned long flags;
+
+		spin_lock_irqsave(&rq->lock, flags);
+		if (mode == LOTTERY_DRAW_RECORD)
+			rq->lottery_rq.lottery_draws_nr = 0;
+		rq->lottery_rq.lottery_draws_pos = 0;
+		spin_unlock_irqrestore(&rq->lock, flags);
+	}
+	lottery_draw_mode = mode;
+	*ppos += cnt;
+	ret = cnt;
+out:
+	mutex_unlock(&lottery_draws_mutex);
+
+	return ret;
+}
+
+static int lottery_draw_mode_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, lottery_draw_mode_show, NULL);
+}
+
+static const struct file_operations lottery_draw_mode_fops = {
+	.open		= lottery_draw_mode_open,
+	.write		= lottery_draw_mode_write,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * The draws file iterates over (cpu, index) flattened into the position,
+ * cpu * LOTTERY_MAX_DRAWS + index, skipping the unused tail of each cpu.
+ */
+static void *lottery_draws_seek(loff_t pos)
+{
+	int cpu = pos / LOTTERY_MAX_DRAWS;
+	unsigned int idx = pos % LOTTERY_MAX_DRAWS;
+
+	for (; cpu < nr_cpu_ids; cpu++, idx = 0) {
+		struct lottery_rq *lt_rq = &cpu_rq(cpu)->lottery_rq;
+
+		if (!cpu_possible(cpu) || !lt_rq->lottery_draws)
+			continue;
+		if (idx < lt_rq->lottery_draws_nr)
+			return (void *)(unsigned long)
+				((loff_t)cpu * LOTTERY_MAX_DRAWS + idx + 1);
+	}
+	return NULL;
+}
+
+static void *lottery_draws_start(struct seq_file *m, loff_t *pos)
+{
+	void *v;
+
+	mutex_lock(&lottery_draws_mutex);
+	v = lottery_draws_seek(*pos);
+	if (v)
+		*pos = (unsigned long)v - 1;
+	return v;
+}
+
+static void *lottery_draws_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	v = lottery_draws_seek(*pos + 1);
+	if (v)
+		*pos = (unsigned long)v - 1;
+	else
+		++*pos;
+	return v;
+}
+
+static void lottery_draws_stop(struct seq_file *m, void *v)
+{
+	mutex_unlock(&lottery_draws_mutex);
+}
+
+static int lottery_draws_show(struct seq_file *m, void *v)
+{
+	unsigned long pos = (unsigned long)v - 1;
+	int cpu = pos / LOTTERY_MAX_DRAWS;
+
+	seq_printf(m, "%d %Lu\n", cpu,
+		   cpu_rq(cpu)->lottery_rq.lottery_draws[pos % LOTTERY_MAX_DRAWS]);
+	return 0;
+}
+
+static const struct seq_operations lottery_draws_seq_ops = {
+	.start	= lottery_draws_start,
+	.next	= lottery_draws_next,
+	.stop	= lottery_draws_stop,
+	.show	= lottery_draws_show,
+};
+
+/**
+ * @brief Parses a "<cpu> <ticket>" line and appends it to the cpu's buffer
+ *
+ * @param line Line without the newline
+ */
+static void lottery_draws_append(const char *line)
+{
+	unsigned long long ticket;
+	struct lottery_rq *lt_rq;
+	unsigned long flags;
+	int cpu;
+
+	if (sscanf(line, "%d %Lu", &cpu, &ticket) != 2)
+		return;
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return;
+
+	lt_rq = &cpu_rq(cpu)->lottery_rq;
+	spin_lock_irqsave(&cpu_rq(cpu)->lock, flags);
+	if (lt_rq->lottery_draws_nr < LOTTERY_MAX_DRAWS)
+		lt_rq->lottery_draws[lt_rq->lottery_draws_nr++] = ticket;
+	spin_unlock_irqrestore(&cpu_rq(cpu)->lock, flags);
+}
+
+/**
+ * @brief Appends "<cpu> <ticket>" lines to the per cpu replay buffers.
+ * Only whole lines are consumed, the caller writes the rest again.
+ */
+static ssize_t lottery_draws_write(struct file *filp, const char __user *ubuf,
+				   size_t cnt, loff_t *ppos)
+{
+	char buf[256], *line, *nl;
+	size_t done = 0;
+	int ret;
+
+	if (cnt > sizeof(buf) - 1)
+		cnt = sizeof(buf) - 1;
+
+	if (copy_from_user(&buf, ubuf, cnt))
+		return -EFAULT;
+
+	buf[cnt] = 0;
+
+	mutex_lock(&lottery_draws_mutex);
+	ret = -EBUSY;
+	if (lottery_draw_mode != LOTTERY_DRAW_LIVE)
+		goto out;
+	ret = lottery_draws_alloc();
+	if (ret)
+		goto out;
+
+	for (line = buf; (nl = strchr(line, '\n')); line = nl + 1) {
+		*nl = 0;
+		done = nl + 1 - buf;
+		lottery_draws_append(line);
+	}
+
+	/* A single line longer than the buffer is malformed */
+	ret = -EINVAL;
+	if (!done && cnt == sizeof(buf) - 1)
+		goto out;
+
+	/* Allow a last line without the trailing newline */
+	if (!done && cnt) {
+		done = cnt;
+		lottery_draws_append(buf);
+	}
+
+	*ppos += done;
+	ret = done;
+out:
+	mutex_unlock(&lottery_draws_mutex);
+
+	return ret;
+}
+
+static int lottery_draws_open(struct inode *inode, struct file *filp)
+{
+	int cpu;
+
+	if ((filp->f_mode & FMODE_WRITE) && (filp->f_flags & O_TRUNC)) {
+		mutex_lock(&lottery_draws_mutex);
+		if (lottery_draw_mode != LOTTERY_DRAW_LIVE) {
+			mutex_unlock(&lottery_draws_mutex);
+			return -EBUSY;
+		}
+		for_each_possible_cpu(cpu) {
+			struct rq *rq = cpu_rq(cpu);
+			unsigned long flags;
+
+			spin_lock_irqsave(&rq->lock, flags);
+			rq->lottery_rq.lottery_draws_nr = 0;
+			spin_unlock_irqrestore(&rq->lock, flags);
+		}
+		mutex_unlock(&lottery_draws_mutex);
+	}
+
+	if (filp->f_mode & FMODE_READ)
+		return seq_open(filp, &lottery_draws_seq_ops);
+
+	return 0;
+}
+
+static int lottery_draws_release(struct inode *inode, struct file *filp)
+{
+	if (filp->f_mode & FMODE_READ)
+		return seq_release(inode, filp);
+
+	return 0;
+}
+
+static const struct file_operations lottery_draws_fops = {
+	.open		= lottery_draws_open,
+	.write		= lottery_draws_write,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= lottery_draws_release,
+};
+
+#endif /* CONFIG_SCHED_DEBUG */
+
+/*
+ * Event streaming in <debugfs>/lottery: writing 1 to event_stream opens
+ * a relay channel with one event<cpu> file per cpu, carrying the lines
+ * of the event log as they are logged. The files support read(), mmap()
+ * and poll(); writing 0 closes the channel once the readers are gone.
+ */
+#define LOTTERY_RELAY_SUBBUF_SIZE	(16 * 1024)
+#define LOTTERY_RELAY_N_SUBBUFS		8
+
+static struct dentry *lottery_debugfs_dir;
+static DEFINE_MUTEX(lottery_relay_mutex);
+
+static struct dentry *lottery_relay_create_buf_file(const char *filename,
+						    struct dentry *parent,
+						    int mode,
+						    struct rchan_buf *buf,
+						    int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf,
+				   &relay_file_operations);
+}
+
+static int lottery_relay_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+	return 0;
+}
+
+static struct rchan_callbacks lottery_relay_callbacks = {
+	.create_buf_file	= lottery_relay_create_buf_file,
+	.remove_buf_file	= lottery_relay_remove_buf_file,
+};
+
+static int lottery_event_stream_get(void *data, u64 *val)
+{
+	*val = lottery_relay_chan != NULL;
+	return 0;
+}
+
+static int lottery_event_stream_set(void *data, u64 val)
+{
+	struct rchan *chan;
+	int ret = 0;
+
+	mutex_lock(&lottery_relay_mutex);
+	if (val && !lottery_relay_chan) {
+		chan = relay_open("event", lottery_debugfs_dir,
+				  LOTTERY_RELAY_SUBBUF_SIZE,
+				  LOTTERY_RELAY_N_SUBBUFS,
+				  &lottery_relay_callbacks, NULL);
+		if (chan)
+			rcu_assign_pointer(lottery_relay_chan, chan);
+		else
+			ret = -ENOMEM;
+	} else if (!val && lottery_relay_chan) {
+		chan = lottery_relay_chan;
+		rcu_assign_pointer(lottery_relay_chan, NULL);
+		/* Wait for the writers still using the channel */
+		synchronize_sched();
+		relay_flush(chan);
+		relay_close(chan);
+	}
+	mutex_unlock(&lottery_relay_mutex);
+
+	return ret;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(lottery_event_stream_fops, lottery_event_stream_get,
+			lottery_event_stream_set, "%llu\n");
+
+static __init int sched_lottery_init_debug(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("lottery", NULL);
+	if (!dir || IS_ERR(dir))
+		return 0;
+	lottery_debugfs_dir = dir;
+
+	debugfs_create_file("event_stream", 0644, dir, NULL,
+			    &lottery_event_stream_fops);
+#ifdef CONFIG_SCHED_DEBUG
+	debugfs_create_file("seed", 0644, dir, NULL, &lottery_seed_fops);
+	debugfs_create_file("draw_mode", 0644, dir, NULL,
+			    &lottery_draw_mode_fops);
+	debugfs_create_file("draws", 0644, dir, NULL, &lottery_draws_fops);
+#endif
+
+	return 0;
+}
+late_initcall(sched_lottery_init_debug);
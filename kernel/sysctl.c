@@ -94,6 +94,9 @@ extern int rcutorture_runnable;
 #ifdef CONFIG_BLOCK
 extern int blk_iopoll_enabled;
 #endif
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR
+extern int sysctl_memcg_lottery_reclaim;
+#endif
 
 /* Constants used for minimum and  maximum */
 #ifdef CONFIG_DETECT_SOFTLOCKUP
@@ -250,6 +253,14 @@ static int min_wakeup_granularity_ns;			/* 0 usecs */
 static int max_wakeup_granularity_ns = NSEC_PER_SEC;	/* 1 second */
 #endif
 
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+static int lottery_rq_backend_max = LOTTERY_NR_RQ_BACKENDS - 1;
+static int max_lottery_wait_factor = 1000;
+#ifdef CONFIG_SMP
+static int max_lottery_gang_us = USEC_PER_SEC;		/* 1 second */
+#endif
+#endif
+
 static struct ctl_table kern_table[] = {
 	{
 		.ctl_name	= CTL_UNNUMBERED,
@@ -371,6 +382,73 @@ static struct ctl_table kern_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &sched_rt_handler,
 	},
+#ifdef CONFIG_SCHED_LOTTERY_POLICY
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "sched_lottery_rq_backend",
+		.data		= &sysctl_sched_lottery_rq_backend,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= &sched_lottery_rq_handler,
+		.extra1		= &zero,
+		.extra2		= &lottery_rq_backend_max,
+	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "sched_lottery_adaptive_nr",
+		.data		= &sysctl_sched_lottery_adaptive_nr,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= &sched_lottery_rq_handler,
+		.extra1		= &one,
+	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "sched_lottery_period_us",
+		.data		= &sysctl_sched_lottery_period,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= &sched_lottery_handler,
+	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "sched_lottery_runtime_us",
+		.data		= &sysctl_sched_lottery_runtime,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &sched_lottery_handler,
+	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "sched_lottery_wait_factor",
+		.data		= &sysctl_sched_lottery_wait_factor,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &max_lottery_wait_factor,
+	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "sched_lottery_user_tickets",
+		.data		= &sysctl_sched_lottery_user_tickets,
+		.maxlen		= sizeof(unsigned long),
+		.mode		= 0644,
+		.proc_handler	= &proc_doulongvec_minmax,
+	},
+#ifdef CONFIG_SMP
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "sched_lottery_gang_us",
+		.data		= &sysctl_sched_lottery_gang,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= &sched_lottery_gang_handler,
+		.extra1		= &zero,
+		.extra2		= &max_lottery_gang_us,
+	},
+#endif
+#endif
 	{
 		.ctl_name	= CTL_UNNUMBERED,
 		.procname	= "sched_compat_yield",
@@ -1163,6 +1241,19 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &zero,
 		.extra2		= &one_hundred,
 	},
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "memcg_lottery_reclaim",
+		.data		= &sysctl_memcg_lottery_reclaim,
+		.maxlen		= sizeof(sysctl_memcg_lottery_reclaim),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
 #ifdef CONFIG_HUGETLB_PAGE
 	 {
 		.procname	= "nr_hugepages",
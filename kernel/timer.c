@@ -71,12 +71,26 @@ struct tvec_root {
 	struct list_head vec[TVR_SIZE];
 };
 
+/*
+ * Cascading a whole tv2 bucket into tv1 every TVR_SIZE ticks walks every
+ * timer due in the next window at once.  Instead, while a window runs,
+ * the bucket of the next window is drained a batch per tick: timers
+ * whose tv1 slot has already been run this window go straight to tv1,
+ * the others wait in tv1_next and are spliced into tv1 right after
+ * their slot has been run.  Whatever is left at the window boundary is
+ * cascaded the old way, and the batch grows so that next time it isn't.
+ */
+#define CASCADE_BATCH_MIN	16
+#define CASCADE_BATCH_MAX	1024
+
 struct tvec_base {
 	spinlock_t lock;
 	struct timer_list *running_timer;
 	unsigned long timer_jiffies;
 	unsigned long next_timer;
+	int cascade_batch;
 	struct tvec_root tv1;
+	struct tvec_root tv1_next;
 	struct tvec tv2;
 	struct tvec tv3;
 	struct tvec tv4;
@@ -549,6 +563,7 @@ static void __init_timer(struct timer_list *timer,
 {
 	timer->entry.next = NULL;
 	timer->base = __raw_get_cpu_var(tvec_bases);
+	timer->slack = -1;
 #ifdef CONFIG_TIMER_STATS
 	timer->start_site = NULL;
 	timer->start_pid = -1;
@@ -716,6 +731,49 @@ int mod_timer_pending(struct timer_list *timer, unsigned long expires)
 }
 EXPORT_SYMBOL(mod_timer_pending);
 
+/*
+ * Decide where to put the timer while taking the slack into account
+ *
+ * Algorithm:
+ *   1) calculate the maximum (absolute) time
+ *   2) calculate the highest bit where the expires and new max are different
+ *   3) use this bit to make a mask
+ *   4) use the bitmask to round down the maximum time, so that all last
+ *      bits are zeros
+ *
+ * Timers whose windows overlap thus tend to end up on the same jiffy and
+ * fire from one tv1 bucket, instead of one wakeup each.
+ */
+static inline
+unsigned long apply_slack(struct timer_list *timer, unsigned long expires)
+{
+	unsigned long expires_limit, mask;
+	int bit;
+
+	expires_limit = expires;
+
+	if (timer->slack >= 0) {
+		expires_limit = expires + timer->slack;
+	} else {
+		unsigned long now = jiffies;
+
+		/* No slack, if already expired else auto slack 0.4% */
+		if (time_after(expires, now))
+			expires_limit = expires + (expires - now)/256;
+	}
+	mask = expires ^ expires_limit;
+	if (mask == 0)
+		return expires;
+
+	bit = find_last_bit(&mask, BITS_PER_LONG);
+
+	mask = (1UL << bit) - 1;
+
+	expires_limit = expires_limit & ~(mask);
+
+	return expires_limit;
+}
+
 /**
  * mod_timer - modify a timer's timeout
  * @timer: the timer to be modified
@@ -738,6 +796,8 @@ EXPORT_SYMBOL(mod_timer_pending);
  */
 int mod_timer(struct timer_list *timer, unsigned long expires)
 {
+	expires = apply_slack(timer, expires);
+
 	/*
 	 * This is a common optimization triggered by the
 	 * networking code - if the timer is re-modified
@@ -772,6 +832,25 @@ int mod_timer_pinned(struct timer_list *timer, unsigned long expires)
 }
 EXPORT_SYMBOL(mod_timer_pinned);
 
+/**
+ * set_timer_slack - set the allowed slack for a timer
+ * @timer: the timer to be modified
+ * @slack_hz: the amount of time (in jiffies) allowed for rounding
+ *
+ * Set the amount of time, in jiffies, that a certain timer has
+ * in terms of slack. By setting this value, the timer subsystem
+ * will schedule the actual timer somewhere between
+ * the time mod_timer() asks for, and that time plus the slack.
+ *
+ * By setting the slack to -1, a percentage of the delay is used
+ * instead.
+ */
+void set_timer_slack(struct timer_list *timer, int slack_hz)
+{
+	timer->slack = slack_hz;
+}
+EXPORT_SYMBOL_GPL(set_timer_slack);
+
 /**
  * add_timer - start a timer
  * @timer: the timer to be added
@@ -957,6 +1036,51 @@ static int cascade(struct tvec_base *base, struct tvec *tv, int index)
 
 #define INDEX(N) ((base->timer_jiffies >> (TVR_BITS + (N) * TVN_BITS)) & TVN_MASK)
 
+/*
+ * Pull up to ->cascade_batch timers out of the tv2 bucket of the next
+ * window, see the comment above struct tvec_base.  Called right after a
+ * tv1 slot was run and ->timer_jiffies advanced past it.
+ */
+static void cascade_ahead(struct tvec_base *base)
+{
+	unsigned long window = (base->timer_jiffies - 1) >> TVR_BITS;
+	struct list_head *head = base->tv2.vec + ((window + 1) & TVN_MASK);
+	struct timer_list *timer;
+	int n = base->cascade_batch;
+
+	while (n-- && !list_empty(head)) {
+		unsigned long expires;
+
+		timer = list_first_entry(head, struct timer_list, entry);
+		BUG_ON(tbase_get_base(timer->base) != base);
+		expires = timer->expires;
+
+		if (expires - base->timer_jiffies < TVR_SIZE)
+			list_move_tail(&timer->entry,
+				       base->tv1.vec + (expires & TVR_MASK));
+		else if (expires - base->timer_jiffies < 2 * TVR_SIZE)
+			list_move_tail(&timer->entry,
+				       base->tv1_next.vec + (expires & TVR_MASK));
+		else
+			/* not for the next window after all, leave it be */
+			list_move_tail(&timer->entry, head);
+	}
+}
+
+/*
+ * Adapt the batch of cascade_ahead() to what it left behind in the
+ * bucket of the window that is just starting.
+ */
+static void cascade_adjust(struct tvec_base *base)
+{
+	if (!list_empty(base->tv2.vec + INDEX(0)))
+		base->cascade_batch = min(base->cascade_batch * 2,
+					  CASCADE_BATCH_MAX);
+	else
+		base->cascade_batch = max(base->cascade_batch / 2,
+					  CASCADE_BATCH_MIN);
+}
+
 /**
  * __run_timers - run all expired timers (if any) on this CPU.
  * @base: the timer vector to be processed.
@@ -975,8 +1099,11 @@ static inline void __run_timers(struct tvec_base *base)
 		int index = base->timer_jiffies & TVR_MASK;
 
 		/*
-		 * Cascade timers:
+		 * Cascade timers, normally only the few that
+		 * cascade_ahead() didn't get to are left in tv2:
 		 */
+		if (!index)
+			cascade_adjust(base);
 		if (!index &&
 			(!cascade(base, &base->tv2, INDEX(0))) &&
 				(!cascade(base, &base->tv3, INDEX(1))) &&
@@ -984,6 +1111,9 @@ static inline void __run_timers(struct tvec_base *base)
 			cascade(base, &base->tv5, INDEX(3));
 		++base->timer_jiffies;
 		list_replace_init(base->tv1.vec + index, &work_list);
+		list_splice_tail_init(base->tv1_next.vec + index,
+				      base->tv1.vec + index);
+		cascade_ahead(base);
 		while (!list_empty(head)) {
 			void (*fn)(unsigned long);
 			unsigned long data;
@@ -1076,6 +1206,18 @@ static unsigned long __next_timer_interrupt(struct tvec_base *base)
 	} while (slot != index);
 
 cascade:
+	/* Timers cascade_ahead() already took out of tv2 */
+	for (slot = 0; slot < TVR_SIZE; slot++) {
+		list_for_each_entry(nte, base->tv1_next.vec + slot, entry) {
+			if (tbase_get_deferrable(nte->base))
+				continue;
+
+			found = 1;
+			if (time_before(nte->expires, expires))
+				expires = nte->expires;
+		}
+	}
+
 	/* Calculate the next cascade event */
 	if (index)
 		timer_jiffies += TVR_SIZE - index;
@@ -1560,11 +1702,14 @@ static int __cpuinit init_timers_cpu(int cpu)
 		INIT_LIST_HEAD(base->tv3.vec + j);
 		INIT_LIST_HEAD(base->tv2.vec + j);
 	}
-	for (j = 0; j < TVR_SIZE; j++)
+	for (j = 0; j < TVR_SIZE; j++) {
 		INIT_LIST_HEAD(base->tv1.vec + j);
+		INIT_LIST_HEAD(base->tv1_next.vec + j);
+	}
 
 	base->timer_jiffies = jiffies;
 	base->next_timer = base->timer_jiffies;
+	base->cascade_batch = CASCADE_BATCH_MIN;
 	return 0;
 }
 
@@ -1602,8 +1747,10 @@ static void __cpuinit migrate_timers(int cpu)
 
 	BUG_ON(old_base->running_timer);
 
-	for (i = 0; i < TVR_SIZE; i++)
+	for (i = 0; i < TVR_SIZE; i++) {
 		migrate_timer_list(new_base, old_base->tv1.vec + i);
+		migrate_timer_list(new_base, old_base->tv1_next.vec + i);
+	}
 	for (i = 0; i < TVN_SIZE; i++) {
 		migrate_timer_list(new_base, old_base->tv2.vec + i);
 		migrate_timer_list(new_base, old_base->tv3.vec + i);
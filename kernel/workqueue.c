@@ -36,6 +36,70 @@
 #define CREATE_TRACE_POINTS
 #include <trace/events/workqueue.h>
 
+#include "workqueue_sched.h"
+
+/*
+ * Workqueues which are neither single threaded, freezeable nor rt don't
+ * own any threads.  Their per-CPU queues are fed to a per-CPU pool of
+ * workers instead: a worker takes a cwq off pool->worklist, runs one
+ * work from it and puts it back at the tail if it has more.  Only one
+ * worker runs a given cwq at a time, so works queued on one cwq still
+ * execute in order and ->current_work means what flush and cancel
+ * expect it to mean.
+ *
+ * The scheduler tells us when a busy worker blocks and when it is woken
+ * up.  ->nr_running counts the busy workers which are runnable; when
+ * it drops to zero while cwqs are waiting, an idle worker is woken so a
+ * work that sleeps doesn't stall the other workqueues on its CPU.  The
+ * last idle worker to go busy creates a replacement before it runs
+ * anything, so there is always somebody to wake.
+ *
+ * Creating a worker allocates memory and may block, so it can't be what
+ * works on the reclaim path wait for.  Each pooled workqueue has a
+ * rescuer thread of its own.  If a pool's busy workers are all blocked
+ * with no idle worker left and cwqs are still waiting after
+ * MAYDAY_INITIAL_TIMEOUT, the pool asks the rescuers of those cwqs'
+ * workqueues to run them, and asks again every MAYDAY_INTERVAL while it
+ * stays stuck.
+ */
+#define MAX_IDLE_WORKERS	2
+#define IDLE_WORKER_TIMEOUT	(300 * HZ)
+#define MAYDAY_INITIAL_TIMEOUT	(HZ / 100 >= 2 ? HZ / 100 : 2)
+#define MAYDAY_INTERVAL		(HZ / 10)
+
+struct worker_pool {
+	spinlock_t lock;
+	int cpu;
+	int dead;			/* CPU is gone, no new workers */
+
+	struct list_head worklist;	/* cwqs with pending works */
+	struct list_head idle_list;	/* idle workers, most recent first */
+	struct list_head workers;	/* all workers */
+
+	int nr_workers;
+	int nr_idle;
+	atomic_t nr_running;		/* busy workers not blocked */
+	int next_id;			/* for worker names */
+
+	struct timer_list mayday_timer;	/* calls the rescuers when stuck */
+} ____cacheline_aligned;
+
+struct worker {
+	struct list_head entry;		/* on pool->idle_list */
+	struct list_head node;		/* on pool->workers */
+	struct task_struct *task;
+	struct worker_pool *pool;
+	unsigned long last_active;	/* jiffies when it went idle */
+
+	/* only changed by the worker itself */
+	unsigned int idle:1;
+
+	/* set by the worker, cleared under the rq lock by whoever wakes it */
+	int sleeping;
+};
+
+static DEFINE_PER_CPU(struct worker_pool, worker_pools);
+
 /*
  * The per-CPU workqueue (if single thread, we always use the first
  * possible cpu).
@@ -49,7 +113,12 @@ struct cpu_workqueue_struct {
 	struct work_struct *current_work;
 
 	struct workqueue_struct *wq;
-	struct task_struct *thread;
+	struct task_struct *thread;	/* for pooled cwqs: the worker running it */
+
+	struct worker_pool *pool;	/* NULL if we have our own thread */
+	struct list_head pool_entry;	/* on pool->worklist, under pool->lock */
+	struct worker *worker;		/* under pool->lock */
+	int mayday;			/* rescuer asked for, under pool->lock */
 } ____cacheline_aligned;
 
 /*
@@ -63,6 +132,7 @@ struct workqueue_struct {
 	int singlethread;
 	int freezeable;		/* Freeze threads during suspend */
 	int rt;
+	struct worker *rescuer;	/* pooled only: runs cwqs of a stuck pool */
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map lockdep_map;
 #endif
@@ -89,6 +159,11 @@ static inline int is_wq_single_threaded(struct workqueue_struct *wq)
 	return wq->singlethread;
 }
 
+static inline int is_wq_pooled(struct workqueue_struct *wq)
+{
+	return !wq->singlethread && !wq->freezeable && !wq->rt;
+}
+
 static const struct cpumask *wq_cpu_map(struct workqueue_struct *wq)
 {
 	return is_wq_single_threaded(wq)
@@ -125,10 +200,54 @@ struct cpu_workqueue_struct *get_wq_data(struct work_struct *work)
 	return (void *) (atomic_long_read(&work->data) & WORK_STRUCT_WQ_DATA_MASK);
 }
 
+/* Must be called with pool->lock held */
+static void wake_up_worker(struct worker_pool *pool)
+{
+	struct worker *worker;
+
+	if (list_empty(&pool->idle_list))
+		return;
+	worker = list_first_entry(&pool->idle_list, struct worker, entry);
+	wake_up_process(worker->task);
+}
+
+/*
+ * No busy worker of @pool is runnable and cwqs are waiting: wake an idle
+ * worker, or have the rescuers called if none is left.  A pool whose CPU
+ * isn't online yet has no started worker; the first one runs the cwqs
+ * once it is.  Must be called with pool->lock held.
+ */
+static void pool_need_worker(struct worker_pool *pool)
+{
+	if (!list_empty(&pool->idle_list))
+		wake_up_worker(pool);
+	else if (pool->nr_workers && !timer_pending(&pool->mayday_timer))
+		mod_timer(&pool->mayday_timer,
+			  jiffies + MAYDAY_INITIAL_TIMEOUT);
+}
+
+/*
+ * Make sure a pool worker will get to @cwq.  Must be called with
+ * cwq->lock held.
+ */
+static void pool_kick_cwq(struct cpu_workqueue_struct *cwq)
+{
+	struct worker_pool *pool = cwq->pool;
+
+	spin_lock(&pool->lock);
+	if (!cwq->worker && list_empty(&cwq->pool_entry)) {
+		list_add_tail(&cwq->pool_entry, &pool->worklist);
+		if (!atomic_read(&pool->nr_running))
+			pool_need_worker(pool);
+	}
+	spin_unlock(&pool->lock);
+}
+
 static void insert_work(struct cpu_workqueue_struct *cwq,
 			struct work_struct *work, struct list_head *head)
 {
-	trace_workqueue_insertion(cwq->thread, work);
+	if (cwq->thread)
+		trace_workqueue_insertion(cwq->thread, work);
 
 	set_wq_data(work, cwq);
 	/*
@@ -137,7 +256,10 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 	 */
 	smp_wmb();
 	list_add_tail(&work->entry, head);
-	wake_up(&cwq->more_work);
+	if (cwq->pool)
+		pool_kick_cwq(cwq);
+	else
+		wake_up(&cwq->more_work);
 }
 
 static void __queue_work(struct cpu_workqueue_struct *cwq,
@@ -261,51 +383,59 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 }
 EXPORT_SYMBOL_GPL(queue_delayed_work_on);
 
-static void run_workqueue(struct cpu_workqueue_struct *cwq)
+/*
+ * Run the first work on @cwq->worklist.  Called and returns with
+ * cwq->lock held and interrupts disabled.
+ */
+static void run_one_work(struct cpu_workqueue_struct *cwq)
 {
-	spin_lock_irq(&cwq->lock);
-	while (!list_empty(&cwq->worklist)) {
-		struct work_struct *work = list_entry(cwq->worklist.next,
-						struct work_struct, entry);
-		work_func_t f = work->func;
+	struct work_struct *work = list_entry(cwq->worklist.next,
+					struct work_struct, entry);
+	work_func_t f = work->func;
 #ifdef CONFIG_LOCKDEP
-		/*
-		 * It is permissible to free the struct work_struct
-		 * from inside the function that is called from it,
-		 * this we need to take into account for lockdep too.
-		 * To avoid bogus "held lock freed" warnings as well
-		 * as problems when looking into work->lockdep_map,
-		 * make a copy and use that here.
-		 */
-		struct lockdep_map lockdep_map = work->lockdep_map;
+	/*
+	 * It is permissible to free the struct work_struct
+	 * from inside the function that is called from it,
+	 * this we need to take into account for lockdep too.
+	 * To avoid bogus "held lock freed" warnings as well
+	 * as problems when looking into work->lockdep_map,
+	 * make a copy and use that here.
+	 */
+	struct lockdep_map lockdep_map = work->lockdep_map;
 #endif
-		trace_workqueue_execution(cwq->thread, work);
-		cwq->current_work = work;
-		list_del_init(cwq->worklist.next);
-		spin_unlock_irq(&cwq->lock);
-
-		BUG_ON(get_wq_data(work) != cwq);
-		work_clear_pending(work);
-		lock_map_acquire(&cwq->wq->lockdep_map);
-		lock_map_acquire(&lockdep_map);
-		f(work);
-		lock_map_release(&lockdep_map);
-		lock_map_release(&cwq->wq->lockdep_map);
+	trace_workqueue_execution(cwq->thread, work);
+	cwq->current_work = work;
+	list_del_init(cwq->worklist.next);
+	spin_unlock_irq(&cwq->lock);
 
-		if (unlikely(in_atomic() || lockdep_depth(current) > 0)) {
-			printk(KERN_ERR "BUG: workqueue leaked lock or atomic: "
-					"%s/0x%08x/%d\n",
-					current->comm, preempt_count(),
-				       	task_pid_nr(current));
-			printk(KERN_ERR "    last function: ");
-			print_symbol("%s\n", (unsigned long)f);
-			debug_show_held_locks(current);
-			dump_stack();
-		}
+	BUG_ON(get_wq_data(work) != cwq);
+	work_clear_pending(work);
+	lock_map_acquire(&cwq->wq->lockdep_map);
+	lock_map_acquire(&lockdep_map);
+	f(work);
+	lock_map_release(&lockdep_map);
+	lock_map_release(&cwq->wq->lockdep_map);
 
-		spin_lock_irq(&cwq->lock);
-		cwq->current_work = NULL;
+	if (unlikely(in_atomic() || lockdep_depth(current) > 0)) {
+		printk(KERN_ERR "BUG: workqueue leaked lock or atomic: "
+				"%s/0x%08x/%d\n",
+				current->comm, preempt_count(),
+			       	task_pid_nr(current));
+		printk(KERN_ERR "    last function: ");
+		print_symbol("%s\n", (unsigned long)f);
+		debug_show_held_locks(current);
+		dump_stack();
 	}
+
+	spin_lock_irq(&cwq->lock);
+	cwq->current_work = NULL;
+}
+
+static void run_workqueue(struct cpu_workqueue_struct *cwq)
+{
+	spin_lock_irq(&cwq->lock);
+	while (!list_empty(&cwq->worklist))
+		run_one_work(cwq);
 	spin_unlock_irq(&cwq->lock);
 }
 
@@ -336,6 +466,383 @@ static int worker_thread(void *__cwq)
 	return 0;
 }
 
+/* The two below must be called with pool->lock held, by the worker itself */
+static void worker_enter_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	if (worker->idle)
+		return;
+	worker->idle = 1;
+	worker->last_active = jiffies;
+	atomic_dec(&pool->nr_running);
+	pool->nr_idle++;
+	list_add(&worker->entry, &pool->idle_list);
+}
+
+static void worker_leave_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	if (!worker->idle)
+		return;
+	worker->idle = 0;
+	pool->nr_idle--;
+	atomic_inc(&pool->nr_running);
+	list_del_init(&worker->entry);
+}
+
+/**
+ * wq_worker_sleeping - a pool worker is going to sleep
+ * @task: the worker, which is current
+ *
+ * Called from schedule() before @task is dequeued.  If it was the last
+ * runnable busy worker of its pool and cwqs are waiting, wake an idle
+ * worker to take them, or call the rescuers if there is none.
+ */
+void wq_worker_sleeping(struct task_struct *task)
+{
+	struct worker *worker = kthread_data(task);
+	struct worker_pool *pool = worker->pool;
+	unsigned long flags;
+
+	if (worker->idle || worker->sleeping)
+		return;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	worker->sleeping = 1;
+	if (atomic_dec_and_test(&pool->nr_running) &&
+	    !list_empty(&pool->worklist))
+		pool_need_worker(pool);
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+/**
+ * wq_worker_waking_up - a pool worker is runnable again
+ * @task: the worker
+ *
+ * Called with the rq lock of @task held, by try_to_wake_up() when it
+ * activates @task, or by schedule() when @task was woken before it got
+ * dequeued.  pool->lock nests outside rq locks, so only the atomic count
+ * is touched here.
+ */
+void wq_worker_waking_up(struct task_struct *task)
+{
+	struct worker *worker = kthread_data(task);
+
+	if (!worker->sleeping)
+		return;
+
+	worker->sleeping = 0;
+	atomic_inc(&worker->pool->nr_running);
+}
+
+/* Must be called with pool->lock held */
+static void send_mayday(struct cpu_workqueue_struct *cwq)
+{
+	if (cwq->mayday)
+		return;
+	cwq->mayday = 1;
+	wake_up_process(cwq->wq->rescuer->task);
+}
+
+/*
+ * Nobody runs the waiting cwqs of @pool and no worker is left to wake:
+ * the one creating a spare, if any, is blocked.  Call the rescuers.
+ */
+static void pool_mayday_timeout(unsigned long __pool)
+{
+	struct worker_pool *pool = (void *)__pool;
+	struct cpu_workqueue_struct *cwq;
+
+	spin_lock_irq(&pool->lock);
+	if (pool->nr_workers && !atomic_read(&pool->nr_running) &&
+	    !pool->nr_idle && !list_empty(&pool->worklist)) {
+		list_for_each_entry(cwq, &pool->worklist, pool_entry)
+			send_mayday(cwq);
+		mod_timer(&pool->mayday_timer, jiffies + MAYDAY_INTERVAL);
+	}
+	spin_unlock_irq(&pool->lock);
+}
+
+static int pool_worker_thread(void *__worker);
+
+/*
+ * Put @worker on the idle list and wake it up.  Workers are bound before
+ * they are published, so nobody wakes one up on the wrong CPU.  Must be
+ * called with pool->lock held, so destroy_pool_workers() can't free
+ * @worker under us.
+ */
+static void start_worker(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	worker->last_active = jiffies;
+	list_add(&worker->entry, &pool->idle_list);
+	pool->nr_workers++;
+	pool->nr_idle++;
+	wake_up_process(worker->task);
+}
+
+/*
+ * Create a worker for @pool, bound to its CPU.  With @start it is started
+ * right away, otherwise it waits for start_worker_pool().  Returns NULL on
+ * failure or if the pool's CPU went away meanwhile.
+ */
+static struct worker *create_worker(struct worker_pool *pool, int start)
+{
+	struct worker *worker;
+	int id;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return NULL;
+
+	INIT_LIST_HEAD(&worker->entry);
+	INIT_LIST_HEAD(&worker->node);
+	worker->pool = pool;
+	worker->idle = 1;
+
+	spin_lock_irq(&pool->lock);
+	id = pool->next_id++;
+	spin_unlock_irq(&pool->lock);
+
+	worker->task = kthread_create(pool_worker_thread, worker,
+				      "kworker/%d:%d", pool->cpu, id);
+	if (IS_ERR(worker->task)) {
+		kfree(worker);
+		return NULL;
+	}
+	kthread_bind(worker->task, pool->cpu);
+	trace_workqueue_creation(worker->task, pool->cpu);
+
+	spin_lock_irq(&pool->lock);
+	if (pool->dead) {
+		spin_unlock_irq(&pool->lock);
+		kthread_stop(worker->task);
+		kfree(worker);
+		return NULL;
+	}
+	list_add_tail(&worker->node, &pool->workers);
+	if (start)
+		start_worker(worker);
+	spin_unlock_irq(&pool->lock);
+
+	return worker;
+}
+
+/*
+ * Detach and stop every worker of @pool.  The pooled cwqs of its CPU
+ * must have been flushed already.
+ */
+static void destroy_pool_workers(struct worker_pool *pool)
+{
+	struct worker *worker;
+
+	spin_lock_irq(&pool->lock);
+	pool->dead = 1;
+	while (!list_empty(&pool->workers)) {
+		worker = list_first_entry(&pool->workers, struct worker, node);
+		list_del_init(&worker->node);
+		list_del_init(&worker->entry);
+		spin_unlock_irq(&pool->lock);
+
+		trace_workqueue_destruction(worker->task);
+		kthread_stop(worker->task);
+		kfree(worker);
+
+		spin_lock_irq(&pool->lock);
+	}
+	spin_unlock_irq(&pool->lock);
+
+	del_timer_sync(&pool->mayday_timer);
+}
+
+static int pooled_cwq_busy(struct cpu_workqueue_struct *cwq)
+{
+	struct worker_pool *pool = cwq->pool;
+	int busy;
+
+	spin_lock_irq(&cwq->lock);
+	spin_lock(&pool->lock);
+	busy = cwq->worker || !list_empty(&cwq->pool_entry);
+	spin_unlock(&pool->lock);
+	spin_unlock_irq(&cwq->lock);
+
+	return busy;
+}
+
+/*
+ * Wait until no worker holds @cwq any more: after a flush, the worker
+ * which ran the barrier may still be putting the cwq back.  Pooled cwqs
+ * have no thread sleeping on ->more_work, so it is used to wait for
+ * that, see release_pooled_cwq().
+ */
+static void wait_on_pooled_cwq(struct cpu_workqueue_struct *cwq)
+{
+	wait_event(cwq->more_work, !pooled_cwq_busy(cwq));
+}
+
+/*
+ * A worker or the rescuer is done with @cwq.  Must be called with
+ * cwq->lock held, which wait_on_pooled_cwq() checks ->worker under.
+ */
+static void release_pooled_cwq(struct cpu_workqueue_struct *cwq)
+{
+	cwq->worker = NULL;
+	if (waitqueue_active(&cwq->more_work))
+		wake_up(&cwq->more_work);
+}
+
+static int pool_worker_thread(void *__worker)
+{
+	struct worker *worker = __worker;
+	struct worker_pool *pool = worker->pool;
+	struct cpu_workqueue_struct *cwq;
+
+	current->flags |= PF_WQ_WORKER;
+
+	spin_lock_irq(&pool->lock);
+	for (;;) {
+		/* detached by destroy_pool_workers() */
+		if (list_empty(&worker->node))
+			break;
+
+		if (list_empty(&pool->worklist)) {
+			if (worker->idle && pool->nr_idle > MAX_IDLE_WORKERS &&
+			    time_after_eq(jiffies, worker->last_active +
+					  IDLE_WORKER_TIMEOUT)) {
+				list_del_init(&worker->node);
+				list_del_init(&worker->entry);
+				pool->nr_workers--;
+				pool->nr_idle--;
+				spin_unlock_irq(&pool->lock);
+
+				current->flags &= ~PF_WQ_WORKER;
+				trace_workqueue_destruction(current);
+				kfree(worker);
+				return 0;
+			}
+			worker_enter_idle(worker);
+			__set_current_state(TASK_INTERRUPTIBLE);
+			spin_unlock_irq(&pool->lock);
+			schedule_timeout(IDLE_WORKER_TIMEOUT);
+			spin_lock_irq(&pool->lock);
+			continue;
+		}
+
+		worker_leave_idle(worker);
+		if (!pool->nr_idle && !pool->dead) {
+			struct worker *spare;
+
+			spin_unlock_irq(&pool->lock);
+			spare = create_worker(pool, 1);
+			spin_lock_irq(&pool->lock);
+			if (spare || list_empty(&pool->worklist))
+				continue;
+		}
+
+		cwq = list_first_entry(&pool->worklist,
+				       struct cpu_workqueue_struct, pool_entry);
+		list_del_init(&cwq->pool_entry);
+		cwq->worker = worker;
+		spin_unlock_irq(&pool->lock);
+
+		spin_lock_irq(&cwq->lock);
+		cwq->thread = current;
+		if (!list_empty(&cwq->worklist))
+			run_one_work(cwq);
+		cwq->thread = NULL;
+
+		/* round robin: requeue behind the other waiting cwqs */
+		spin_lock(&pool->lock);
+		release_pooled_cwq(cwq);
+		if (!list_empty(&cwq->worklist))
+			list_add_tail(&cwq->pool_entry, &pool->worklist);
+		spin_unlock(&pool->lock);
+		spin_unlock_irq(&cwq->lock);
+
+		spin_lock_irq(&pool->lock);
+	}
+	spin_unlock_irq(&pool->lock);
+
+	current->flags &= ~PF_WQ_WORKER;
+
+	/* our worker struct is freed by whoever stops us */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+/*
+ * Run every work of @cwq, unless a pool worker got to it since the
+ * mayday was sent.
+ */
+static void rescue_cwq(struct worker *rescuer,
+		       struct cpu_workqueue_struct *cwq, int cpu)
+{
+	struct worker_pool *pool = cwq->pool;
+
+	/* run where the works were queued, unless the CPU went away */
+	set_cpus_allowed_ptr(current, cpumask_of(cpu));
+
+	spin_lock_irq(&cwq->lock);
+	spin_lock(&pool->lock);
+	cwq->mayday = 0;
+	if (cwq->worker || list_empty(&cwq->pool_entry)) {
+		spin_unlock(&pool->lock);
+		spin_unlock_irq(&cwq->lock);
+		return;
+	}
+	list_del_init(&cwq->pool_entry);
+	cwq->worker = rescuer;
+	spin_unlock(&pool->lock);
+
+	cwq->thread = current;
+	while (!list_empty(&cwq->worklist))
+		run_one_work(cwq);
+	cwq->thread = NULL;
+
+	spin_lock(&pool->lock);
+	release_pooled_cwq(cwq);
+	spin_unlock(&pool->lock);
+	spin_unlock_irq(&cwq->lock);
+}
+
+static int rescuer_thread(void *__wq)
+{
+	struct workqueue_struct *wq = __wq;
+	struct cpu_workqueue_struct *cwq;
+	int cpu, rescued;
+
+	for (;;) {
+		/* a mayday sent after we looked at its cwq wakes us up */
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+
+		rescued = 0;
+		for_each_cpu(cpu, cpu_populated_map) {
+			cwq = per_cpu_ptr(wq->cpu_wq, cpu);
+			if (!ACCESS_ONCE(cwq->mayday))
+				continue;
+			__set_current_state(TASK_RUNNING);
+			rescue_cwq(wq->rescuer, cwq, cpu);
+			rescued = 1;
+		}
+		if (!rescued)
+			schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
 struct wq_barrier {
 	struct work_struct	work;
 	struct completion	done;
@@ -782,10 +1289,36 @@ init_cpu_workqueue(struct workqueue_struct *wq, int cpu)
 	spin_lock_init(&cwq->lock);
 	INIT_LIST_HEAD(&cwq->worklist);
 	init_waitqueue_head(&cwq->more_work);
+	INIT_LIST_HEAD(&cwq->pool_entry);
+	if (is_wq_pooled(wq))
+		cwq->pool = &per_cpu(worker_pools, cpu);
 
 	return cwq;
 }
 
+static int create_rescuer(struct workqueue_struct *wq)
+{
+	struct worker *rescuer;
+
+	rescuer = kzalloc(sizeof(*rescuer), GFP_KERNEL);
+	if (!rescuer)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&rescuer->entry);
+	INIT_LIST_HEAD(&rescuer->node);
+	rescuer->task = kthread_create(rescuer_thread, wq, "%s", wq->name);
+	if (IS_ERR(rescuer->task)) {
+		int err = PTR_ERR(rescuer->task);
+
+		kfree(rescuer);
+		return err;
+	}
+	wq->rescuer = rescuer;
+	wake_up_process(rescuer->task);
+
+	return 0;
+}
+
 static int create_workqueue_thread(struct cpu_workqueue_struct *cwq, int cpu)
 {
 	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
@@ -793,6 +1326,9 @@ static int create_workqueue_thread(struct cpu_workqueue_struct *cwq, int cpu)
 	const char *fmt = is_wq_single_threaded(wq) ? "%s" : "%s/%d";
 	struct task_struct *p;
 
+	if (cwq->pool)
+		return 0;
+
 	p = kthread_create(worker_thread, cwq, fmt, wq->name, cpu);
 	/*
 	 * Nobody can add the work_struct to this cwq,
@@ -817,6 +1353,9 @@ static void start_workqueue_thread(struct cpu_workqueue_struct *cwq, int cpu)
 {
 	struct task_struct *p = cwq->thread;
 
+	if (cwq->pool)
+		return;
+
 	if (p != NULL) {
 		if (cpu >= 0)
 			kthread_bind(p, cpu);
@@ -852,6 +1391,12 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 	wq->rt = rt;
 	INIT_LIST_HEAD(&wq->list);
 
+	if (is_wq_pooled(wq) && create_rescuer(wq)) {
+		free_percpu(wq->cpu_wq);
+		kfree(wq);
+		return NULL;
+	}
+
 	if (singlethread) {
 		cwq = init_cpu_workqueue(wq, singlethread_cpu);
 		err = create_workqueue_thread(cwq, singlethread_cpu);
@@ -893,6 +1438,19 @@ EXPORT_SYMBOL_GPL(__create_workqueue_key);
 
 static void cleanup_workqueue_thread(struct cpu_workqueue_struct *cwq)
 {
+	/*
+	 * Pooled cwqs have no thread of their own, just drain them and
+	 * make sure no worker still looks at them.
+	 */
+	if (cwq->pool) {
+		lock_map_acquire(&cwq->wq->lockdep_map);
+		lock_map_release(&cwq->wq->lockdep_map);
+
+		flush_cpu_workqueue(cwq);
+		wait_on_pooled_cwq(cwq);
+		return;
+	}
+
 	/*
 	 * Our caller is either destroy_workqueue() or CPU_POST_DEAD,
 	 * cpu_add_remove_lock protects cwq->thread.
@@ -939,11 +1497,46 @@ void destroy_workqueue(struct workqueue_struct *wq)
 		cleanup_workqueue_thread(per_cpu_ptr(wq->cpu_wq, cpu));
  	cpu_maps_update_done();
 
+	if (wq->rescuer) {
+		kthread_stop(wq->rescuer->task);
+		kfree(wq->rescuer);
+	}
+
 	free_percpu(wq->cpu_wq);
 	kfree(wq);
 }
 EXPORT_SYMBOL_GPL(destroy_workqueue);
 
+/*
+ * Give the pool of @cpu its first idle worker.  Whatever ran on it before
+ * the CPU went down is gone, so start the accounting afresh.
+ */
+static int prepare_worker_pool(int cpu)
+{
+	struct worker_pool *pool = &per_cpu(worker_pools, cpu);
+
+	spin_lock_irq(&pool->lock);
+	pool->dead = 0;
+	pool->nr_workers = 0;
+	pool->nr_idle = 0;
+	atomic_set(&pool->nr_running, 0);
+	spin_unlock_irq(&pool->lock);
+
+	return create_worker(pool, 0) ? 0 : -ENOMEM;
+}
+
+static void start_worker_pool(int cpu)
+{
+	struct worker_pool *pool = &per_cpu(worker_pools, cpu);
+	struct worker *worker;
+
+	/* only the worker prepare_worker_pool() made can be there yet */
+	spin_lock_irq(&pool->lock);
+	worker = list_first_entry(&pool->workers, struct worker, node);
+	start_worker(worker);
+	spin_unlock_irq(&pool->lock);
+}
+
 static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 						unsigned long action,
 						void *hcpu)
@@ -957,7 +1550,16 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 
 	switch (action) {
 	case CPU_UP_PREPARE:
+		if (prepare_worker_pool(cpu)) {
+			printk(KERN_ERR "workqueue pool for %i failed\n", cpu);
+			return NOTIFY_BAD;
+		}
 		cpumask_set_cpu(cpu, cpu_populated_map);
+		break;
+
+	case CPU_ONLINE:
+		start_worker_pool(cpu);
+		break;
 	}
 undo:
 	list_for_each_entry(wq, &workqueues, list) {
@@ -988,6 +1590,7 @@ undo:
 	switch (action) {
 	case CPU_UP_CANCELED:
 	case CPU_POST_DEAD:
+		destroy_pool_workers(&per_cpu(worker_pools, cpu));
 		cpumask_clear_cpu(cpu, cpu_populated_map);
 	}
 
@@ -1043,6 +1646,25 @@ EXPORT_SYMBOL_GPL(work_on_cpu);
 
 void __init init_workqueues(void)
 {
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct worker_pool *pool = &per_cpu(worker_pools, cpu);
+
+		spin_lock_init(&pool->lock);
+		pool->cpu = cpu;
+		pool->dead = 1;
+		INIT_LIST_HEAD(&pool->worklist);
+		INIT_LIST_HEAD(&pool->idle_list);
+		INIT_LIST_HEAD(&pool->workers);
+		setup_timer(&pool->mayday_timer, pool_mayday_timeout,
+			    (unsigned long)pool);
+	}
+	for_each_online_cpu(cpu) {
+		BUG_ON(prepare_worker_pool(cpu));
+		start_worker_pool(cpu);
+	}
+
 	alloc_cpumask_var(&cpu_populated_map, GFP_KERNEL);
 
 	cpumask_copy(cpu_populated_map, cpu_online_mask);
@@ -514,9 +514,100 @@ static wait_queue_head_t *page_waitqueue(struct page *page)
 	return &zone->wait_table[hash_ptr(page, zone->wait_table_bits)];
 }
 
+/*
+ * PG_waiters lets unlock_page() and end_page_writeback() skip the hashed
+ * waitqueue, and its lock, when nobody sleeps on the page.  A sleeper sets
+ * it only once it is on the waitqueue, then tests its bit again after a full
+ * barrier; the waker clears its bit, then tests PG_waiters after a barrier.
+ * One of the two always sees the other.  The waker clears PG_waiters again
+ * under the queue lock once no sleeper on this page is left in the bucket.
+ */
+static inline void page_set_waiters(struct page *page)
+{
+	SetPageWaiters(page);
+	smp_mb();
+}
+
+/*
+ * Is anybody on @wq still waiting on @page?  Waiters queued through
+ * add_page_wait_queue() can't be told apart, so they always count.
+ * Called with wq->lock held.
+ */
+static int page_waiters_queued(wait_queue_head_t *wq, struct page *page)
+{
+	wait_queue_t *curr;
+
+	list_for_each_entry(curr, &wq->task_list, task_list) {
+		struct wait_bit_queue *wb;
+
+		if (curr->func != wake_bit_function)
+			return 1;
+		wb = container_of(curr, struct wait_bit_queue, wait);
+		if (wb->key.flags == &page->flags)
+			return 1;
+	}
+	return 0;
+}
+
 static inline void wake_up_page(struct page *page, int bit)
 {
-	__wake_up_bit(page_waitqueue(page), &page->flags, bit);
+	struct wait_bit_key key = __WAIT_BIT_KEY_INITIALIZER(&page->flags, bit);
+	wait_queue_head_t *wq;
+	unsigned long flags;
+
+	if (!PageWaiters(page))
+		return;
+
+	wq = page_waitqueue(page);
+	spin_lock_irqsave(&wq->lock, flags);
+	__wake_up_locked_key(wq, TASK_NORMAL, &key);
+	if (!page_waiters_queued(wq, page))
+		ClearPageWaiters(page);
+	spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/*
+ * __wait_on_bit() and __wait_on_bit_lock() for page bits: as above, the
+ * page must be marked PG_waiters between queueing and testing the bit.
+ */
+static int __sched __wait_on_page_bit(struct page *page,
+			struct wait_bit_queue *q, int (*action)(void *),
+			unsigned mode)
+{
+	wait_queue_head_t *wq = page_waitqueue(page);
+	int ret = 0;
+
+	do {
+		prepare_to_wait(wq, &q->wait, mode);
+		page_set_waiters(page);
+		if (test_bit(q->key.bit_nr, q->key.flags))
+			ret = (*action)(q->key.flags);
+	} while (test_bit(q->key.bit_nr, q->key.flags) && !ret);
+	finish_wait(wq, &q->wait);
+	return ret;
+}
+
+static int __sched __wait_on_page_bit_lock(struct page *page,
+			struct wait_bit_queue *q, int (*action)(void *),
+			unsigned mode)
+{
+	wait_queue_head_t *wq = page_waitqueue(page);
+
+	do {
+		int ret;
+
+		prepare_to_wait_exclusive(wq, &q->wait, mode);
+		page_set_waiters(page);
+		if (!test_bit(q->key.bit_nr, q->key.flags))
+			continue;
+		ret = (*action)(q->key.flags);
+		if (!ret)
+			continue;
+		abort_exclusive_wait(wq, &q->wait, mode, &q->key);
+		return ret;
+	} while (test_and_set_bit(q->key.bit_nr, q->key.flags));
+	finish_wait(wq, &q->wait);
+	return 0;
 }
 
 void wait_on_page_bit(struct page *page, int bit_nr)
@@ -524,7 +615,7 @@ void wait_on_page_bit(struct page *page, int bit_nr)
 	DEFINE_WAIT_BIT(wait, &page->flags, bit_nr);
 
 	if (test_bit(bit_nr, &page->flags))
-		__wait_on_bit(page_waitqueue(page), &wait, sync_page,
+		__wait_on_page_bit(page, &wait, sync_page,
 							TASK_UNINTERRUPTIBLE);
 }
 EXPORT_SYMBOL(wait_on_page_bit);
@@ -543,6 +634,7 @@ void add_page_wait_queue(struct page *page, wait_queue_t *waiter)
 
 	spin_lock_irqsave(&q->lock, flags);
 	__add_wait_queue(q, waiter);
+	SetPageWaiters(page);
 	spin_unlock_irqrestore(&q->lock, flags);
 }
 EXPORT_SYMBOL_GPL(add_page_wait_queue);
@@ -598,8 +690,7 @@ void __lock_page(struct page *page)
 {
 	DEFINE_WAIT_BIT(wait, &page->flags, PG_locked);
 
-	__wait_on_bit_lock(page_waitqueue(page), &wait, sync_page,
-							TASK_UNINTERRUPTIBLE);
+	__wait_on_page_bit_lock(page, &wait, sync_page, TASK_UNINTERRUPTIBLE);
 }
 EXPORT_SYMBOL(__lock_page);
 
@@ -607,7 +698,7 @@ int __lock_page_killable(struct page *page)
 {
 	DEFINE_WAIT_BIT(wait, &page->flags, PG_locked);
 
-	return __wait_on_bit_lock(page_waitqueue(page), &wait,
+	return __wait_on_page_bit_lock(page, &wait,
 					sync_page_killable, TASK_KILLABLE);
 }
 EXPORT_SYMBOL_GPL(__lock_page_killable);
@@ -622,7 +713,7 @@ EXPORT_SYMBOL_GPL(__lock_page_killable);
 void __lock_page_nosync(struct page *page)
 {
 	DEFINE_WAIT_BIT(wait, &page->flags, PG_locked);
-	__wait_on_bit_lock(page_waitqueue(page), &wait, __sleep_on_page_lock,
+	__wait_on_page_bit_lock(page, &wait, __sleep_on_page_lock,
 							TASK_UNINTERRUPTIBLE);
 }
 
@@ -38,6 +38,8 @@
 #include <linux/vmalloc.h>
 #include <linux/mm_inline.h>
 #include <linux/page_cgroup.h>
+#include <linux/random.h>
+#include <linux/math64.h>
 #include "internal.h"
 
 #include <asm/uaccess.h>
@@ -222,6 +224,11 @@ struct mem_cgroup {
 
 	unsigned int	swappiness;
 
+	/*
+	 * memory tickets for inverse lottery reclaim
+	 */
+	unsigned long long tickets;
+
 	/* set when res.limit == memsw.limit */
 	bool		memsw_is_minimum;
 
@@ -238,6 +245,19 @@ struct mem_cgroup {
 #define	MEM_CGROUP_MAX_RECLAIM_LOOPS		(100)
 #define	MEM_CGROUP_MAX_SOFT_LIMIT_RECLAIM_LOOPS	(2)
 
+/*
+ * Inverse lottery reclaim draws the victim of each reclaim batch with
+ * probability proportional to (pages in the zone / tickets). Weights are
+ * fixed point with MEM_CGROUP_LOTTERY_SHIFT fractional bits. Tickets are
+ * capped so that a group with pages never gets a weight of 0, which would
+ * make it immune to reclaim.
+ */
+#define MEM_CGROUP_DEFAULT_TICKETS	(1)
+#define MEM_CGROUP_LOTTERY_SHIFT	(16)
+#define MEM_CGROUP_MAX_TICKETS		(1ULL << MEM_CGROUP_LOTTERY_SHIFT)
+
+int sysctl_memcg_lottery_reclaim __read_mostly;
+
 enum charge_type {
 	MEM_CGROUP_CHARGE_TYPE_CACHE = 0,
 	MEM_CGROUP_CHARGE_TYPE_MAPPED,
@@ -2217,6 +2237,97 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 	return ret;
 }
 
+/*
+ * Weight of a memcg in the inverse lottery for the given zone.
+ */
+static u64 mem_cgroup_lottery_weight(struct mem_cgroup *mem, int nid, int zid)
+{
+	struct mem_cgroup_per_zone *mz = mem_cgroup_zoneinfo(mem, nid, zid);
+	unsigned long pages = 0;
+	enum lru_list l;
+
+	for_each_evictable_lru(l)
+		pages += MEM_CGROUP_ZSTAT(mz, l);
+
+	return div64_u64((u64)pages << MEM_CGROUP_LOTTERY_SHIFT, mem->tickets);
+}
+
+/*
+ * Draw the victim among all memcgs. Returns it with a css reference held, or
+ * NULL if no memcg has pages in the zone.
+ */
+static struct mem_cgroup *mem_cgroup_lottery_select_victim(int nid, int zid)
+{
+	struct cgroup_subsys_state *css;
+	struct mem_cgroup *mem, *victim = NULL;
+	u64 total = 0, weight, lottery;
+	int nextid, found;
+
+	rcu_read_lock();
+	nextid = 1;
+	while ((css = css_get_next(&mem_cgroup_subsys, nextid,
+				   &root_mem_cgroup->css, &found))) {
+		mem = container_of(css, struct mem_cgroup, css);
+		total += mem_cgroup_lottery_weight(mem, nid, zid);
+		nextid = found + 1;
+	}
+
+	if (!total)
+		goto out;
+
+	lottery = (u64)random32() << 32 | random32();
+	lottery -= div64_u64(lottery, total) * total;
+
+	/*
+	 * Groups may come and go between the two walks, in which case the
+	 * last live group with pages wins.
+	 */
+	nextid = 1;
+	while ((css = css_get_next(&mem_cgroup_subsys, nextid,
+				   &root_mem_cgroup->css, &found))) {
+		mem = container_of(css, struct mem_cgroup, css);
+		nextid = found + 1;
+		weight = mem_cgroup_lottery_weight(mem, nid, zid);
+		if (!weight || !css_tryget(css))
+			continue;
+		if (victim)
+			css_put(&victim->css);
+		victim = mem;
+		if (lottery < weight)
+			break;
+		lottery -= weight;
+	}
+out:
+	rcu_read_unlock();
+	return victim;
+}
+
+/*
+ * Reclaim a batch from the zone out of a memcg drawn by inverse lottery.
+ * Groups using more pages than their tickets pay for are drawn more often.
+ */
+static unsigned long mem_cgroup_lottery_reclaim(struct zone *zone,
+						gfp_t gfp_mask, int nid,
+						int zid)
+{
+	unsigned long nr_reclaimed = 0;
+	struct mem_cgroup *victim;
+	int loop;
+
+	for (loop = 0; loop <= MEM_CGROUP_MAX_SOFT_LIMIT_RECLAIM_LOOPS &&
+		       !nr_reclaimed; loop++) {
+		victim = mem_cgroup_lottery_select_victim(nid, zid);
+		if (!victim)
+			break;
+
+		nr_reclaimed += mem_cgroup_shrink_node_zone(victim, gfp_mask,
+					victim->memsw_is_minimum,
+					get_swappiness(victim), zone, nid);
+		css_put(&victim->css);
+	}
+	return nr_reclaimed;
+}
+
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 						gfp_t gfp_mask, int nid,
 						int zid)
@@ -2231,6 +2342,9 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 	if (order > 0)
 		return 0;
 
+	if (sysctl_memcg_lottery_reclaim)
+		return mem_cgroup_lottery_reclaim(zone, gfp_mask, nid, zid);
+
 	mctz = soft_limit_tree_node_zone(nid, zid);
 	/*
 	 * This loop can run a while, specially if mem_cgroup's continuously
@@ -2843,6 +2957,24 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+static u64 mem_cgroup_tickets_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	return memcg->tickets;
+}
+
+static int mem_cgroup_tickets_write(struct cgroup *cgrp, struct cftype *cft,
+				    u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	if (!val || val > MEM_CGROUP_MAX_TICKETS)
+		return -EINVAL;
+
+	memcg->tickets = val;
+	return 0;
+}
 
 static struct cftype mem_cgroup_files[] = {
 	{
@@ -2892,6 +3024,11 @@ static struct cftype mem_cgroup_files[] = {
 		.read_u64 = mem_cgroup_swappiness_read,
 		.write_u64 = mem_cgroup_swappiness_write,
 	},
+	{
+		.name = "tickets",
+		.read_u64 = mem_cgroup_tickets_read,
+		.write_u64 = mem_cgroup_tickets_write,
+	},
 };
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_SWAP
@@ -3131,6 +3268,7 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 
 	if (parent)
 		mem->swappiness = get_swappiness(parent);
+	mem->tickets = MEM_CGROUP_DEFAULT_TICKETS;
 	atomic_set(&mem->refcnt, 1);
 	return &mem->css;
 free_out:
@@ -2807,16 +2807,29 @@ void build_all_zonelists(void)
  * Helper functions to size the waitqueue hash table.
  * Essentially these want to choose hash table sizes sufficiently
  * large so that collisions trying to wait on pages are rare.
- * But in fact, the number of active page waitqueues on typical
- * systems is ridiculously low, less than 200. So this is even
- * conservative, even though it seems large.
+ * Large file servers keep thousands of pages locked or under writeback
+ * at once, though, and every unlock_page() walks the whole bucket it
+ * hashes to, so the table keeps growing with the zone (each zone's table
+ * lives on its own node) up to WAIT_TABLE_MAX_ENTRIES.
  *
  * The constant PAGES_PER_WAITQUEUE specifies the ratio of pages to
  * waitqueues, i.e. the size of the waitq table given the number of pages.
  */
 #define PAGES_PER_WAITQUEUE	256
+#define WAIT_TABLE_MAX_ENTRIES	(1UL << 16)
 
 #ifndef CONFIG_MEMORY_HOTPLUG
+#define WAIT_TABLE_MIN_ENTRIES	4UL
+#else
+/*
+ * A zone's size might be changed by hot-add, so it is not possible to determine
+ * a suitable size for its wait_table from its boot-time size alone.  Give
+ * every zone at least the 4096 entries a 2G zone (4K pages) would get, which
+ * is 96Kbyte on x86-64 with preemption, and size bigger zones by their pages.
+ */
+#define WAIT_TABLE_MIN_ENTRIES	4096UL
+#endif
+
 static inline unsigned long wait_table_hash_nr_entries(unsigned long pages)
 {
 	unsigned long size = 1;
@@ -2826,38 +2839,10 @@ static inline unsigned long wait_table_hash_nr_entries(unsigned long pages)
 	while (size < pages)
 		size <<= 1;
 
-	/*
-	 * Once we have dozens or even hundreds of threads sleeping
-	 * on IO we've got bigger problems than wait queue collision.
-	 * Limit the size of the wait table to a reasonable size.
-	 */
-	size = min(size, 4096UL);
+	size = min(size, WAIT_TABLE_MAX_ENTRIES);
 
-	return max(size, 4UL);
-}
-#else
-/*
- * A zone's size might be changed by hot-add, so it is not possible to determine
- * a suitable size for its wait_table.  So we use the maximum size now.
- *
- * The max wait table size = 4096 x sizeof(wait_queue_head_t).   ie:
- *
- *    i386 (preemption config)    : 4096 x 16 = 64Kbyte.
- *    ia64, x86-64 (no preemption): 4096 x 20 = 80Kbyte.
- *    ia64, x86-64 (preemption)   : 4096 x 24 = 96Kbyte.
- *
- * The maximum entries are prepared when a zone's memory is (512K + 256) pages
- * or more by the traditional way. (See above).  It equals:
- *
- *    i386, x86-64, powerpc(4K page size) : =  ( 2G + 1M)byte.
- *    ia64(16K page size)                 : =  ( 8G + 4M)byte.
- *    powerpc (64K page size)             : =  (32G +16M)byte.
- */
-static inline unsigned long wait_table_hash_nr_entries(unsigned long pages)
-{
-	return 4096UL;
+	return max(size, WAIT_TABLE_MIN_ENTRIES);
 }
-#endif
 
 /*
  * This is an integer logarithm so that shifts can be used later
@@ -0,0 +1,644 @@
+/*
+ * net/sched/sch_lottery.c	Lottery scheduler
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * Each class holds tickets. The next class to dequeue from is drawn among
+ * the backlogged classes with probability proportional to its tickets, the
+ * same semantics the SCHED_LOTTERY CPU scheduler uses.
+ *
+ * A class whose last packet was shorter than its quantum gets compensation
+ * tickets, inflating its tickets by quantum / len until it is drawn again,
+ * so the share holds in bytes rather than packets. The quantum is capped at
+ * LOTTERY_MAX_QUANTUM, so a class holds less than 2^48 tickets and the sums
+ * over the at most 2^16 classes of a qdisc fit in a u64.
+ *
+ * Backlogged classes live in an rbtree augmented with the ticket sum of each
+ * subtree, so a draw, an enqueue and a dequeue are O(log n) in the number of
+ * backlogged classes.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/netdevice.h>
+#include <linux/pkt_sched.h>
+#include <linux/rbtree_augmented.h>
+#include <linux/math64.h>
+#include <net/sch_generic.h>
+#include <net/pkt_sched.h>
+#include <net/pkt_cls.h>
+
+#define LOTTERY_MAX_QUANTUM	(64 * 1024)
+
+struct lottery_class {
+	struct Qdisc_class_common	common;
+	unsigned int			refcnt;
+	unsigned int			filter_cnt;
+
+	struct gnet_stats_basic_packed		bstats;
+	struct gnet_stats_queue		qstats;
+	struct gnet_stats_rate_est	rate_est;
+	struct rb_node			anode;
+	struct Qdisc			*qdisc;
+
+	u32				tickets;
+	u32				quantum;
+	u64				eff_tickets;	/* including compensation */
+	u64				subtree_tickets;
+};
+
+struct lottery_sched {
+	struct rb_root			active;
+	struct tcf_proto		*filter_list;
+	struct Qdisc_class_hash		clhash;
+};
+
+static inline u64 lottery_subtree_tickets(struct rb_node *node)
+{
+	if (node == NULL)
+		return 0;
+	return rb_entry(node, struct lottery_class, anode)->subtree_tickets;
+}
+
+static inline u64 lottery_compute_subtree(struct lottery_class *cl)
+{
+	return cl->eff_tickets +
+	       lottery_subtree_tickets(cl->anode.rb_left) +
+	       lottery_subtree_tickets(cl->anode.rb_right);
+}
+
+RB_DECLARE_CALLBACKS(static, lottery_augment_cb, struct lottery_class, anode,
+		     u64, subtree_tickets, lottery_compute_subtree)
+
+static struct lottery_class *lottery_find_class(struct Qdisc *sch, u32 classid)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct Qdisc_class_common *clc;
+
+	clc = qdisc_class_find(&q->clhash, classid);
+	if (clc == NULL)
+		return NULL;
+	return container_of(clc, struct lottery_class, common);
+}
+
+static void lottery_activate(struct lottery_sched *q, struct lottery_class *cl)
+{
+	struct rb_node **p = &q->active.rb_node, *parent = NULL;
+	struct lottery_class *pcl;
+
+	cl->eff_tickets = cl->tickets;
+	cl->subtree_tickets = cl->eff_tickets;
+
+	while (*p) {
+		parent = *p;
+		pcl = rb_entry(parent, struct lottery_class, anode);
+		pcl->subtree_tickets += cl->eff_tickets;
+		if (cl->common.classid < pcl->common.classid)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&cl->anode, parent, p);
+	rb_insert_augmented(&cl->anode, &q->active, &lottery_augment_cb);
+}
+
+static void lottery_deactivate(struct lottery_sched *q,
+			       struct lottery_class *cl)
+{
+	rb_erase_augmented(&cl->anode, &q->active, &lottery_augment_cb);
+}
+
+static void lottery_set_eff_tickets(struct lottery_class *cl, u64 eff_tickets)
+{
+	cl->eff_tickets = eff_tickets;
+	lottery_augment_cb_propagate(&cl->anode, NULL);
+}
+
+static struct lottery_class *lottery_draw(struct lottery_sched *q)
+{
+	struct rb_node *node = q->active.rb_node;
+	struct lottery_class *cl;
+	u64 lottery, left;
+
+	if (node == NULL)
+		return NULL;
+
+	lottery = (u64)net_random() << 32 | net_random();
+	lottery -= div64_u64(lottery, lottery_subtree_tickets(node)) *
+		   lottery_subtree_tickets(node);
+
+	while (node) {
+		cl = rb_entry(node, struct lottery_class, anode);
+		left = lottery_subtree_tickets(node->rb_left);
+		if (lottery < left)
+			node = node->rb_left;
+		else if (lottery < left + cl->eff_tickets)
+			return cl;
+		else {
+			lottery -= left + cl->eff_tickets;
+			node = node->rb_right;
+		}
+	}
+	return NULL;
+}
+
+static void lottery_purge_queue(struct lottery_class *cl)
+{
+	unsigned int len = cl->qdisc->q.qlen;
+
+	qdisc_reset(cl->qdisc);
+	qdisc_tree_decrease_qlen(cl->qdisc, len);
+}
+
+static const struct nla_policy lottery_policy[TCA_LOTTERY_MAX + 1] = {
+	[TCA_LOTTERY_TICKETS]	= { .type = NLA_U32 },
+	[TCA_LOTTERY_QUANTUM]	= { .type = NLA_U32 },
+};
+
+static int lottery_change_class(struct Qdisc *sch, u32 classid, u32 parentid,
+				struct nlattr **tca, unsigned long *arg)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl = (struct lottery_class *)*arg;
+	struct nlattr *opt = tca[TCA_OPTIONS];
+	struct nlattr *tb[TCA_LOTTERY_MAX + 1];
+	u32 tickets, quantum;
+	int err;
+
+	if (!opt)
+		return -EINVAL;
+
+	err = nla_parse_nested(tb, TCA_LOTTERY_MAX, opt, lottery_policy);
+	if (err < 0)
+		return err;
+
+	if (tb[TCA_LOTTERY_TICKETS]) {
+		tickets = nla_get_u32(tb[TCA_LOTTERY_TICKETS]);
+		if (tickets == 0)
+			return -EINVAL;
+	} else
+		tickets = 1;
+
+	if (tb[TCA_LOTTERY_QUANTUM]) {
+		quantum = nla_get_u32(tb[TCA_LOTTERY_QUANTUM]);
+		if (quantum == 0 || quantum > LOTTERY_MAX_QUANTUM)
+			return -EINVAL;
+	} else
+		quantum = min_t(u32, psched_mtu(qdisc_dev(sch)),
+				LOTTERY_MAX_QUANTUM);
+
+	if (cl != NULL) {
+		if (tca[TCA_RATE]) {
+			err = gen_replace_estimator(&cl->bstats, &cl->rate_est,
+						    qdisc_root_sleeping_lock(sch),
+						    tca[TCA_RATE]);
+			if (err)
+				return err;
+		}
+
+		sch_tree_lock(sch);
+		if (tb[TCA_LOTTERY_QUANTUM])
+			cl->quantum = quantum;
+		if (tb[TCA_LOTTERY_TICKETS]) {
+			cl->tickets = tickets;
+			if (cl->qdisc->q.qlen)
+				lottery_set_eff_tickets(cl, tickets);
+		}
+		sch_tree_unlock(sch);
+
+		return 0;
+	}
+
+	cl = kzalloc(sizeof(struct lottery_class), GFP_KERNEL);
+	if (cl == NULL)
+		return -ENOBUFS;
+
+	cl->refcnt	   = 1;
+	cl->common.classid = classid;
+	cl->tickets	   = tickets;
+	cl->quantum	   = quantum;
+	cl->qdisc	   = qdisc_create_dflt(qdisc_dev(sch), sch->dev_queue,
+					       &pfifo_qdisc_ops, classid);
+	if (cl->qdisc == NULL)
+		cl->qdisc = &noop_qdisc;
+
+	if (tca[TCA_RATE]) {
+		err = gen_replace_estimator(&cl->bstats, &cl->rate_est,
+					    qdisc_root_sleeping_lock(sch),
+					    tca[TCA_RATE]);
+		if (err) {
+			qdisc_destroy(cl->qdisc);
+			kfree(cl);
+			return err;
+		}
+	}
+
+	sch_tree_lock(sch);
+	qdisc_class_hash_insert(&q->clhash, &cl->common);
+	sch_tree_unlock(sch);
+
+	qdisc_class_hash_grow(sch, &q->clhash);
+
+	*arg = (unsigned long)cl;
+	return 0;
+}
+
+static void lottery_destroy_class(struct Qdisc *sch, struct lottery_class *cl)
+{
+	gen_kill_estimator(&cl->bstats, &cl->rate_est);
+	qdisc_destroy(cl->qdisc);
+	kfree(cl);
+}
+
+static int lottery_delete_class(struct Qdisc *sch, unsigned long arg)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl = (struct lottery_class *)arg;
+
+	if (cl->filter_cnt > 0)
+		return -EBUSY;
+
+	sch_tree_lock(sch);
+
+	lottery_purge_queue(cl);
+	qdisc_class_hash_remove(&q->clhash, &cl->common);
+
+	BUG_ON(--cl->refcnt == 0);
+	/*
+	 * This shouldn't happen: we "hold" one cops->get() when called
+	 * from tc_ctl_tclass; the destroy method is done from cops->put().
+	 */
+
+	sch_tree_unlock(sch);
+	return 0;
+}
+
+static unsigned long lottery_get_class(struct Qdisc *sch, u32 classid)
+{
+	struct lottery_class *cl = lottery_find_class(sch, classid);
+
+	if (cl != NULL)
+		cl->refcnt++;
+
+	return (unsigned long)cl;
+}
+
+static void lottery_put_class(struct Qdisc *sch, unsigned long arg)
+{
+	struct lottery_class *cl = (struct lottery_class *)arg;
+
+	if (--cl->refcnt == 0)
+		lottery_destroy_class(sch, cl);
+}
+
+static struct tcf_proto **lottery_tcf_chain(struct Qdisc *sch,
+					    unsigned long cl)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+
+	if (cl)
+		return NULL;
+
+	return &q->filter_list;
+}
+
+static unsigned long lottery_bind_tcf(struct Qdisc *sch, unsigned long parent,
+				      u32 classid)
+{
+	struct lottery_class *cl = lottery_find_class(sch, classid);
+
+	if (cl != NULL)
+		cl->filter_cnt++;
+
+	return (unsigned long)cl;
+}
+
+static void lottery_unbind_tcf(struct Qdisc *sch, unsigned long arg)
+{
+	struct lottery_class *cl = (struct lottery_class *)arg;
+
+	cl->filter_cnt--;
+}
+
+static int lottery_graft_class(struct Qdisc *sch, unsigned long arg,
+			       struct Qdisc *new, struct Qdisc **old)
+{
+	struct lottery_class *cl = (struct lottery_class *)arg;
+
+	if (new == NULL) {
+		new = qdisc_create_dflt(qdisc_dev(sch), sch->dev_queue,
+					&pfifo_qdisc_ops, cl->common.classid);
+		if (new == NULL)
+			new = &noop_qdisc;
+	}
+
+	sch_tree_lock(sch);
+	lottery_purge_queue(cl);
+	*old = cl->qdisc;
+	cl->qdisc = new;
+	sch_tree_unlock(sch);
+	return 0;
+}
+
+static struct Qdisc *lottery_class_leaf(struct Qdisc *sch, unsigned long arg)
+{
+	struct lottery_class *cl = (struct lottery_class *)arg;
+
+	return cl->qdisc;
+}
+
+static void lottery_qlen_notify(struct Qdisc *sch, unsigned long arg)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl = (struct lottery_class *)arg;
+
+	if (cl->qdisc->q.qlen == 0)
+		lottery_deactivate(q, cl);
+}
+
+static int lottery_dump_class(struct Qdisc *sch, unsigned long arg,
+			      struct sk_buff *skb, struct tcmsg *tcm)
+{
+	struct lottery_class *cl = (struct lottery_class *)arg;
+	struct nlattr *nest;
+
+	tcm->tcm_parent	= TC_H_ROOT;
+	tcm->tcm_handle	= cl->common.classid;
+	tcm->tcm_info	= cl->qdisc->handle;
+
+	nest = nla_nest_start(skb, TCA_OPTIONS);
+	if (nest == NULL)
+		goto nla_put_failure;
+	NLA_PUT_U32(skb, TCA_LOTTERY_TICKETS, cl->tickets);
+	NLA_PUT_U32(skb, TCA_LOTTERY_QUANTUM, cl->quantum);
+	return nla_nest_end(skb, nest);
+
+nla_put_failure:
+	nla_nest_cancel(skb, nest);
+	return -EMSGSIZE;
+}
+
+static int lottery_dump_class_stats(struct Qdisc *sch, unsigned long arg,
+				    struct gnet_dump *d)
+{
+	struct lottery_class *cl = (struct lottery_class *)arg;
+	struct tc_lottery_stats xstats;
+
+	memset(&xstats, 0, sizeof(xstats));
+	if (cl->qdisc->q.qlen) {
+		xstats.eff_tickets = cl->eff_tickets;
+		cl->qdisc->qstats.qlen = cl->qdisc->q.qlen;
+	}
+
+	if (gnet_stats_copy_basic(d, &cl->bstats) < 0 ||
+	    gnet_stats_copy_rate_est(d, &cl->rate_est) < 0 ||
+	    gnet_stats_copy_queue(d, &cl->qdisc->qstats) < 0)
+		return -1;
+
+	return gnet_stats_copy_app(d, &xstats, sizeof(xstats));
+}
+
+static void lottery_walk(struct Qdisc *sch, struct qdisc_walker *arg)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl;
+	struct hlist_node *n;
+	unsigned int i;
+
+	if (arg->stop)
+		return;
+
+	for (i = 0; i < q->clhash.hashsize; i++) {
+		hlist_for_each_entry(cl, n, &q->clhash.hash[i], common.hnode) {
+			if (arg->count < arg->skip) {
+				arg->count++;
+				continue;
+			}
+			if (arg->fn(sch, (unsigned long)cl, arg) < 0) {
+				arg->stop = 1;
+				return;
+			}
+			arg->count++;
+		}
+	}
+}
+
+static struct lottery_class *lottery_classify(struct sk_buff *skb,
+					      struct Qdisc *sch, int *qerr)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl;
+	struct tcf_result res;
+	int result;
+
+	if (TC_H_MAJ(skb->priority ^ sch->handle) == 0) {
+		cl = lottery_find_class(sch, skb->priority);
+		if (cl != NULL)
+			return cl;
+	}
+
+	*qerr = NET_XMIT_SUCCESS | __NET_XMIT_BYPASS;
+	result = tc_classify(skb, q->filter_list, &res);
+	if (result >= 0) {
+#ifdef CONFIG_NET_CLS_ACT
+		switch (result) {
+		case TC_ACT_QUEUED:
+		case TC_ACT_STOLEN:
+			*qerr = NET_XMIT_SUCCESS | __NET_XMIT_STOLEN;
+		case TC_ACT_SHOT:
+			return NULL;
+		}
+#endif
+		cl = (struct lottery_class *)res.class;
+		if (cl == NULL)
+			cl = lottery_find_class(sch, res.classid);
+		return cl;
+	}
+	return NULL;
+}
+
+static int lottery_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl;
+	unsigned int len;
+	int err;
+
+	cl = lottery_classify(skb, sch, &err);
+	if (cl == NULL) {
+		if (err & __NET_XMIT_BYPASS)
+			sch->qstats.drops++;
+		kfree_skb(skb);
+		return err;
+	}
+
+	len = qdisc_pkt_len(skb);
+	err = qdisc_enqueue(skb, cl->qdisc);
+	if (unlikely(err != NET_XMIT_SUCCESS)) {
+		if (net_xmit_drop_count(err)) {
+			cl->qstats.drops++;
+			sch->qstats.drops++;
+		}
+		return err;
+	}
+
+	if (cl->qdisc->q.qlen == 1)
+		lottery_activate(q, cl);
+
+	cl->bstats.packets++;
+	cl->bstats.bytes += len;
+	sch->bstats.packets++;
+	sch->bstats.bytes += len;
+
+	sch->q.qlen++;
+	return err;
+}
+
+static struct sk_buff *lottery_dequeue(struct Qdisc *sch)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl;
+	struct sk_buff *skb;
+	unsigned int len;
+
+	cl = lottery_draw(q);
+	if (cl == NULL)
+		return NULL;
+
+	skb = cl->qdisc->ops->peek(cl->qdisc);
+	if (skb == NULL)
+		return NULL;
+
+	len = qdisc_pkt_len(skb);
+	skb = qdisc_dequeue_peeked(cl->qdisc);
+	if (cl->qdisc->q.qlen == 0)
+		lottery_deactivate(q, cl);
+	else {
+		/*
+		 * Compensate a short packet so the class gets its share in
+		 * bytes: it holds quantum / len times its tickets until it
+		 * wins again.
+		 */
+		if (len && len < cl->quantum)
+			lottery_set_eff_tickets(cl, div_u64((u64)cl->tickets *
+							    cl->quantum, len));
+		else if (cl->eff_tickets != cl->tickets)
+			lottery_set_eff_tickets(cl, cl->tickets);
+	}
+
+	sch->q.qlen--;
+	return skb;
+}
+
+static unsigned int lottery_drop(struct Qdisc *sch)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl;
+	struct rb_node *node;
+	unsigned int len;
+
+	for (node = rb_first(&q->active); node; node = rb_next(node)) {
+		cl = rb_entry(node, struct lottery_class, anode);
+		if (cl->qdisc->ops->drop) {
+			len = cl->qdisc->ops->drop(cl->qdisc);
+			if (len > 0) {
+				sch->q.qlen--;
+				if (cl->qdisc->q.qlen == 0)
+					lottery_deactivate(q, cl);
+				return len;
+			}
+		}
+	}
+	return 0;
+}
+
+static int lottery_init_qdisc(struct Qdisc *sch, struct nlattr *opt)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	int err;
+
+	err = qdisc_class_hash_init(&q->clhash);
+	if (err < 0)
+		return err;
+	q->active = RB_ROOT;
+	return 0;
+}
+
+static void lottery_reset_qdisc(struct Qdisc *sch)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl;
+	struct hlist_node *n;
+	unsigned int i;
+
+	for (i = 0; i < q->clhash.hashsize; i++) {
+		hlist_for_each_entry(cl, n, &q->clhash.hash[i], common.hnode)
+			qdisc_reset(cl->qdisc);
+	}
+	q->active = RB_ROOT;
+	sch->q.qlen = 0;
+}
+
+static void lottery_destroy_qdisc(struct Qdisc *sch)
+{
+	struct lottery_sched *q = qdisc_priv(sch);
+	struct lottery_class *cl;
+	struct hlist_node *n, *next;
+	unsigned int i;
+
+	tcf_destroy_chain(&q->filter_list);
+
+	for (i = 0; i < q->clhash.hashsize; i++) {
+		hlist_for_each_entry_safe(cl, n, next, &q->clhash.hash[i],
+					  common.hnode)
+			lottery_destroy_class(sch, cl);
+	}
+	qdisc_class_hash_destroy(&q->clhash);
+}
+
+static const struct Qdisc_class_ops lottery_class_ops = {
+	.change		= lottery_change_class,
+	.delete		= lottery_delete_class,
+	.get		= lottery_get_class,
+	.put		= lottery_put_class,
+	.tcf_chain	= lottery_tcf_chain,
+	.bind_tcf	= lottery_bind_tcf,
+	.unbind_tcf	= lottery_unbind_tcf,
+	.graft		= lottery_graft_class,
+	.leaf		= lottery_class_leaf,
+	.qlen_notify	= lottery_qlen_notify,
+	.dump		= lottery_dump_class,
+	.dump_stats	= lottery_dump_class_stats,
+	.walk		= lottery_walk,
+};
+
+static struct Qdisc_ops lottery_qdisc_ops __read_mostly = {
+	.cl_ops		= &lottery_class_ops,
+	.id		= "lottery",
+	.priv_size	= sizeof(struct lottery_sched),
+	.enqueue	= lottery_enqueue,
+	.dequeue	= lottery_dequeue,
+	.peek		= qdisc_peek_dequeued,
+	.drop		= lottery_drop,
+	.init		= lottery_init_qdisc,
+	.reset		= lottery_reset_qdisc,
+	.destroy	= lottery_destroy_qdisc,
+	.owner		= THIS_MODULE,
+};
+
+static int __init lottery_init(void)
+{
+	return register_qdisc(&lottery_qdisc_ops);
+}
+
+static void __exit lottery_exit(void)
+{
+	unregister_qdisc(&lottery_qdisc_ops);
+}
+
+module_init(lottery_init);
+module_exit(lottery_exit);
+MODULE_LICENSE("GPL");